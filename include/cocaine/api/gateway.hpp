@@ -26,6 +26,10 @@
 
 #include <asio/ip/tcp.hpp>
 
+#include <chrono>
+#include <map>
+#include <system_error>
+
 namespace cocaine { namespace api {
 
 struct gateway_t {
@@ -80,6 +84,29 @@ struct gateway_t {
     auto
     cleanup(const std::string& uuid, const std::string& name) -> void = 0;
 
+    /**
+     * apply a batch of service updates from concrete uuid, services without endpoints are removed
+     * and the rest are added or replaced; gateways may override it to apply the whole batch at once
+     */
+    virtual
+    auto
+    update(const std::string& uuid, const std::map<std::string, service_description_t>& services) -> void {
+        for(auto it = services.begin(); it != services.end(); ++it) {
+            if(it->second.endpoints.empty()) {
+                cleanup(uuid, it->first);
+                continue;
+            }
+
+            try {
+                cleanup(uuid, it->first);
+            } catch(const std::system_error&) {
+                // The service is not registered yet.
+            }
+
+            consume(uuid, it->first, it->second.version, it->second.endpoints, it->second.protocol);
+        }
+    }
+
     /**
      * drop all services from uuid, typically it's called on node shutdown or disconnect
      */
@@ -87,6 +114,16 @@ struct gateway_t {
     auto
     cleanup(const std::string& uuid) -> void = 0;
 
+    /**
+     * feedback on the remote node responsiveness, e.g. how long it took to connect to it; gateways
+     * may use it to prefer faster nodes
+     */
+    virtual
+    auto
+    feedback(const std::string& /* uuid */, std::chrono::microseconds /* latency */) -> void {
+        // Empty.
+    }
+
     /**
      * count all services with specified name including local ones
      */
@@ -25,6 +25,8 @@
 
 #include "cocaine/idl/context.hpp"
 
+#include "cocaine/detail/timing_wheel.hpp"
+
 #include <asio/deadline_timer.hpp>
 
 #include <asio/ip/tcp.hpp>
@@ -40,12 +42,29 @@ public:
 
     // Will announce local endpoints to the specified multicast group every `interval` seconds.
     asio::deadline_timer::duration_type interval;
+
+    // Whether to send legacy msgpack announces along with the compact ones, so that nodes which
+    // don't understand the latter could still discover this one. Should be disabled once all the
+    // nodes are upgraded.
+    bool legacy;
 };
 
 class multicast_t:
     public api::cluster_t
 {
     struct announce_t;
+    struct metrics_t;
+
+    struct peer_t {
+        // Generation of the last announce received from this peer. Announces of the same generation
+        // carry the same endpoints, so they are not decoded again. Legacy announces have no
+        // generation, which is represented by zero.
+        std::uint64_t generation;
+
+        // Endpoints of the last announce, the peer is linked again on every announce, because the
+        // locator might have dropped it in the meantime.
+        std::vector<asio::ip::tcp::endpoint> endpoints;
+    };
 
     context_t& m_context;
 
@@ -60,8 +79,18 @@ class multicast_t:
     asio::ip::udp::socket m_socket;
     asio::deadline_timer m_timer;
 
-    // Announce expiration timeouts.
-    std::map<std::string, std::unique_ptr<asio::deadline_timer>> m_expirations;
+    // Local announce generation, changed whenever local endpoints change, as well as on restarts.
+    std::uint64_t m_generation;
+    std::vector<asio::ip::tcp::endpoint> m_endpoints;
+
+    // Remote peers indexed by uuid.
+    std::map<std::string, peer_t> m_peers;
+
+    // Peer expiration deadlines, all of them driven by a single periodic timer.
+    timing_wheel<std::string> m_expirations;
+    asio::deadline_timer m_expiration_timer;
+
+    std::unique_ptr<metrics_t> m_metrics;
 
     // Signal to handle context ready event
     std::shared_ptr<dispatch<io::context_tag>> m_signals;
@@ -79,8 +108,21 @@ private:
     void
     on_receive(const std::error_code& ec, size_t bytes_received, const std::shared_ptr<announce_t>& ptr);
 
+    // Refreshes and links the peer if it's already known with the same announce generation.
+    bool
+    is_known(const std::string& uuid, std::uint64_t generation);
+
+    // Same for legacy announces, which have no generation. Peers known from compact announces
+    // ignore legacy ones, other peers are known if their endpoints haven't changed.
+    bool
+    is_legacy_duplicate(const std::string& uuid, const std::vector<asio::ip::tcp::endpoint>& endpoints);
+
+    void
+    on_announce(const std::string& uuid, std::uint64_t generation,
+                const std::vector<asio::ip::tcp::endpoint>& endpoints);
+
     void
-    on_expired(const std::error_code& ec, const std::string& uuid);
+    on_expiration_tick(const std::error_code& ec);
 };
 
 }} // namespace cocaine::cluster
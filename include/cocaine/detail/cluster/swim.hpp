@@ -0,0 +1,308 @@
+/*
+    Copyright (c) 2011-2014 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2014 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef COCAINE_SWIM_CLUSTER_HPP
+#define COCAINE_SWIM_CLUSTER_HPP
+
+#include "cocaine/api/cluster.hpp"
+
+#include "cocaine/idl/context.hpp"
+
+#include <asio/deadline_timer.hpp>
+
+#include <asio/ip/tcp.hpp>
+#include <asio/ip/udp.hpp>
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace cocaine { namespace cluster {
+
+namespace swim {
+
+// SWIM-style membership protocol: every protocol period each node probes one other node, directly
+// and, if it doesn't respond in time, indirectly via a few other nodes. Unresponsive nodes become
+// suspects, and unless they refute the suspicion in time by bumping their incarnation, they are
+// declared dead. All membership changes are disseminated by piggybacking them on probe messages,
+// each one a logarithmic number of times, so they reach the whole cluster in O(log N) periods with
+// constant per-node traffic. New nodes join by asking seed nodes for a full membership snapshot.
+// Nodes also periodically exchange snapshots with a random member, so that nodes which missed the
+// gossip, e.g. after a partition or a long pause, eventually learn about each other again.
+//
+// The protocol state machine itself knows nothing about sockets or timers, which makes it possible
+// to run a whole cluster of them in one process.
+
+enum class states: std::uint8_t { alive, suspect, dead };
+
+struct update_t {
+    std::string uuid;
+
+    // Gossip endpoint of the node.
+    asio::ip::udp::endpoint gossip;
+
+    // Locator endpoints of the node.
+    std::vector<asio::ip::tcp::endpoint> endpoints;
+
+    std::uint64_t incarnation;
+    states state;
+};
+
+struct message_t {
+    enum class types: std::uint8_t { ping, ack, ping_req, join, sync };
+
+    types type;
+    std::uint64_t seq;
+
+    // Node to probe, for indirect probe requests only.
+    asio::ip::udp::endpoint target;
+
+    // Piggybacked membership updates, or the membership snapshot for sync messages.
+    std::vector<update_t> updates;
+};
+
+// Gossip datagrams are kept under a typical path MTU, so that they are never fragmented. Only an
+// update which doesn't fit on its own makes a larger one.
+const size_t max_datagram_size = 1400;
+
+std::string
+encode(const message_t& message);
+
+// Size an update takes in an encoded message.
+size_t
+encoded_size(const update_t& update);
+
+bool
+decode(const char* data, size_t size, message_t& message);
+
+struct membership_cfg_t {
+    // Protocol period and direct probe timeout.
+    std::chrono::milliseconds interval;
+    std::chrono::milliseconds timeout;
+
+    // Number of nodes asked to probe an unresponsive node.
+    size_t indirect;
+
+    // Suspects are declared dead after this many times log2(N) protocol periods.
+    unsigned int suspicion;
+
+    // Every update is piggybacked this many times log2(N) messages.
+    unsigned int retransmit;
+
+    // Maximum number of updates piggybacked on a single message.
+    size_t piggyback;
+
+    // Snapshots are exchanged with a random member every this many protocol periods, zero disables.
+    unsigned int sync;
+
+    // Gossip endpoints of the nodes to join the cluster through.
+    std::vector<asio::ip::udp::endpoint> seeds;
+};
+
+class membership_t {
+public:
+    typedef std::chrono::steady_clock clock_type;
+    typedef clock_type::time_point time_point;
+
+    struct handlers_t {
+        std::function<void(const asio::ip::udp::endpoint&, const message_t&)> send;
+
+        // Invoked when a node joins the cluster or changes its endpoints.
+        std::function<void(const std::string&, const std::vector<asio::ip::tcp::endpoint>&)> alive;
+
+        // Invoked when a node is declared dead.
+        std::function<void(const std::string&)> dead;
+    };
+
+private:
+    struct member_t {
+        update_t info;
+
+        // Suspicion timeout for suspects, or when to forget dead nodes.
+        time_point deadline;
+    };
+
+    struct probe_t {
+        bool active;
+        bool acked;
+        bool indirect;
+
+        std::string target;
+        std::uint64_t seq;
+        time_point started;
+    };
+
+    struct relay_t {
+        // Requester of the indirect probe and its probe sequence number.
+        asio::ip::udp::endpoint origin;
+        std::uint64_t seq;
+
+        time_point deadline;
+    };
+
+    const membership_cfg_t m_cfg;
+    const handlers_t m_handlers;
+
+    update_t m_self;
+
+    std::map<std::string, member_t> m_members;
+
+    // Pending updates with the number of times each of them has been sent.
+    std::map<std::string, std::pair<update_t, unsigned int>> m_gossip;
+
+    // Members are probed round-robin in random order, reshuffled on every pass.
+    std::vector<std::string> m_order;
+    size_t m_position;
+
+    probe_t m_probe;
+    std::map<std::uint64_t, relay_t> m_relays;
+
+    std::uint64_t m_seq;
+    std::uint64_t m_rounds;
+    time_point m_next_round;
+
+    std::default_random_engine m_random;
+
+public:
+    membership_t(membership_cfg_t cfg, update_t self, handlers_t handlers, time_point now);
+
+    void
+    tick(time_point now);
+
+    void
+    receive(const asio::ip::udp::endpoint& from, const message_t& message, time_point now);
+
+    // Uuids of the nodes considered alive or suspected, not including this node.
+    std::vector<std::string>
+    members() const;
+
+    std::uint64_t
+    incarnation() const {
+        return m_self.incarnation;
+    }
+
+private:
+    void
+    probe(time_point now);
+
+    void
+    join();
+
+    // Exchanges membership snapshots with a random member.
+    void
+    push_pull();
+
+    void
+    apply(const update_t& update, time_point now);
+
+    // Same, for updates from membership snapshots.
+    void
+    merge(const update_t& update, time_point now);
+
+    void
+    suspect(const std::string& uuid, time_point now);
+
+    void
+    enqueue(const update_t& update);
+
+    void
+    send(const asio::ip::udp::endpoint& target, message_t::types type, std::uint64_t seq,
+         const asio::ip::udp::endpoint& subject = asio::ip::udp::endpoint());
+
+    // Sends the full membership snapshot including this node and tombstones, split into datagrams.
+    // The first one is of the specified type, the rest are sync messages.
+    void
+    send_snapshot(const asio::ip::udp::endpoint& target, message_t::types type, std::uint64_t seq);
+
+    size_t
+    alive() const;
+
+    // Logarithm of the cluster size, used to scale timeouts and retransmissions.
+    unsigned int
+    scale() const;
+};
+
+} // namespace swim
+
+class swim_cfg_t
+{
+public:
+    // An UDP endpoint to bind for gossip.
+    asio::ip::udp::endpoint endpoint;
+
+    // Gossip endpoint advertised to other nodes, if the bound one is not routable.
+    asio::ip::udp::endpoint advertise;
+
+    swim::membership_cfg_t membership;
+};
+
+class swim_t:
+    public api::cluster_t
+{
+    struct datagram_t;
+
+    context_t& m_context;
+
+    const std::unique_ptr<logging::logger_t> m_log;
+
+    // Interoperability with the locator service.
+    interface& m_locator;
+
+    const mode_t m_mode;
+
+    // Component config.
+    const swim_cfg_t m_cfg;
+
+    asio::ip::udp::socket m_socket;
+    asio::deadline_timer m_timer;
+
+    // Created once the local locator endpoints are known.
+    std::unique_ptr<swim::membership_t> m_membership;
+
+    // Signal to handle context ready event
+    std::shared_ptr<dispatch<io::context_tag>> m_signals;
+
+public:
+    swim_t(context_t& context, interface& locator, mode_t mode, const std::string& name, const dynamic_t& args);
+
+    virtual
+   ~swim_t();
+
+private:
+    void
+    on_prepared();
+
+    void
+    on_tick(const std::error_code& ec);
+
+    void
+    on_receive(const std::error_code& ec, size_t bytes_received, const std::shared_ptr<datagram_t>& ptr);
+
+    void
+    receive();
+};
+
+}} // namespace cocaine::cluster
+
+#endif
@@ -24,29 +24,81 @@
 #include "cocaine/api/gateway.hpp"
 #include "cocaine/locked_ptr.hpp"
 
+#include <array>
+#include <atomic>
 #include <random>
+#include <set>
+#include <unordered_map>
 
 namespace cocaine { namespace gateway {
 
 class adhoc_t:
     public api::gateway_t
 {
+public:
+    enum class balancer_t {
+        // Picks a remote uniformly at random.
+        random,
+        // Picks the less loaded of two random remotes (power of two choices), with remote node
+        // latency reported via feedback() used as the load estimate. Nodes with no latency samples
+        // yet are assumed to be as fast as the measured ones on average.
+        p2c
+    };
+
+private:
     const std::unique_ptr<logging::logger_t> m_log;
 
-    // Used in resolve() method, which is const.
-    std::default_random_engine mutable m_random_generator;
+    balancer_t m_balancer;
+
+    // Remote node state shared between all the services it provides.
+    struct node_t {
+        node_t(): latency(0) { }
+
+        // Exponentially weighted moving average of the reported latencies, microseconds.
+        std::atomic<std::uint64_t> latency;
+    };
 
     struct remote_t {
         std::string uuid;
         unsigned int version;
         std::vector<asio::ip::tcp::endpoint> endpoints;
         io::graph_root_t protocol;
+        std::shared_ptr<node_t> node;
     };
 
-    typedef std::map<std::string, std::map<std::string, remote_t>> remote_map_t;
+    typedef std::map<std::string, std::map<std::string, std::shared_ptr<const remote_t>>> remote_map_t;
+
+    struct state_t {
+        state_t(): measured_sum(0), measured(0) { }
+
+        remote_map_t remotes;
+        std::map<std::string, std::shared_ptr<node_t>> nodes;
+
+        // Reverse index of the services provided by every remote node, so that dropping a node
+        // doesn't have to scan all the services.
+        std::map<std::string, std::set<std::string>> services;
+
+        // Sum of the latencies of all the measured nodes and their number.
+        std::uint64_t measured_sum;
+        std::size_t measured;
+    };
 
     // TODO: Make sure that remote service metadata is consistent across the whole cluster.
-    synchronized<remote_map_t> m_remotes;
+    synchronized<state_t> m_state;
+
+    // Remotes of every service as an indexable array, so that resolving is O(1). Services are
+    // spread over a number of immutable shards by name, each rebuilt on change under the state lock
+    // and replaced as a whole, so resolving never takes a lock and a change copies only a fraction
+    // of the index. Should be accessed only via std::atomic_load() and std::atomic_store().
+    typedef std::vector<std::shared_ptr<const remote_t>> remote_vector_t;
+    typedef std::unordered_map<std::string, std::shared_ptr<const remote_vector_t>> snapshot_t;
+
+    static const size_t kShards = 64;
+
+    std::array<std::shared_ptr<const snapshot_t>, kShards> m_snapshot;
+
+    // Average latency of the measured nodes, used for the nodes which are not measured yet.
+    std::atomic<std::uint64_t> m_mean;
 
 public:
     adhoc_t(context_t& context, const std::string& _local_uuid, const std::string& name, const dynamic_t& args);
@@ -69,12 +121,42 @@ public:
     auto
     cleanup(const std::string& uuid, const std::string& name) -> void override;
 
+    auto
+    update(const std::string& uuid, const std::map<std::string, service_description_t>& services) -> void override;
+
     auto
     cleanup(const std::string& uuid) -> void override;
 
+    auto
+    feedback(const std::string& uuid, std::chrono::microseconds latency) -> void override;
+
     auto
     total_count(const std::string& name) const -> size_t override;
 
+private:
+    static
+    size_t
+    shard(const std::string& name);
+
+    // Registers a single remote service, returns false if it's already registered. Requires the
+    // state lock.
+    bool
+    insert(state_t& state, const std::string& uuid, const std::string& name, unsigned int version,
+           const std::vector<asio::ip::tcp::endpoint>& endpoints, const io::graph_root_t& protocol);
+
+    // Removes a single remote service, returns false if there was no such service. Requires the
+    // state lock.
+    bool
+    erase(state_t& state, const std::string& uuid, const std::string& name);
+
+    // Forgets the latency samples of the given node. Requires the state lock.
+    void
+    unmeasure(state_t& state, const node_t& node);
+
+    // Rebuilds the snapshot entries of the given services, copying every affected shard once.
+    // Requires the state lock.
+    void
+    publish(const state_t& state, const std::vector<std::string>& names);
 };
 
 }} // namespace cocaine::gateway
@@ -26,14 +26,25 @@
 #include "cocaine/api/service.hpp"
 
 #include "cocaine/detail/service/locator/routing.hpp"
+#include "cocaine/detail/service/locator/sharded.hpp"
 
 #include "cocaine/idl/context.hpp"
 #include "cocaine/idl/locator.hpp"
 
+#include "cocaine/rpc/asio/encoder.hpp"
 #include "cocaine/rpc/dispatch.hpp"
 
 #include "cocaine/locked_ptr.hpp"
 
+#include <asio/deadline_timer.hpp>
+
+#include <boost/optional/optional.hpp>
+
+#include <deque>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+
 namespace cocaine {
 
 class actor_t;
@@ -50,6 +61,42 @@ typedef result_of<io::locator::resolve>::type resolve;
 typedef result_of<io::locator::connect>::type connect;
 typedef result_of<io::locator::cluster>::type cluster;
 typedef result_of<io::locator::routing>::type routing;
+typedef result_of<io::locator::routing_v2>::type routing_v2;
+typedef result_of<io::locator::mesh>::type mesh;
+
+// Routing groups as sent to routers, i.e. continuums indexed by routing group name.
+typedef std::tuple_element<2, routing_v2>::type routing_table;
+
+// Version vectors and versioned service states of nodes, as exchanged over mesh links.
+typedef std::tuple_element<0, mesh>::type mesh_versions;
+typedef std::tuple_element<1, mesh>::type mesh_states;
+
+// Resolve responses packed ahead of time, to be sent out without being serialized again.
+typedef io::prepacked<
+    io::protocol<io::event_traits<io::locator::resolve>::upstream_type>::scope::value
+> packed_resolve;
+
+// Routing table chunks packed once and shared between all the outgoing router streams. Legacy
+// routers get full routing tables, newer ones get versioned deltas.
+typedef io::prepacked<
+    io::protocol<io::event_traits<io::locator::routing>::upstream_type>::scope::chunk
+> packed_routing;
+
+typedef io::prepacked<
+    io::protocol<io::event_traits<io::locator::routing_v2>::upstream_type>::scope::chunk
+> packed_routing_v2;
+
+// Service updates packed once and shared between all the outgoing remote locator streams.
+typedef io::prepacked<
+    io::protocol<io::event_traits<io::locator::connect>::upstream_type>::scope::chunk
+> packed_connect;
+
+// Service states packed once and shared between all the mesh links, incoming and outgoing ones.
+typedef io::prepacked<
+    io::protocol<io::event_traits<io::locator::mesh>::upstream_type>::scope::chunk
+> packed_mesh;
+
+typedef io::prepacked<io::locator::mesh::update> packed_mesh_update;
 
 } // namespace results
 
@@ -63,6 +110,47 @@ public:
 
     // Restricted services.
     std::set<std::string> restricted;
+
+    // Hash function for routing group keys.
+    routing_group_t::hash_type hash;
+
+    // Routing group algorithm, by default and for specific routing groups.
+    routing_group_t::algorithm_type algorithm;
+    std::map<std::string, routing_group_t::algorithm_type> algorithms;
+
+    // Whether routing groups are advertised to routers. Only algorithms routers understand are
+    // allowed when enabled.
+    bool advertise;
+
+    // Local service updates are coalesced over this window before being announced to remote
+    // locators. Zero means announce every update immediately.
+    asio::deadline_timer::duration_type announce_window;
+
+    // Failed connections to remote locators are retried after a jittered exponential back-off
+    // between these bounds.
+    asio::deadline_timer::duration_type backoff_min;
+    asio::deadline_timer::duration_type backoff_max;
+
+    // Maximum number of connection attempts to remote locators in flight.
+    std::size_t max_connects;
+
+    // Linked remote locators are probed with a request this often to measure their latency for the
+    // gateway. Zero disables probing.
+    asio::deadline_timer::duration_type probe_interval;
+
+    // Number of replicas of the read-mostly state used by resolving, see sharded_ptr.
+    std::size_t shards;
+
+    // In the full topology every node links to every other node. In the mesh topology every node
+    // links to a bounded number of peers, and service updates propagate transitively.
+    enum class topologies { full, mesh } topology;
+
+    // Number of peers every node links to in the mesh topology.
+    std::size_t fanout;
+
+    // Service states of nodes dropped by the cluster manager are forgotten after this long in the
+    // mesh topology, unless the nodes come back.
+    asio::deadline_timer::duration_type mesh_expiration;
 };
 
 class locator_t:
@@ -71,22 +159,78 @@ class locator_t:
     public dispatch<io::locator_tag>
 {
     class connect_sink_t;
+    class mesh_sink_t;
+    class mesh_slot_t;
+    class probe_sink_t;
     class publish_slot_t;
-    class routing_slot_t;
+    class resolve_slot_t;
+    template<class Event> class routing_slot_t;
 
-    typedef std::map<std::string, continuum_t> rg_map_t;
+    struct metrics_t;
+
+    struct rg_t {
+        // Routing group definition as stored, used to detect changes on refresh.
+        routing_group_t::stored_type group;
+        std::unique_ptr<routing_group_t> routing;
+
+        rg_t(std::unique_ptr<logging::logger_t> log, routing_group_t::stored_type group,
+             routing_group_t::algorithm_type algorithm, routing_group_t::hash_type hash);
+    };
+
+    typedef std::map<std::string, std::shared_ptr<const rg_t>> rg_map_t;
 
     class uplink_t
     {
     public:
+        enum class states { queued, connecting, backoff, connected };
+
         std::vector<asio::ip::tcp::endpoint> endpoints;
         std::shared_ptr<session<asio::ip::tcp>> ptr;
+
+        states state;
+
+        // Number of consecutive failed connection attempts.
+        unsigned failures;
+
+        // Socket of the connection attempt in flight or the retry timer, depending on the state.
+        // Also used to tell stale completion handlers apart.
+        std::shared_ptr<asio::ip::tcp::socket> socket;
+        std::shared_ptr<asio::deadline_timer> timer;
     };
 
     typedef std::map<std::string, uplink_t> client_map_t;
 
     typedef std::map<std::string, streamed<results::connect>> remote_map_t;
     typedef std::map<std::string, streamed<results::routing>> router_map_t;
+    typedef std::map<std::string, streamed<results::routing_v2>> router_v2_map_t;
+
+    typedef std::unordered_map<std::string, results::packed_resolve> cache_map_t;
+
+    typedef std::map<std::string, results::resolve> service_map_t;
+
+    struct origin_t {
+        std::uint64_t version;
+        service_map_t services;
+
+        // Whether the services are exposed via the gateway. Nodes dropped by the cluster manager
+        // keep their latest state for a while to ignore stale updates, and to restore it if they
+        // come back. Dropped nodes are forgotten once expired.
+        bool active;
+        asio::deadline_timer::time_type expires;
+    };
+
+    struct mesh_t {
+        // Version of the local service state.
+        std::uint64_t version;
+
+        // Latest known service states of all the other nodes.
+        std::map<std::string, origin_t> origins;
+
+        // Mesh links to send service updates to. Outgoing links are set up by this node, incoming
+        // ones by remote nodes, tagged to tell stale discards apart from the current link.
+        std::map<std::string, io::upstream_ptr_t> outgoing;
+        std::map<std::string, std::pair<std::uint64_t, streamed<results::mesh>>> incoming;
+    };
 
     context_t& m_context;
 
@@ -104,20 +248,68 @@ class locator_t:
     std::unique_ptr<api::gateway_t> m_gateway;
 
     // Used to resolve service names against routing groups, based on weights and other metrics.
-    synchronized<rg_map_t> m_rgs;
+    // Immutable, replaced as a whole on refresh, so that resolving never waits for updates.
+    sharded_ptr<rg_map_t> m_rgs;
+
+    // Serializes routing group updates and router stream attachments, so that every router gets
+    // a full snapshot followed by all the deltas since its version, in order.
+    std::mutex m_rgs_mutex;
+
+    // Routing table version and the full snapshot of this version, packed on the first attach in
+    // both formats. All guarded by the routing group mutex.
+    std::uint64_t m_rgs_version;
+    boost::optional<results::packed_routing> m_rgs_table;
+    boost::optional<results::packed_routing_v2> m_rgs_snapshot;
+
+    // Packed resolve responses for local services, indexed by service name. Populated and purged
+    // by context service signals, so that resolving a local service doesn't hit the context.
+    // Immutable, replaced as a whole on every change under the cache mutex.
+    sharded_ptr<cache_map_t> m_cache;
+    std::mutex m_cache_mutex;
 
     // Incoming remote locator streams indexed by uuid. Uuid is required to disambiguate between
     // multiple different instances on the same host and port (in case it was restarted).
     synchronized<client_map_t> m_clients;
 
+    // Remote locators waiting for a free connection slot and the number of connection attempts in
+    // flight. Synchronized with incoming remote locator streams, as well as the back-off jitter RNG.
+    std::deque<std::string> m_connect_queue;
+    std::size_t m_connecting;
+    std::default_random_engine m_random;
+
+    // All the nodes reported by the cluster manager in the mesh topology, only some of which are
+    // linked. Synchronized with incoming remote locator streams.
+    std::map<std::string, std::vector<asio::ip::tcp::endpoint>> m_known;
+
     // Outgoing remote locator streams indexed by node uuid.
     synchronized<remote_map_t> m_remotes;
 
-    // Snapshots of the local service states. Synchronized with outgoing remote streams.
-    std::map<std::string, results::resolve> m_snapshots;
+    // Snapshots of the local service states, as announced to remote locators. Synchronized with
+    // outgoing remote streams.
+    service_map_t m_snapshots;
+
+    // Local service updates which are not announced yet, removed services have empty locations.
+    // Synchronized with outgoing remote streams, flushed by the timer. The timer is armed once by
+    // the first queued update, so that no update is delayed for longer than the announce window.
+    service_map_t m_pending;
+    asio::deadline_timer m_announce_timer;
+    bool m_announce_armed;
+
+    // Drives latency probes of the linked remote locators.
+    asio::deadline_timer m_probe_timer;
 
-    // Outgoing router streams indexed by some arbitrary router-provided uuid.
+    // Mesh topology state. Synchronized with outgoing remote streams, as well as the timer which
+    // forgets expired dropped nodes, armed while there are any.
+    mesh_t m_mesh;
+    asio::deadline_timer m_expiration_timer;
+    bool m_expiration_armed;
+
+    std::unique_ptr<metrics_t> m_metrics;
+
+    // Outgoing router streams indexed by some arbitrary router-provided uuid, for legacy routers
+    // and for those which understand routing table deltas.
     synchronized<router_map_t> m_routers;
+    synchronized<router_v2_map_t> m_routers_v2;
 
 public:
     locator_t(context_t& context, asio::io_service& asio, const std::string& name, const dynamic_t& args);
@@ -151,27 +343,119 @@ public:
 
 private:
     auto
-    on_resolve(const std::string& name, const std::string& seed) const -> results::resolve;
+    on_resolve(const std::string& name, const std::string& seed) const -> results::packed_resolve;
 
     auto
     on_connect(const std::string& uuid) -> streamed<results::connect>;
 
+    auto
+    on_mesh(const std::string& uuid, const results::mesh_versions& versions, std::uint64_t id)
+        -> streamed<results::mesh>;
+
+    void
+    on_mesh_update(const std::string& uuid, const results::mesh_versions& versions,
+                   results::mesh_states&& states);
+
     void
     on_refresh(const std::vector<std::string>& groups);
 
     auto
     on_cluster() const -> results::cluster;
 
+    // Full routing table for legacy routers, packed on demand. Must be called with the routing
+    // group mutex held.
+    auto
+    routing_table() -> const results::packed_routing&;
+
+    auto
+    on_routing(const std::string& ruid) -> streamed<results::routing>;
+
     auto
-    on_routing(const std::string& ruid, bool replace = false) -> streamed<results::routing>;
+    on_routing_v2(const std::string& ruid) -> streamed<results::routing_v2>;
 
     // Context signals
 
-    enum class modes { exposed, removed };
+    enum class modes { exposed, updated, removed };
 
     void
     on_service(const std::string& name, const results::resolve& meta, modes mode);
 
+    void
+    on_local_service(const std::string& name, const results::resolve& meta, modes mode);
+
+    // Remote locator connection scheduling. All of these require the incoming streams lock.
+
+    void
+    connect_pending(client_map_t& mapping);
+
+    // Arms the probe timer to send a latency probe to every connected remote locator, over and
+    // over again.
+    void
+    probe();
+
+    void
+    connect(client_map_t& mapping, const std::string& uuid);
+
+    void
+    reconnect(client_map_t& mapping, const std::string& uuid);
+
+    void
+    transition(uplink_t& uplink, uplink_t::states state);
+
+    // Removes the uplink, keeping the per-state peer gauges consistent.
+    void
+    forget(client_map_t& mapping, client_map_t::iterator it);
+
+    void
+    link(client_map_t& mapping, const std::string& uuid, const std::vector<asio::ip::tcp::endpoint>& endpoints);
+
+    auto
+    unlink(client_map_t& mapping, const std::string& uuid) -> std::shared_ptr<session<asio::ip::tcp>>;
+
+    // Mesh topology. Relinks a peer with back-off after its link has failed, without forgetting
+    // the node itself.
+    void
+    relink(const std::string& uuid);
+
+    // Links the selected peers and unlinks the rest. Returns the sessions to detach once the
+    // incoming streams lock is released.
+    auto
+    rebalance(client_map_t& mapping) -> std::vector<std::shared_ptr<session<asio::ip::tcp>>>;
+
+    auto
+    select_peers() const -> std::set<std::string>;
+
+    // Mesh service state handling. All of these require the outgoing streams lock.
+
+    auto
+    versions() const -> results::mesh_versions;
+
+    auto
+    lacking(const results::mesh_versions& versions) const -> results::mesh_states;
+
+    // Applies newer service states and deltas, and returns the resulting deltas, so that they could
+    // be passed further. Deltas which don't follow the known states are skipped, setting the gap.
+    auto
+    merge(results::mesh_states&& states, bool& gap) -> results::mesh_states;
+
+    void
+    broadcast(const results::mesh_states& states, const std::string& except);
+
+    // Sends service states and the version vector to a linked peer over whichever link it has.
+    void
+    reply(const std::string& uuid, const results::mesh_versions& versions, const results::mesh_states& states);
+
+    // Arms the expiration timer to forget dropped nodes, unless it's already armed.
+    void
+    expire();
+
+    void
+    expose(const std::string& uuid, const service_map_t& before, const service_map_t& after);
+
+    // Announces pending service updates to all remote locators. Requires the remote streams lock.
+    void
+    announce(remote_map_t& mapping);
+
     void
     on_context_shutdown();
 };
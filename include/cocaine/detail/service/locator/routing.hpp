@@ -23,67 +23,93 @@
 
 #include "cocaine/common.hpp"
 
+#include <atomic>
 #include <map>
-#include <random>
+#include <vector>
 
 namespace cocaine { namespace service {
 
-// Ketama algorithm implementation
-
-struct continuum_t {
+// Routing group interface. Routing groups map keys to group elements, with shares proportional to
+// element weights, using one of the following algorithms:
+//
+//  * ketama: a continuum of 256 MD5-derived points per element, which is what routers understand;
+//  * maglev: a fixed-size lookup table populated from per-element slot permutations;
+//  * jump: jump consistent hash over a bucket per unit of element weight;
+//  * rendezvous: weighted highest random weight hashing, no lookup structures at all.
+//
+// Routers only understand continuums, so only Ketama and Maglev groups can be advertised to them.
+
+class routing_group_t {
+public:
     typedef uint32_t point_type;
 
-    typedef struct element_type {
-        point_type  point;
-        std::string value;
-    } element_t;
-
-    friend
-    bool
-    operator< (const element_t& lhs, const element_t& rhs) {
-        return lhs.point < rhs.point;
-    }
-
-    friend
-    bool
-    operator==(const element_t& lhs, const element_t& rhs) {
-        return lhs.point == rhs.point;
-    }
-
-    friend
-    bool
-    operator< (const point_type lhs, const element_t& rhs) {
-        return lhs < rhs.point;
-    }
+    // Index into the interned group element names.
+    typedef uint16_t index_type;
 
     typedef std::map<std::string, unsigned int> stored_type;
 
+    // Hash function used to map keys (and, for Ketama, group elements) onto points. MD5 is the
+    // original Ketama hash, which routers also rely on, FNV-1a is a much faster alternative for
+    // setups where all the parties agree on it.
+    enum class hash_type { md5, fnv1a };
+
+    enum class algorithm_type { ketama, maglev, jump, rendezvous };
+
 public:
-    continuum_t(std::unique_ptr<logging::logger_t> log, const stored_type& group);
+    routing_group_t(std::unique_ptr<logging::logger_t> log, const stored_type& group, hash_type hash);
+
+    virtual
+   ~routing_group_t();
 
     // Observers
 
-    std::string
+    const std::string&
     get(const std::string& key) const;
 
-    std::string
+    const std::string&
     get() const;
 
+    // Routing group as a continuum, for routers. Throws for algorithms which can't be represented
+    // as a continuum.
+    virtual
     std::vector<std::tuple<point_type, std::string>>
-    all() const;
+    all() const = 0;
 
-private:
+    // Memory used by the lookup structures, in bytes.
+    virtual
+    size_t
+    footprint() const = 0;
+
+protected:
+    // Maps a point to the index of the corresponding group element.
+    virtual
+    index_type
+    select(point_type point) const = 0;
+
+protected:
     // Shared to allow cloning of rg_map_t for routing group updates.
     const std::shared_ptr<logging::logger_t> m_log;
 
-    // The hashring.
-    std::vector<element_t> m_elements;
+    const hash_type m_hash;
+
+    // Interned group element names and their weights.
+    std::vector<std::string> m_values;
+    std::vector<unsigned int> m_weights;
 
-    // Used for keyless operations.
-    std::default_random_engine                mutable m_rng;
-    std::uniform_int_distribution<point_type> mutable m_distribution;
+private:
+    // Used for keyless operations. Random points are derived from a randomly seeded counter, so
+    // that keyless lookups are thread-safe and don't need any locking.
+    std::atomic<uint64_t> mutable m_sequence;
 };
 
+// Whether routing groups built with the given algorithm can be advertised to routers.
+bool
+is_advertisable(routing_group_t::algorithm_type algorithm);
+
+std::unique_ptr<routing_group_t>
+make_routing_group(routing_group_t::algorithm_type algorithm, std::unique_ptr<logging::logger_t> log,
+                   const routing_group_t::stored_type& group, routing_group_t::hash_type hash);
+
 }} // namespace cocaine::service
 
 #endif
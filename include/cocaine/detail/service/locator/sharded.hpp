@@ -0,0 +1,147 @@
+/*
+    Copyright (c) 2011-2014 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2014 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef COCAINE_LOCATOR_SERVICE_SHARDED_HPP
+#define COCAINE_LOCATOR_SERVICE_SHARDED_HPP
+
+#include "cocaine/common.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <thread>
+
+namespace cocaine { namespace service {
+
+// Immutable value shared between many reader threads and replaced as a whole by writers. Loading
+// and storing a std::shared_ptr atomically takes a lock from a small global pool, and every load
+// bumps the reference count in the same control block, so a single pointer read by all the I/O
+// threads becomes a point of contention. Here the pointer is replicated into a number of shards,
+// each on its own cache line, guarded by its own spinlock and owning its own control block, and
+// each thread always reads from its own shard. Writers replace all the shards one by one, so
+// readers in different threads may briefly observe different values. Writers must be serialized
+// externally.
+
+template<class T>
+class sharded_ptr {
+    COCAINE_DECLARE_NONCOPYABLE(sharded_ptr)
+
+    static const size_t kCacheLine = 64;
+
+    struct alignas(kCacheLine) shard_t {
+        shard_t(): busy(false) { }
+
+        mutable std::atomic<bool> busy;
+        std::shared_ptr<const T> ptr;
+    };
+
+    // Over-aligned types are not guaranteed to be aligned by the default allocator, so the shards
+    // are placed into a manually aligned buffer.
+    std::unique_ptr<char[]> m_storage;
+
+    shard_t* m_shards;
+    size_t   m_count;
+
+public:
+    sharded_ptr(std::shared_ptr<const T> value, size_t shards):
+        m_storage(new char[(std::max<size_t>(shards, 1) + 1) * sizeof(shard_t)]),
+        m_count(std::max<size_t>(shards, 1))
+    {
+        const auto address = reinterpret_cast<std::uintptr_t>(m_storage.get());
+
+        m_shards = reinterpret_cast<shard_t*>((address + kCacheLine - 1) & ~(kCacheLine - 1));
+
+        for(size_t i = 0; i < m_count; ++i) {
+            new(m_shards + i) shard_t();
+        }
+
+        store(std::move(value));
+    }
+
+   ~sharded_ptr() {
+        for(size_t i = 0; i < m_count; ++i) {
+            m_shards[i].~shard_t();
+        }
+    }
+
+    std::shared_ptr<const T>
+    load() const {
+        const auto& target = shard();
+
+        lock(target);
+        auto result = target.ptr;
+        unlock(target);
+
+        return result;
+    }
+
+    void
+    store(const std::shared_ptr<const T>& value) {
+        for(size_t i = 0; i < m_count; ++i) {
+            // Every shard gets its own control block, which keeps the original one alive, so that
+            // readers of different shards don't bump the same reference count.
+            auto holder = std::make_shared<std::shared_ptr<const T>>(value);
+            auto local  = std::shared_ptr<const T>(holder, value.get());
+
+            lock(m_shards[i]);
+            m_shards[i].ptr.swap(local);
+            unlock(m_shards[i]);
+
+            // The previous value, if any, is released here, outside of the lock.
+        }
+    }
+
+    size_t
+    shards() const {
+        return m_count;
+    }
+
+private:
+    const shard_t&
+    shard() const {
+        // Threads are assigned to shards round-robin on their first access.
+        static std::atomic<size_t> counter(0);
+        static thread_local const size_t index = counter++;
+
+        return m_shards[index % m_count];
+    }
+
+    static
+    void
+    lock(const shard_t& target) {
+        while(target.busy.exchange(true, std::memory_order_acquire)) {
+            // Critical sections are tiny, so it's most likely that the holder has been preempted.
+            std::this_thread::yield();
+        }
+    }
+
+    static
+    void
+    unlock(const shard_t& target) {
+        target.busy.store(false, std::memory_order_release);
+    }
+};
+
+}} // namespace cocaine::service
+
+#endif
@@ -22,24 +22,66 @@
 #define COCAINE_FILE_STORAGE_HPP
 
 #include "cocaine/api/storage.hpp"
+#include "cocaine/locked_ptr.hpp"
 
 #include <asio/io_service.hpp>
+#include <asio/strand.hpp>
 
 #include <boost/filesystem/path.hpp>
 #include <boost/optional/optional.hpp>
 
+#include <future>
+#include <map>
+
 namespace cocaine { namespace storage {
 
+class tag_index_t;
+
+// Reads the whole object file at once, sizing the buffer upfront with fstat().
+std::string
+read_object(const boost::filesystem::path& path);
+
 class files_t:
     public api::storage_t
 {
+    struct metrics_t;
+
+    class committer_t;
+
+    enum class operations { read, write, remove, find };
+
+    // Objects are always written to a temporary file which then atomically replaces the object.
+    // The difference is whether the data hits the disk before the write is acknowledged: never,
+    // by an fsync() on every write, or by an fsync() batch shared with the concurrent writes.
+    enum class durability_t { none, fsync, group };
+
     const std::unique_ptr<logging::logger_t> m_log;
 
     const boost::filesystem::path m_parent_path;
 
+    durability_t m_durability;
+
+    // Batches fsync() calls in the group commit mode.
+    std::unique_ptr<committer_t> m_committer;
+
+    // Tag indexes of the collections, which are opened lazily. Finds are served from the indexes,
+    // while the tag directories are still maintained to stay compatible with older versions. The
+    // map is only locked to find an index, operations on a collection being opened wait for it on
+    // the future instead.
+    typedef std::map<std::string, std::shared_future<std::shared_ptr<tag_index_t>>> index_map_t;
+
+    synchronized<index_map_t> m_indexes;
+
     asio::io_service io_loop;
     boost::optional<asio::io_service::work> io_work;
-    std::thread thread;
+
+    // Operations on the same key are serialized by running them through the same strand, so that
+    // they are applied in order. Operations on different keys run on the worker pool in parallel.
+    std::vector<std::unique_ptr<asio::io_service::strand>> m_strands;
+
+    std::unique_ptr<metrics_t> m_metrics;
+
+    std::vector<std::thread> m_workers;
 
 public:
     files_t(context_t& context, const std::string& name, const dynamic_t& args);
@@ -76,6 +118,34 @@ public:
     find(const std::string& collection, const std::vector<std::string>& tags, callback<std::vector<std::string>> cb);
 
 private:
+    auto
+    strand(const std::string& collection, const std::string& key) -> asio::io_service::strand&;
+
+    // Schedules the operation either on the given strand or on any worker, accounting for it.
+    template<class F>
+    void
+    spawn(operations operation, asio::io_service::strand* strand, F fn);
+
+    // Returns the tag index of the collection, opening it on first use.
+    auto
+    index(const std::string& collection) -> std::shared_ptr<tag_index_t>;
+
+    // Opens the tag index of the collection, building it from the tag directories if there's none
+    // on disk yet. Unless it has been closed cleanly, it's reconciled with the objects and their
+    // symlinks found on disk, as interrupted writes might have left the index behind.
+    auto
+    open_index(const std::string& collection) -> std::shared_ptr<tag_index_t>;
+
+    // Rebuilds the tag directories of the collection from the existing symlinks of its objects and
+    // the tags recorded in its index, dropping dangling symlinks, empty tag directories and leftovers
+    // of interrupted writes. Must not run concurrently with other operations on the collection.
+    void
+    compact_sync(const std::string& collection);
+
+    // Makes the data written to the file descriptor durable according to the durability mode.
+    void
+    sync(int fd, const boost::filesystem::path& path);
+
     std::string
     read_sync(const std::string& collection, const std::string& key);
 
@@ -0,0 +1,184 @@
+/*
+    Copyright (c) 2011-2014 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2014 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COCAINE_STORAGE_TAG_INDEX_HPP
+#define COCAINE_STORAGE_TAG_INDEX_HPP
+
+#include <boost/filesystem/path.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cocaine { namespace storage {
+
+// In-memory inverted index of object tags. Every tag maps to a sorted list of the keys having it,
+// so that finds are plain intersections of sorted lists. Not thread-safe.
+
+class tag_map_t {
+public:
+    typedef std::unordered_map<std::string, std::vector<std::string>> object_map_type;
+
+private:
+    // Object tags, sorted, and sorted object keys for every tag.
+    object_map_type m_objects;
+    object_map_type m_tags;
+
+public:
+    size_t
+    size() const;
+
+    const object_map_type&
+    objects() const;
+
+    // Returns the tags of the object, or nullptr if there's no such object.
+    const std::vector<std::string>*
+    tags(const std::string& key) const;
+
+    // Replaces the tags of the object. The tags must be normalized.
+    void
+    attach(const std::string& key, std::vector<std::string> tags);
+
+    // Returns false if there's no such object.
+    bool
+    detach(const std::string& key);
+
+    void
+    clear();
+
+    // Returns sorted keys of the objects having all of the given tags.
+    std::vector<std::string>
+    find(const std::vector<std::string>& tags) const;
+
+    // Sorts the tags and drops duplicates.
+    static
+    void
+    normalize(std::vector<std::string>& tags);
+};
+
+// Persistent tag map of a collection. On disk, the index is a log of updates, which is replayed
+// via mmap() when the index is opened and rewritten from scratch once it mostly consists of
+// superseded updates. Thread-safe.
+
+class tag_index_t {
+public:
+    // Called to make the data written to a file descriptor durable.
+    typedef std::function<void(int fd, const boost::filesystem::path& path)> sync_type;
+
+private:
+    const boost::filesystem::path m_path;
+    const sync_type m_sync;
+
+    mutable std::mutex m_mutex;
+
+    // Descriptor of the log opened for appending, or -1 if there's no log on disk yet.
+    int m_fd;
+
+    // Size of the valid part of the log, so that a failed append can be rolled back.
+    std::uint64_t m_size;
+
+    // Number of updates in the log which were superseded by later ones.
+    std::uint64_t m_stale;
+
+    // Whether the log ended with a clean close when loaded, and whether it can be closed cleanly.
+    bool m_clean;
+    bool m_tainted;
+
+    tag_map_t m_map;
+
+public:
+    // Loads the index from the given file, if it exists. A truncated or corrupted tail of the log,
+    // e.g. left by a crash in the middle of an update, is dropped.
+    tag_index_t(const boost::filesystem::path& path, sync_type sync);
+   ~tag_index_t();
+
+    tag_index_t(const tag_index_t& other) = delete;
+
+    tag_index_t&
+    operator=(const tag_index_t& other) = delete;
+
+    // Whether the index was loaded from disk. Otherwise it has to be populated with reset().
+    bool
+    exists() const;
+
+    // Whether the index was closed cleanly the last time, i.e. it's known to match the objects,
+    // unless they've been changed behind its back.
+    bool
+    clean() const;
+
+    // Records a clean close at the end of the log, unless the index has been tainted. Updates made
+    // after that record it's not clean anymore, simply by following it.
+    void
+    close();
+
+    // Marks the index as possibly out of sync with the objects, e.g. after an interrupted write, so
+    // that it's never closed cleanly.
+    void
+    taint();
+
+    size_t
+    size() const;
+
+    // Returns the tags the object was last written with, sorted.
+    std::vector<std::string>
+    tags(const std::string& key) const;
+
+    // Returns all the objects along with their tags.
+    std::map<std::string, std::vector<std::string>>
+    objects() const;
+
+    // Replaces the tags of the object.
+    void
+    insert(const std::string& key, std::vector<std::string> tags);
+
+    void
+    erase(const std::string& key);
+
+    // Replaces the whole index with the given objects and their tags.
+    void
+    reset(const std::map<std::string, std::vector<std::string>>& objects);
+
+    // Returns sorted keys of the objects having all of the given tags.
+    std::vector<std::string>
+    find(const std::vector<std::string>& tags) const;
+
+private:
+    void
+    load();
+
+    void
+    append(const std::string& record);
+
+    // Rewrites the log once it's mostly made of superseded updates.
+    void
+    compact();
+
+    // Replaces the log with a fresh one, containing a single update per object.
+    void
+    rewrite();
+};
+
+}} // namespace cocaine::storage
+
+#endif
@@ -0,0 +1,177 @@
+/*
+    Copyright (c) 2011-2014 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2014 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COCAINE_JOURNAL_STORAGE_HPP
+#define COCAINE_JOURNAL_STORAGE_HPP
+
+#include "cocaine/api/storage.hpp"
+#include "cocaine/locked_ptr.hpp"
+
+#include "cocaine/detail/storage/index.hpp"
+
+#include <asio/deadline_timer.hpp>
+#include <asio/io_service.hpp>
+#include <asio/strand.hpp>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/optional/optional.hpp>
+
+#include <atomic>
+#include <thread>
+
+namespace cocaine { namespace storage {
+
+namespace record {
+
+struct descriptor_t;
+
+} // namespace record
+
+// Embedded storage for lots of small objects. All the objects live in a single append-only log,
+// with an in-memory index pointing at the latest version of every object, so that a write is one
+// append and a read is one pread(). Superseded records are dropped by compaction, which
+// periodically rewrites the log once it's mostly garbage, without blocking writes for long.
+//
+// Writes and removes are applied in order, one at a time. Reads and finds run in parallel with
+// them and see every operation which has been completed.
+
+class journal_t:
+    public api::storage_t
+{
+    struct location_t {
+        // Position of the blob in the log.
+        std::uint64_t offset;
+        std::uint32_t size;
+
+        // Size of the whole record, for garbage accounting.
+        std::uint32_t record;
+    };
+
+    struct collection_t {
+        std::unordered_map<std::string, location_t> objects;
+        tag_map_t tags;
+    };
+
+    struct state_t {
+        // Shared with reads in progress, so that it stays open when replaced by compaction.
+        std::shared_ptr<record::descriptor_t> log;
+
+        // Size of the log and how much of it is taken by superseded records.
+        std::uint64_t size;
+        std::uint64_t garbage;
+
+        bool compacting;
+
+        std::unordered_map<std::string, collection_t> collections;
+    };
+
+    const std::unique_ptr<logging::logger_t> m_log;
+
+    const boost::filesystem::path m_path;
+
+    // Whether writes are acknowledged only once they're on disk.
+    const bool m_fsync;
+
+    // Compaction settings: how often the log is checked and how much garbage is enough to bother.
+    const asio::deadline_timer::duration_type m_compaction_interval;
+    const std::uint64_t m_compaction_garbage;
+
+    synchronized<state_t> m_state;
+
+    asio::io_service io_loop;
+    boost::optional<asio::io_service::work> io_work;
+
+    // Serializes writes and removes, as well as everything related to the compaction timer.
+    asio::io_service::strand m_strand;
+    asio::deadline_timer m_timer;
+
+    std::atomic<bool> m_stopping;
+
+    std::vector<std::thread> m_workers;
+
+public:
+    journal_t(context_t& context, const std::string& name, const dynamic_t& args);
+
+    virtual
+   ~journal_t();
+
+    using api::storage_t::read;
+
+    virtual
+    void
+    read(const std::string& collection, const std::string& key, callback<std::string> cb);
+
+    using api::storage_t::write;
+
+    virtual
+    void
+    write(const std::string& collection,
+          const std::string& key,
+          const std::string& blob,
+          const std::vector<std::string>& tags,
+          callback<void> cb);
+
+    using api::storage_t::remove;
+
+    virtual
+    void
+    remove(const std::string& collection, const std::string& key, callback<void> cb);
+
+    using api::storage_t::find;
+
+    virtual
+    void
+    find(const std::string& collection, const std::vector<std::string>& tags, callback<std::vector<std::string>> cb);
+
+private:
+    // Replays the log, dropping its torn tail, if any. Throws if the log is corrupted elsewhere, as
+    // dropping everything after the corrupted record would lose acknowledged writes.
+    void
+    load();
+
+    // Appends the record to the log, rolling the log back on failure.
+    void
+    append(state_t& state, const std::string& record);
+
+    void
+    schedule();
+
+    void
+    compact();
+
+    std::string
+    read_sync(const std::string& collection, const std::string& key);
+
+    void
+    write_sync(const std::string& collection,
+               const std::string& key,
+               const std::string& blob,
+               const std::vector<std::string>& tags);
+
+    void
+    remove_sync(const std::string& collection, const std::string& key);
+
+    std::vector<std::string>
+    find_sync(const std::string& collection, const std::vector<std::string>& tags);
+};
+
+}} // namespace cocaine::storage
+
+#endif
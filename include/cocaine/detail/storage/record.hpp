@@ -0,0 +1,97 @@
+/*
+    Copyright (c) 2011-2014 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2014 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COCAINE_STORAGE_RECORD_HPP
+#define COCAINE_STORAGE_RECORD_HPP
+
+#include <boost/filesystem/path.hpp>
+
+#include <cstdint>
+#include <string>
+#include <system_error>
+
+#include <sys/types.h>
+
+namespace cocaine { namespace storage { namespace record {
+
+// Low-level I/O helpers shared by the storage backends.
+
+// Owns a file descriptor, unless it's released.
+struct descriptor_t {
+    int fd;
+
+    explicit
+    descriptor_t(int fd_): fd(fd_) { }
+
+   ~descriptor_t();
+
+    descriptor_t(const descriptor_t& other) = delete;
+
+    descriptor_t&
+    operator=(const descriptor_t& other) = delete;
+
+    int
+    release();
+};
+
+// Makes an error from the current errno.
+std::system_error
+make_system_error(const boost::filesystem::path& path);
+
+void
+write_all(int fd, const std::string& data, const boost::filesystem::path& path);
+
+// Reads exactly the given number of bytes at the given offset.
+void
+read_all(int fd, char* data, size_t size, off_t offset, const boost::filesystem::path& path);
+
+// Records are framed as [size][checksum][payload], so that garbage left by a crash in the middle
+// of an append can be told apart from actual records. Integers are 32-bit in the native byte
+// order, strings are prefixed with their size.
+
+const size_t header_size = 2 * sizeof(std::uint32_t);
+
+void
+put(std::string& buffer, std::uint32_t value);
+
+void
+put(std::string& buffer, const std::string& value);
+
+std::string
+frame(const std::string& payload);
+
+struct reader_t {
+    const char* it;
+    const char* end;
+
+    bool
+    get(std::uint32_t& value);
+
+    bool
+    get(std::string& value);
+
+    // Reads the next framed payload, returning false if the rest is truncated or corrupted.
+    bool
+    next(reader_t& payload);
+};
+
+}}} // namespace cocaine::storage::record
+
+#endif
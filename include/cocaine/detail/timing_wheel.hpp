@@ -0,0 +1,188 @@
+/*
+    Copyright (c) 2011-2014 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2014 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef COCAINE_TIMING_WHEEL_HPP
+#define COCAINE_TIMING_WHEEL_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace cocaine {
+
+// Hashed timing wheel for tracking lots of deadlines with a single periodic timer, e.g. expiration
+// of cluster peers or idle sessions. Keys are hashed into slots by their deadline tick; each tick
+// only the current slot is visited. Rescheduling a key is O(1) and doesn't touch the wheel: the key
+// is moved to the right slot lazily, when its old slot comes up. Deadlines are rounded up to the
+// tick resolution. Not thread-safe.
+
+template<class Key, class Hash = std::hash<Key>>
+class timing_wheel {
+public:
+    typedef std::chrono::steady_clock clock_type;
+    typedef clock_type::duration duration_type;
+    typedef clock_type::time_point time_point;
+
+private:
+    struct entry_t {
+        // Tick at which the key expires.
+        std::uint64_t deadline;
+
+        // Tick of the slot the key is currently scheduled in. Slots may contain stale copies of the
+        // key, which are told apart by this tick.
+        std::uint64_t scheduled;
+    };
+
+    typedef std::vector<std::pair<Key, std::uint64_t>> slot_type;
+
+    const duration_type m_tick;
+    const time_point m_origin;
+
+    // Last processed tick.
+    std::uint64_t m_now;
+
+    std::vector<slot_type> m_slots;
+    std::unordered_map<Key, entry_t, Hash> m_entries;
+
+public:
+    timing_wheel(duration_type tick, size_t slots, time_point origin = clock_type::now()):
+        m_tick(tick),
+        m_origin(origin),
+        m_now(0),
+        m_slots(slots == 0 ? 1 : slots)
+    { }
+
+    duration_type
+    tick() const {
+        return m_tick;
+    }
+
+    size_t
+    size() const {
+        return m_entries.size();
+    }
+
+    bool
+    contains(const Key& key) const {
+        return m_entries.count(key) != 0;
+    }
+
+    // Schedules the key to expire at the given deadline, replacing its previous deadline if any.
+    void
+    schedule(const Key& key, time_point deadline) {
+        const auto tick = std::max(to_tick(deadline), m_now + 1);
+        const auto it = m_entries.find(key);
+
+        if(it == m_entries.end()) {
+            m_entries.insert({key, entry_t{tick, tick}});
+            m_slots[tick % m_slots.size()].emplace_back(key, tick);
+            return;
+        }
+
+        it->second.deadline = tick;
+
+        // Postponing is lazy, but an earlier deadline needs an earlier slot.
+        if(tick < it->second.scheduled) {
+            it->second.scheduled = tick;
+            m_slots[tick % m_slots.size()].emplace_back(key, tick);
+        }
+    }
+
+    void
+    erase(const Key& key) {
+        // Copies of the key in slots are dropped when visited.
+        m_entries.erase(key);
+    }
+
+    // Processes all the ticks up to the given time, invoking the callback for every expired key.
+    // Expired keys are removed before the callback is invoked, so it's safe to reschedule them.
+    template<class F>
+    void
+    advance(time_point now, F&& callback) {
+        // Only the ticks which have completely passed.
+        const auto target = now <= m_origin ? 0 : static_cast<std::uint64_t>((now - m_origin) / m_tick);
+
+        if(target <= m_now) {
+            return;
+        }
+
+        // If more ticks have passed than there are slots, every slot is visited only once.
+        const auto first = target - m_now > m_slots.size() ? target - m_slots.size() + 1 : m_now + 1;
+
+        m_now = target;
+
+        std::vector<Key> expired;
+
+        for(auto tick = first; tick <= target; ++tick) {
+            visit(tick % m_slots.size(), expired);
+        }
+
+        for(auto it = expired.begin(); it != expired.end(); ++it) {
+            callback(*it);
+        }
+    }
+
+private:
+    std::uint64_t
+    to_tick(time_point time) const {
+        if(time <= m_origin) {
+            return 0;
+        }
+
+        // Round up, so that keys never expire earlier than requested.
+        return static_cast<std::uint64_t>((time - m_origin + m_tick - duration_type(1)) / m_tick);
+    }
+
+    void
+    visit(size_t index, std::vector<Key>& expired) {
+        slot_type slot;
+        slot.swap(m_slots[index]);
+
+        for(auto it = slot.begin(); it != slot.end(); ++it) {
+            const auto entry = m_entries.find(it->first);
+
+            if(entry == m_entries.end() || entry->second.scheduled != it->second) {
+                // Stale copy of an erased or rescheduled key.
+                continue;
+            }
+
+            if(it->second > m_now) {
+                // Scheduled for one of the next rounds of the wheel.
+                m_slots[index].push_back(std::move(*it));
+            } else if(entry->second.deadline <= m_now) {
+                expired.push_back(it->first);
+                m_entries.erase(entry);
+            } else {
+                const auto tick = entry->second.deadline;
+
+                entry->second.scheduled = tick;
+                m_slots[tick % m_slots.size()].emplace_back(it->first, tick);
+            }
+        }
+    }
+};
+
+} // namespace cocaine
+
+#endif
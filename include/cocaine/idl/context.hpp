@@ -27,6 +27,10 @@
 #include "cocaine/traits/siginfo.hpp"
 #include "cocaine/traits/graph.hpp"
 
+#include "cocaine/rpc/frozen.hpp"
+
+#include <boost/variant/get.hpp>
+
 #include <signal.h>
 
 namespace cocaine { namespace io {
@@ -106,6 +110,22 @@ struct service {
 
         typedef void upstream_type;
     };
+
+    struct updated {
+        typedef context_tag tag;
+        typedef context_tag dispatch_type;
+
+        static const char* alias() {
+            return "updated";
+        }
+
+        typedef boost::mpl::list<
+            std::string,
+            std::tuple<std::vector<asio::ip::tcp::endpoint>, unsigned int, graph_root_t>
+        >::type argument_type;
+
+        typedef void upstream_type;
+    };
 };
 
 }; // struct context
@@ -129,7 +149,10 @@ struct protocol<context_tag> {
         context::service::exposed,
         // Fired on service destruction, after the service was removed from its endpoints, but
         // before the service object is actually destroyed.
-        context::service::removed
+        context::service::removed,
+        // Fired when endpoints of a running service change, e.g. re-resolved on SIGHUP. Subscribers
+        // should replace whatever they know about the service.
+        context::service::updated
     >::type messages;
 
     typedef context scope;
@@ -149,5 +172,28 @@ struct history_traits<io::context::os_signal> {
     }
 };
 
+// Updates are folded into the latest exposure of the service, so that late subscribers only see the
+// service exposed with its current endpoints, however many times it has been updated.
+template<>
+struct history_traits<io::context::service::updated> {
+    template<class History, class Variant>
+    static void
+    apply(History& history, Variant&& variant) {
+        typedef io::frozen<io::context::service::exposed> exposed_type;
+        typedef io::frozen<io::context::service::updated> updated_type;
+
+        const auto& update = boost::get<updated_type>(variant).tuple;
+
+        for(auto it = history.rbegin(); it != history.rend(); ++it) {
+            auto exposed = boost::get<exposed_type>(&*it);
+
+            if(exposed && std::get<0>(exposed->tuple) == std::get<0>(update)) {
+                std::get<1>(exposed->tuple) = std::get<1>(update);
+                return;
+            }
+        }
+    }
+};
+
 }} // namespace cocaine::aux
 #endif
@@ -172,6 +172,86 @@ struct routing {
     >::tag upstream_type;
 };
 
+struct routing_v2 {
+    typedef locator_tag tag;
+    typedef locator::routing_tag dispatch_type;
+
+    static const char* alias() {
+        return "routing_v2";
+    }
+
+    typedef boost::mpl::list<
+     /* Router ID. */
+        std::string
+    >::type argument_type;
+
+    typedef stream_of<
+     /* Routing table version, incremented on every change. */
+        uint64_t,
+     /* Whether this is a full snapshot of the routing table or only a delta since the previous
+        version. The first chunk in the stream is always a full snapshot. */
+        bool,
+     /* Routing groups on this node, either all of them or only the changed ones. In deltas, removed
+        routing groups have empty continuums. */
+        std::map<std::string, std::vector<std::tuple<uint32_t, std::string>>>
+    >::tag upstream_type;
+};
+
+struct mesh_tag;
+
+struct mesh {
+    struct update {
+        typedef locator::mesh_tag tag;
+        typedef locator::mesh_tag dispatch_type;
+
+        static const char* alias() {
+            return "update";
+        }
+
+        typedef boost::mpl::list<
+         /* Versions of the service states known to the sender, indexed by node ID. Only sent once
+            the link is set up, so that the other side could send back whatever the sender lacks. */
+            std::map<std::string, uint64_t>,
+         /* Service states of some nodes, indexed by node ID, each with its version and the version
+            it is based on. With zero base version the state is a full dump of all available services
+            on that node, otherwise it is a delta where removed services have no endpoints. */
+            std::map<std::string, std::tuple<
+                uint64_t,
+                uint64_t,
+                std::map<std::string, tuple::fold<protocol<resolve::upstream_type>::sequence_type>::type>
+            >>
+        >::type argument_type;
+
+        typedef void upstream_type;
+    };
+
+    typedef locator_tag tag;
+    typedef locator::mesh_tag dispatch_type;
+
+    static const char* alias() {
+        return "mesh";
+    }
+
+    typedef boost::mpl::list<
+     /* Node ID. */
+        std::string,
+     /* Versions of the service states known to the node, indexed by node ID. */
+        std::map<std::string, uint64_t>
+    >::type argument_type;
+
+    typedef stream_of<
+     /* Versions of the service states known to this node. Only sent in the first chunk. */
+        std::map<std::string, uint64_t>,
+     /* Service states of some nodes, indexed by node ID, each with its version and base version,
+        see mesh::update. */
+        std::map<std::string, std::tuple<
+            uint64_t,
+            uint64_t,
+            std::map<std::string, tuple::fold<protocol<resolve::upstream_type>::sequence_type>::type>
+        >>
+    >::tag upstream_type;
+};
+
 }; // struct locator
 
 template<>
@@ -186,7 +266,9 @@ struct protocol<locator_tag> {
         locator::refresh,
         locator::cluster,
         locator::publish,
-        locator::routing
+        locator::routing,
+        locator::mesh,
+        locator::routing_v2
     >::type messages;
 
     typedef locator scope;
@@ -214,6 +296,17 @@ struct protocol<locator::routing_tag> {
     >::type messages;
 };
 
+template<>
+struct protocol<locator::mesh_tag> {
+    typedef boost::mpl::int_<
+        1
+    >::type version;
+
+    typedef boost::mpl::list<
+        locator::mesh::update
+    >::type messages;
+};
+
 }} // namespace cocaine::io
 
 #endif
@@ -51,6 +51,11 @@ class actor_t {
     // allow concurrent observing and operations.
     synchronized<std::unique_ptr<asio::ip::tcp::acceptor>> m_acceptor;
 
+    // Local endpoints the service is reachable on. Resolving them might take a while for services
+    // bound to unspecified addresses, so they are resolved once on start and cached. Refreshed by
+    // the context on SIGHUP.
+    synchronized<std::vector<asio::ip::tcp::endpoint>> m_endpoints;
+
     // Main service thread.
     std::unique_ptr<io::chamber_t> m_chamber;
 
@@ -81,6 +86,26 @@ public:
 
     void
     terminate();
+
+    // Local endpoint the service is bound to, or a default-constructed one if it's not running.
+    auto
+    bound() const -> asio::ip::tcp::endpoint;
+
+    // Replaces the local endpoints, e.g. re-resolved on SIGHUP. Returns true if they have changed.
+    bool
+    update(std::vector<asio::ip::tcp::endpoint> endpoints);
+
+    // Resolves the bound endpoint into the endpoints the service is reachable on, which for
+    // unspecified addresses means resolving the hostname. Might take a while, but doesn't need the
+    // actor itself, so it's safe to call while the actor is being removed.
+    static
+    auto
+    resolve(asio::io_service& asio, const std::string& hostname, const asio::ip::tcp::endpoint& local)
+        -> std::vector<asio::ip::tcp::endpoint>;
+
+private:
+    auto
+    resolve() const -> std::vector<asio::ip::tcp::endpoint>;
 };
 
 } // namespace cocaine
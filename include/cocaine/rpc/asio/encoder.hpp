@@ -88,6 +88,38 @@ struct unbound_message_t {
 
 } // namespace aux
 
+// Message arguments packed ahead of time. The packed arguments are immutable and shared between
+// copies, and are spliced into message frames as-is, so the same arguments can be sent any number
+// of times while being serialized only once.
+
+template<class Event>
+struct prepacked {
+    template<class... Args>
+    explicit
+    prepacked(const Args&... args) {
+        auto buffer = std::make_shared<aux::encoded_buffers_t>();
+
+        msgpack::packer<aux::encoded_buffers_t> packer(*buffer);
+
+        type_traits<typename event_traits<Event>::argument_type>::pack(packer, args...);
+
+        blob = std::move(buffer);
+    }
+
+    auto
+    data() const -> const char* {
+        return blob->data();
+    }
+
+    size_t
+    size() const {
+        return blob->size();
+    }
+
+private:
+    std::shared_ptr<const aux::encoded_buffers_t> blob;
+};
+
 struct encoder_t {
     COCAINE_DECLARE_NONCOPYABLE(encoder_t)
 
@@ -105,6 +137,18 @@ struct encoder_t {
     tether(encoder_t& encoder, uint64_t channel_id, const hpack::header_storage_t& headers, Args&... args) {
         aux::encoded_message_t message;
 
+        append<Event>(encoder, message, channel_id, headers, args...);
+
+        return message;
+    }
+
+    // Packs one more frame right after the frames already in the message buffer.
+    template<class Event, class... Args>
+    static inline
+    void
+    append(encoder_t& encoder, aux::encoded_message_t& message, uint64_t channel_id,
+           const hpack::header_storage_t& headers, Args&... args)
+    {
         packer_type packer(message.buffer);
 
         packer.pack_array(4);
@@ -116,11 +160,9 @@ struct encoder_t {
 
         // Message arguments
 
-        type_traits<typename event_traits<Event>::argument_type>::pack(packer,
-            std::forward<Args>(args)...);
+        pack_arguments<Event>(packer, args...);
 
         encoder.pack_headers(packer, headers);
-        return message;
     }
 
     aux::encoded_message_t
@@ -130,6 +172,20 @@ struct encoder_t {
     pack_headers(packer_type& packer, const hpack::header_storage_t& headers);
 
 private:
+    template<class Event, class... Args>
+    static inline
+    void
+    pack_arguments(packer_type& packer, const Args&... args) {
+        type_traits<typename event_traits<Event>::argument_type>::pack(packer, args...);
+    }
+
+    template<class Event>
+    static inline
+    void
+    pack_arguments(packer_type& packer, const prepacked<Event>& args) {
+        packer.pack_raw_body(args.data(), args.size());
+    }
+
     // HPACK HTTP/2.0 tables.
     hpack::header_table_t hpack_context;
 };
@@ -157,6 +213,38 @@ struct encoded:
     { }
 };
 
+// Encodes a batch of messages of the same type into consecutive frames of a single buffer, so that
+// the whole batch goes through the session and the socket as one write.
+
+template<class Event>
+struct encoded_batch:
+    public aux::unbound_message_t
+{
+    typedef typename event_traits<Event>::tuple_type tuple_type;
+
+    encoded_batch(uint64_t channel_id, std::vector<tuple_type> batch): unbound_message_t(
+        std::bind(&encoded_batch::tether,
+            std::placeholders::_1,
+            channel_id,
+            std::move(batch)))
+    { }
+
+private:
+    static
+    aux::encoded_message_t
+    tether(encoder_t& encoder, uint64_t channel_id, const std::vector<tuple_type>& batch) {
+        aux::encoded_message_t message;
+
+        const hpack::header_storage_t headers;
+
+        for(auto it = batch.begin(); it != batch.end(); ++it) {
+            encoder_t::append<Event>(encoder, message, channel_id, headers, *it);
+        }
+
+        return message;
+    }
+};
+
 }} // namespace cocaine::io
 
 #endif
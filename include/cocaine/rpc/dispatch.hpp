@@ -30,6 +30,7 @@
 #include "cocaine/rpc/slot/generic.hpp"
 #include "cocaine/rpc/slot/streamed.hpp"
 #include "cocaine/rpc/traversal.hpp"
+#include "cocaine/rpc/unpacker.hpp"
 #include "cocaine/traits/tuple.hpp"
 #include "cocaine/utility/exchange.hpp"
 
@@ -172,15 +173,21 @@ struct calling_visitor_t:
     operator()(const std::shared_ptr<io::basic_slot<Event>>& slot) const {
         typedef io::basic_slot<Event> slot_type;
 
+        typedef typename io::event_traits<Event>::argument_type sequence_type;
+
         // Unpacked arguments storage.
         typename slot_type::tuple_type args;
 
-        try {
-            // NOTE: Unpacks the object into a tuple using the argument typelist unlike using plain
-            // tuple type traits, in order to support parameter tags, like optional<T>.
-            io::type_traits<typename io::event_traits<Event>::argument_type>::unpack(unpacked, args);
-        } catch(const msgpack::type_error& e) {
-            throw std::system_error(error::invalid_argument, e.what());
+        // NOTE: Unpacks the object into a tuple using the argument typelist unlike using plain tuple
+        // type traits, in order to support parameter tags, like optional<T>. The specialized
+        // unpacker doesn't throw, so the generic one is only engaged on malformed arguments to
+        // provide a detailed error description.
+        if(io::unpacker<sequence_type>::unpack(unpacked, args)) {
+            try {
+                io::type_traits<sequence_type>::unpack(unpacked, args);
+            } catch(const msgpack::type_error& e) {
+                throw std::system_error(error::invalid_argument, e.what());
+            }
         }
 
         // Call the slot with the upstream constrained with the event's upstream protocol type tag.
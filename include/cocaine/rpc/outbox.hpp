@@ -0,0 +1,421 @@
+/*
+    Copyright (c) 2011-2014 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2014 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COCAINE_IO_MESSAGE_OUTBOX_HPP
+#define COCAINE_IO_MESSAGE_OUTBOX_HPP
+
+#include "cocaine/errors.hpp"
+#include "cocaine/rpc/frozen.hpp"
+#include "cocaine/rpc/tags.hpp"
+#include "cocaine/rpc/upstream.hpp"
+
+#include <atomic>
+#include <thread>
+
+namespace cocaine { namespace io {
+
+template<class Tag> class message_outbox;
+template<class Tag> class message_slot;
+
+namespace aux {
+
+// Type-erased pending message. Each node is typed by its event, so sending it doesn't need any
+// variant dispatch - it just replays the frozen arguments into the upstream.
+
+struct outbox_node_t {
+    outbox_node_t(): next(nullptr) { }
+
+    virtual
+   ~outbox_node_t() = default;
+
+    virtual
+    void
+    send(basic_upstream_t& upstream) = 0;
+
+    std::atomic<outbox_node_t*> next;
+};
+
+template<class Event>
+struct outbox_event_t:
+    public outbox_node_t
+{
+    template<class... Args>
+    outbox_event_t(hpack::header_storage_t headers_, Args&&... args):
+        headers(std::move(headers_)),
+        message(Event(), std::forward<Args>(args)...)
+    { }
+
+    virtual
+    void
+    send(basic_upstream_t& upstream) {
+        upstream.template send<Event>(std::move(headers), std::move(message.tuple));
+    }
+
+private:
+    hpack::header_storage_t headers;
+    frozen<Event> message;
+};
+
+template<class Event>
+struct outbox_batch_t:
+    public outbox_node_t
+{
+    typedef typename event_traits<Event>::tuple_type tuple_type;
+
+    explicit
+    outbox_batch_t(std::vector<tuple_type> batch_):
+        batch(std::move(batch_))
+    { }
+
+    virtual
+    void
+    send(basic_upstream_t& upstream) {
+        upstream.template send_batch<Event>(std::move(batch));
+    }
+
+private:
+    std::vector<tuple_type> batch;
+};
+
+template<class Event>
+struct outbox_packed_t:
+    public outbox_node_t
+{
+    explicit
+    outbox_packed_t(hpack::header_storage_t headers_, prepacked<Event> message_):
+        headers(std::move(headers_)),
+        message(std::move(message_))
+    { }
+
+    virtual
+    void
+    send(basic_upstream_t& upstream) {
+        upstream.template send<Event>(std::move(headers), message);
+    }
+
+private:
+    hpack::header_storage_t headers;
+    prepacked<Event> message;
+};
+
+// Intrusive multi-producer single-consumer queue (Dmitry Vyukov's design). Producers are wait-free:
+// a push is one atomic exchange and one store. The consumer may observe a producer in the middle of
+// a push, in which case pop() returns nullptr and that producer is responsible to flush afterwards.
+
+class mpsc_queue_t {
+    COCAINE_DECLARE_NONCOPYABLE(mpsc_queue_t)
+
+    struct stub_t: public outbox_node_t {
+        virtual
+        void
+        send(basic_upstream_t&) { }
+    };
+
+    std::atomic<outbox_node_t*> m_head;
+    outbox_node_t* m_tail;
+
+    stub_t m_stub;
+
+public:
+    mpsc_queue_t():
+        m_head(&m_stub),
+        m_tail(&m_stub)
+    { }
+
+   ~mpsc_queue_t() {
+        while(outbox_node_t* node = pop()) {
+            delete node;
+        }
+    }
+
+    void
+    push(outbox_node_t* node) {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        m_head.exchange(node)->next.store(node);
+    }
+
+    // Must be called from a single thread at a time.
+    outbox_node_t*
+    pop() {
+        outbox_node_t* tail = m_tail;
+        outbox_node_t* next = tail->next.load();
+
+        if(tail == &m_stub) {
+            if(next == nullptr) {
+                return nullptr;
+            }
+
+            m_tail = tail = next;
+            next = next->next.load();
+        }
+
+        if(next) {
+            m_tail = next;
+            return tail;
+        }
+
+        if(tail != m_head.load()) {
+            // Some producer is in the middle of a push.
+            return nullptr;
+        }
+
+        push(&m_stub);
+
+        if((next = tail->next.load()) != nullptr) {
+            m_tail = next;
+            return tail;
+        }
+
+        return nullptr;
+    }
+};
+
+} // namespace aux
+
+// Lock-free outbox for streaming protocols. Writers enqueue frozen messages without taking any
+// locks, and whichever thread first notices that the upstream is attached becomes the only one to
+// replay the queue into it, so the message order is preserved. Sealing the outbox, i.e. appending
+// a terminal message, waits only for the appends already in flight.
+
+template<class Tag>
+class message_outbox {
+    COCAINE_DECLARE_NONCOPYABLE(message_outbox)
+
+    aux::mpsc_queue_t m_queue;
+
+    // Bit 0 is set when the outbox is sealed, the rest is twice the number of in-flight appends.
+    std::atomic<std::uint64_t> m_gate;
+
+    // Number of pending flush requests. The thread which bumps it from zero becomes the consumer.
+    std::atomic<std::size_t> m_pending;
+
+    // The upstream is assigned exactly once, before the flag is raised.
+    std::atomic<bool> m_attached;
+    std::shared_ptr<basic_upstream_t> m_upstream;
+
+    // The first failure is sticky, so that every later writer sees it. Assigned by the consumer.
+    std::atomic<bool> m_failed;
+    std::error_code m_error;
+
+public:
+    message_outbox():
+        m_gate(0),
+        m_pending(0),
+        m_attached(false),
+        m_failed(false)
+    { }
+
+    template<class Event, class... Args>
+    std::error_code
+    append(hpack::header_storage_t headers, Args&&... args) {
+        static_assert(std::is_same<typename Event::tag, Tag>::value,
+                      "message protocol is not compatible with this message outbox");
+
+        std::unique_ptr<aux::outbox_node_t> node(
+            new aux::outbox_event_t<Event>(std::move(headers), std::forward<Args>(args)...)
+        );
+
+        return enqueue(std::move(node));
+    }
+
+    /// Appends multiple messages at once. They are sent as consecutive frames in a single buffer.
+    template<class Event>
+    std::error_code
+    append_batch(std::vector<typename event_traits<Event>::tuple_type> batch) {
+        static_assert(std::is_same<typename Event::tag, Tag>::value,
+                      "message protocol is not compatible with this message outbox");
+
+        std::unique_ptr<aux::outbox_node_t> node(new aux::outbox_batch_t<Event>(std::move(batch)));
+
+        return enqueue(std::move(node));
+    }
+
+    /// Appends a message serialized ahead of time. The same payload can be shared by many outboxes.
+    template<class Event>
+    std::error_code
+    append_packed(hpack::header_storage_t headers, prepacked<Event> message) {
+        static_assert(std::is_same<typename Event::tag, Tag>::value,
+                      "message protocol is not compatible with this message outbox");
+
+        std::unique_ptr<aux::outbox_node_t> node(
+            new aux::outbox_packed_t<Event>(std::move(headers), std::move(message))
+        );
+
+        return enqueue(std::move(node));
+    }
+
+    /// Appends the terminal message. All further appends will fail with the closed_upstream error.
+    template<class Event, class... Args>
+    std::error_code
+    seal(hpack::header_storage_t headers, Args&&... args) {
+        static_assert(std::is_same<typename Event::tag, Tag>::value,
+                      "message protocol is not compatible with this message outbox");
+
+        std::unique_ptr<aux::outbox_node_t> node(
+            new aux::outbox_event_t<Event>(std::move(headers), std::forward<Args>(args)...)
+        );
+
+        if(m_gate.fetch_or(1) & 1) {
+            return make_error_code(error::protocol_errors::closed_upstream);
+        }
+
+        // Appends which have already passed the gate must land in the queue before the terminal
+        // message. Each of them is just a couple of atomic operations away from completion.
+        while(m_gate.load() != 1) {
+            std::this_thread::yield();
+        }
+
+        m_queue.push(node.release());
+
+        return flush();
+    }
+
+    /// This one can throw to propagate exception to session,
+    /// as we mainly attach the outbox in invocation slot.
+    template<class OtherTag>
+    void
+    attach(upstream<OtherTag>&& upstream) {
+        static_assert(details::is_compatible<Tag, OtherTag>::value,
+                      "upstream protocol is not compatible with this message outbox");
+
+        m_upstream = std::move(upstream.ptr);
+        m_attached.store(true);
+
+        if(const auto ec = flush()) {
+            throw std::system_error(ec);
+        }
+    }
+
+private:
+    std::error_code
+    enqueue(std::unique_ptr<aux::outbox_node_t> node) {
+        if(m_gate.fetch_add(2) & 1) {
+            m_gate.fetch_sub(2);
+            return make_error_code(error::protocol_errors::closed_upstream);
+        }
+
+        m_queue.push(node.release());
+        m_gate.fetch_sub(2);
+
+        return flush();
+    }
+
+    std::error_code
+    flush() {
+        if(!m_attached.load()) {
+            // Messages will be replayed on attach.
+            return std::error_code();
+        }
+
+        if(m_pending.fetch_add(1) == 0) {
+            do {
+                while(aux::outbox_node_t* ptr = m_queue.pop()) {
+                    std::unique_ptr<aux::outbox_node_t> node(ptr);
+
+                    if(m_failed.load(std::memory_order_relaxed)) {
+                        continue;
+                    }
+
+                    try {
+                        node->send(*m_upstream);
+                    } catch(const std::system_error& e) {
+                        m_error = e.code();
+                        m_failed.store(true);
+                    }
+                }
+            } while(m_pending.fetch_sub(1) != 1);
+        }
+
+        return m_failed.load() ? m_error : std::error_code();
+    }
+};
+
+// Single-assignment outbox for primitive protocols. Whoever comes second - the writer or the
+// upstream - sends the message, so neither side ever blocks.
+
+template<class Tag>
+class message_slot {
+    COCAINE_DECLARE_NONCOPYABLE(message_slot)
+
+    enum flags: int {
+        assigned = 1,
+        attached = 2
+    };
+
+    std::atomic<bool> m_taken;
+    std::atomic<int> m_state;
+
+    std::unique_ptr<aux::outbox_node_t> m_message;
+    std::shared_ptr<basic_upstream_t> m_upstream;
+
+public:
+    message_slot():
+        m_taken(false),
+        m_state(0)
+    { }
+
+    template<class Event, class... Args>
+    std::error_code
+    assign(hpack::header_storage_t headers, Args&&... args) {
+        static_assert(std::is_same<typename Event::tag, Tag>::value,
+                      "message protocol is not compatible with this message slot");
+
+        std::unique_ptr<aux::outbox_node_t> node(
+            new aux::outbox_event_t<Event>(std::move(headers), std::forward<Args>(args)...)
+        );
+
+        if(m_taken.exchange(true)) {
+            return make_error_code(error::protocol_errors::closed_upstream);
+        }
+
+        m_message = std::move(node);
+
+        if((m_state.fetch_or(flags::assigned) & flags::attached) == 0) {
+            return std::error_code();
+        }
+
+        try {
+            m_message->send(*m_upstream);
+        } catch(const std::system_error& e) {
+            return e.code();
+        }
+
+        return std::error_code();
+    }
+
+    /// This one can throw to propagate exception to session,
+    /// as we mainly attach the slot in invocation slot.
+    template<class OtherTag>
+    void
+    attach(upstream<OtherTag>&& upstream) {
+        static_assert(details::is_compatible<Tag, OtherTag>::value,
+                      "upstream protocol is not compatible with this message slot");
+
+        m_upstream = std::move(upstream.ptr);
+
+        if(m_state.fetch_or(flags::attached) & flags::assigned) {
+            m_message->send(*m_upstream);
+        }
+    }
+};
+
+}} // namespace cocaine::io
+
+#endif
@@ -23,7 +23,7 @@
 
 #include "cocaine/rpc/slot/function.hpp"
 
-#include "cocaine/rpc/queue.hpp"
+#include "cocaine/rpc/outbox.hpp"
 
 namespace cocaine { namespace io {
 
@@ -103,21 +103,21 @@ template<class T>
 struct deferred_base {
     typedef typename aux::reconstruct<T>::type type;
 
-    typedef io::message_queue<io::primitive_tag<type>> queue_type;
+    typedef io::message_slot<io::primitive_tag<type>> queue_type;
     typedef io::primitive<type> protocol;
 
     deferred_base():
-        outbox(new synchronized<queue_type>())
+        outbox(std::make_shared<queue_type>())
     { }
 
     std::error_code
     abort(const std::error_code& ec, const std::string& reason) {
-        return outbox->synchronize()->template append<typename protocol::error>(ec, reason);
+        return abort(hpack::header_storage_t(), ec, reason);
     }
 
     std::error_code
     abort(hpack::header_storage_t headers, const std::error_code& ec, const std::string& reason) {
-        return outbox->synchronize()->template append<typename protocol::error>(std::move(headers), ec, reason);
+        return outbox->template assign<typename protocol::error>(std::move(headers), ec, reason);
     }
 
     template<class... Args>
@@ -129,17 +129,18 @@ struct deferred_base {
     template<class... Args>
     std::error_code
     write(hpack::header_storage_t headers, Args&&... args) {
-        return outbox->synchronize()->template append<typename protocol::value>(std::move(headers), std::forward<Args>(args)...);
+        return outbox->template assign<typename protocol::value>(std::move(headers), std::forward<Args>(args)...);
     }
 
     template<class UpstreamType>
     void
     attach(UpstreamType&& upstream) {
-        outbox->synchronize()->attach(std::move(upstream));
+        outbox->attach(std::move(upstream));
     }
 
 private:
-    const std::shared_ptr<synchronized<queue_type>> outbox;
+    // Deferred results are assigned only once, so there's no need for neither a lock nor a queue.
+    const std::shared_ptr<queue_type> outbox;
 };
 
 template<class T>
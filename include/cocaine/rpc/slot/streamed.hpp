@@ -22,7 +22,6 @@
 #define COCAINE_IO_STREAMED_SLOT_HPP
 
 #include "cocaine/rpc/slot/deferred.hpp"
-#include "cocaine/utility/exchange.hpp"
 
 namespace cocaine {
 
@@ -30,7 +29,7 @@ template<class T>
 struct streamed {
     typedef typename aux::reconstruct<T>::type type;
 
-    typedef io::message_queue<io::streaming_tag<type>> queue_type;
+    typedef io::message_outbox<io::streaming_tag<type>> queue_type;
     typedef io::streaming<type> protocol;
 
     typedef typename protocol::chunk chunk_type;
@@ -38,7 +37,7 @@ struct streamed {
     typedef typename protocol::choke choke_type;
 
     streamed():
-        data(std::make_shared<synchronized<data_t>>())
+        outbox(std::make_shared<queue_type>())
     { }
 
     template<class... Args>
@@ -47,12 +46,7 @@ struct streamed {
         std::error_code
     >::type
     write(hpack::header_storage_t headers, Args&&... args) {
-        auto d = data->synchronize();
-        if (d->state == state_t::closed) {
-            return make_error_code(error::protocol_errors::closed_upstream);
-        }
-
-        return d->outbox.template append<chunk_type>(std::move(headers), std::forward<Args>(args)...);
+        return outbox->template append<chunk_type>(std::move(headers), std::forward<Args>(args)...);
     }
 
     template<class... Args>
@@ -64,15 +58,39 @@ struct streamed {
         return write({}, std::forward<Args>(args)...);
     }
 
+    /// Writes a chunk serialized ahead of time, e.g. to send the same chunk to many streams.
     std::error_code
-    abort(hpack::header_storage_t headers, const std::error_code& ec, const std::string& reason) {
-        return data->apply([&](data_t& data) {
-            if(utility::exchange(data.state, state_t::closed) == state_t::closed) {
-                return make_error_code(error::protocol_errors::closed_upstream);
-            }
+    write(const io::prepacked<chunk_type>& chunk) {
+        return outbox->template append_packed<chunk_type>({}, chunk);
+    }
+
+    /// Writes a range of chunks at once. All of them are serialized into consecutive frames of one
+    /// buffer and pushed into the session in one go, which is much cheaper for small chunks.
+    template<class Iterator>
+    std::error_code
+    write_batch(Iterator begin, Iterator end) {
+        std::vector<typename io::event_traits<chunk_type>::tuple_type> batch;
 
-            return data.outbox.template append<error_type>(std::move(headers), ec, reason);
-        });
+        for(; begin != end; ++begin) {
+            batch.emplace_back(*begin);
+        }
+
+        if(batch.empty()) {
+            return std::error_code();
+        }
+
+        return outbox->template append_batch<chunk_type>(std::move(batch));
+    }
+
+    template<class Range>
+    std::error_code
+    write_batch(const Range& range) {
+        return write_batch(std::begin(range), std::end(range));
+    }
+
+    std::error_code
+    abort(hpack::header_storage_t headers, const std::error_code& ec, const std::string& reason) {
+        return outbox->template seal<error_type>(std::move(headers), ec, reason);
     }
 
     std::error_code
@@ -82,13 +100,7 @@ struct streamed {
 
     std::error_code
     close(hpack::header_storage_t headers) {
-        return data->apply([&](data_t& data) {
-            if (utility::exchange(data.state, state_t::closed) == state_t::closed) {
-                return make_error_code(error::protocol_errors::closed_upstream);
-            }
-
-            return data.outbox.template append<choke_type>(std::move(headers));
-        });
+        return outbox->template seal<choke_type>(std::move(headers));
     }
 
     std::error_code
@@ -99,23 +111,12 @@ struct streamed {
     template<class UpstreamType>
     void
     attach(UpstreamType&& upstream) {
-        data->synchronize()->outbox.attach(std::move(upstream));
+        outbox->attach(std::move(upstream));
     }
 
 private:
-    enum class state_t {
-        open,
-        closed
-    };
-
-    struct data_t {
-        data_t(): state(state_t::open) {}
-
-        state_t state;
-        queue_type outbox;
-    };
-
-    const std::shared_ptr<synchronized<data_t>> data;
+    // Lock-free, so that multiple service threads can write chunks without contending on a mutex.
+    const std::shared_ptr<queue_type> outbox;
 };
 
 } // namespace cocaine
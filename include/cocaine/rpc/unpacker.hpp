@@ -0,0 +1,281 @@
+/*
+    Copyright (c) 2011-2014 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2014 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COCAINE_IO_UNPACKER_HPP
+#define COCAINE_IO_UNPACKER_HPP
+
+#include "cocaine/errors.hpp"
+#include "cocaine/rpc/tags.hpp"
+#include "cocaine/traits.hpp"
+#include "cocaine/traits/enum.hpp"
+
+#include <limits>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <boost/mpl/at.hpp>
+#include <boost/mpl/count_if.hpp>
+#include <boost/mpl/lambda.hpp>
+#include <boost/mpl/size.hpp>
+
+namespace cocaine { namespace io {
+
+// Non-throwing element unpackers. Every one of them returns false on type mismatch instead of
+// throwing msgpack::type_error. Types without a dedicated unpacker fall back to type_traits<T>.
+
+template<class T, class = void>
+struct element_unpacker {
+    static inline
+    bool
+    apply(const msgpack::object& source, T& target) {
+        try {
+            type_traits<T>::unpack(source, target);
+        } catch(const msgpack::type_error&) {
+            return false;
+        }
+
+        return true;
+    }
+};
+
+template<>
+struct element_unpacker<std::string> {
+    static inline
+    bool
+    apply(const msgpack::object& source, std::string& target) {
+        if(source.type != msgpack::type::RAW) {
+            return false;
+        }
+
+        target.assign(source.via.raw.ptr, source.via.raw.size);
+
+        return true;
+    }
+};
+
+template<>
+struct element_unpacker<bool> {
+    static inline
+    bool
+    apply(const msgpack::object& source, bool& target) {
+        if(source.type != msgpack::type::BOOLEAN) {
+            return false;
+        }
+
+        target = source.via.boolean;
+
+        return true;
+    }
+};
+
+template<class T>
+struct element_unpacker<
+    T,
+    typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type
+>
+{
+    static inline
+    bool
+    apply(const msgpack::object& source, T& target) {
+        // NOTE: Limits are stored in variables to suppress tautological comparison warnings for the
+        // widest integer types.
+        const uint64_t max = static_cast<uint64_t>(std::numeric_limits<T>::max());
+        const int64_t  min = static_cast<int64_t>(std::numeric_limits<T>::min());
+
+        switch(source.type) {
+        case msgpack::type::POSITIVE_INTEGER:
+            if(source.via.u64 > max) {
+                return false;
+            }
+
+            target = static_cast<T>(source.via.u64);
+            return true;
+
+        case msgpack::type::NEGATIVE_INTEGER:
+            if(!std::is_signed<T>::value || source.via.i64 < min) {
+                return false;
+            }
+
+            target = static_cast<T>(source.via.i64);
+            return true;
+
+        default:
+            return false;
+        }
+    }
+};
+
+template<class T>
+struct element_unpacker<
+    T,
+    typename std::enable_if<std::is_enum<T>::value>::type
+>
+{
+    typedef typename type_traits<T>::base_type base_type;
+
+    static inline
+    bool
+    apply(const msgpack::object& source, T& target) {
+        base_type value;
+
+        if(!element_unpacker<base_type>::apply(source, value)) {
+            return false;
+        }
+
+        target = static_cast<T>(value);
+
+        return true;
+    }
+};
+
+template<class T>
+struct element_unpacker<std::vector<T>> {
+    static inline
+    bool
+    apply(const msgpack::object& source, std::vector<T>& target) {
+        if(source.type != msgpack::type::ARRAY) {
+            return false;
+        }
+
+        target.resize(source.via.array.size);
+
+        for(size_t i = 0; i < source.via.array.size; ++i) {
+            if(!element_unpacker<T>::apply(source.via.array.ptr[i], target[i])) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+};
+
+namespace aux {
+
+// Sequence elements are looked up by their position, which is fine since optional arguments are
+// only allowed at the end of the sequence.
+
+template<class T>
+struct sequence_element {
+    static inline
+    bool
+    apply(const msgpack::object_array& source, size_t position, T& target) {
+        if(position >= source.size) {
+            return false;
+        }
+
+        return element_unpacker<T>::apply(source.ptr[position], target);
+    }
+};
+
+template<class T>
+struct sequence_element<optional<T>> {
+    static inline
+    bool
+    apply(const msgpack::object_array& source, size_t position, T& target) {
+        if(position >= source.size) {
+            target = T();
+            return true;
+        }
+
+        return element_unpacker<T>::apply(source.ptr[position], target);
+    }
+};
+
+template<class T, T Default>
+struct sequence_element<optional_with_default<T, Default>> {
+    static inline
+    bool
+    apply(const msgpack::object_array& source, size_t position, T& target) {
+        if(position >= source.size) {
+            target = Default;
+            return true;
+        }
+
+        return element_unpacker<T>::apply(source.ptr[position], target);
+    }
+};
+
+} // namespace aux
+
+// Compile-time specialized unpacker for message argument sequences. Unlike type_traits<Sequence>,
+// it checks the array shape once up front, constructs every element directly in the target tuple
+// and reports failures with an error code instead of an exception.
+
+template<class Sequence>
+struct unpacker {
+    enum constants: unsigned {
+        minimal = boost::mpl::count_if<
+            Sequence,
+            boost::mpl::lambda<details::is_required<boost::mpl::_1>>
+        >::value,
+        length = boost::mpl::size<Sequence>::value
+    };
+
+    template<class... Args>
+    static inline
+    std::error_code
+    unpack(const msgpack::object& source, std::tuple<Args...>& target) {
+        static_assert(sizeof...(Args) == length, "sequence length mismatch");
+
+        // NOTE: Stored in a variable to suppress tautological comparison warnings for sequences
+        // without required elements.
+        const size_t required = minimal;
+
+        if(source.type != msgpack::type::ARRAY || source.via.array.size < required) {
+            return make_error_code(error::invalid_argument);
+        }
+
+        if(!unpack_sequence<0>(source.via.array, target, std::integral_constant<bool, 0 < length>())) {
+            return make_error_code(error::invalid_argument);
+        }
+
+        return std::error_code();
+    }
+
+private:
+    template<size_t Position, class Tuple>
+    static inline
+    bool
+    unpack_sequence(const msgpack::object_array& source, Tuple& target, std::true_type) {
+        typedef typename boost::mpl::at_c<Sequence, Position>::type element_type;
+
+        if(!aux::sequence_element<element_type>::apply(source, Position, std::get<Position>(target))) {
+            return false;
+        }
+
+        return unpack_sequence<Position + 1>(source, target,
+            std::integral_constant<bool, Position + 1 < length>());
+    }
+
+    template<size_t Position, class Tuple>
+    static inline
+    bool
+    unpack_sequence(const msgpack::object_array& COCAINE_UNUSED_(source),
+                    Tuple& COCAINE_UNUSED_(target),
+                    std::false_type)
+    {
+        return true;
+    }
+};
+
+}} // namespace cocaine::io
+
+#endif
@@ -66,6 +66,11 @@ public:
     template<class Event, class... Args>
     void
     send(hpack::header_storage_t headers, Args&&... args);
+
+    /// Sends multiple messages of the same type as consecutive frames with a single session push.
+    template<class Event>
+    void
+    send_batch(std::vector<typename event_traits<Event>::tuple_type> batch);
 };
 
 template<class Event, class... Args>
@@ -80,9 +85,17 @@ basic_upstream_t::send(Args&&... args) {
     m_session->push(encoded<Event>(m_channel_id, std::forward<Args>(args)...));
 }
 
+template<class Event>
+void
+basic_upstream_t::send_batch(std::vector<typename event_traits<Event>::tuple_type> batch) {
+    m_session->push(encoded_batch<Event>(m_channel_id, std::move(batch)));
+}
+
 // Forwards for the upstream<T> class
 
 template<class Tag> class message_queue;
+template<class Tag> class message_outbox;
+template<class Tag> class message_slot;
 
 } // namespace io
 
@@ -94,6 +107,8 @@ class allowing:
 template<class Tag>
 class upstream {
     template<class> friend class io::message_queue;
+    template<class> friend class io::message_outbox;
+    template<class> friend class io::message_slot;
 
     // The original untyped upstream.
     io::upstream_ptr_t ptr;
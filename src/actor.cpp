@@ -36,7 +36,9 @@
 
 #include <blackhole/logger.hpp>
 
+#include <metrics/accumulator/sliding/window.hpp>
 #include <metrics/registry.hpp>
+#include <metrics/timer.hpp>
 
 using namespace cocaine;
 using namespace cocaine::io;
@@ -49,6 +51,9 @@ using ip::tcp;
 struct actor_t::metrics_t {
     metrics::shared_metric<std::atomic<std::int64_t>> connections_accepted;
     metrics::shared_metric<std::atomic<std::int64_t>> connections_rejected;
+
+    // Local endpoints resolution timings.
+    metrics::shared_metric<metrics::timer<metrics::accumulator::sliding::window_t>> resolve;
 };
 
 class actor_t::accept_action_t:
@@ -130,7 +135,8 @@ actor_t::actor_t(context_t& context, const std::shared_ptr<io_service>& asio,
     m_asio(asio),
     metrics(new metrics_t{
         context.metrics_hub().counter<std::int64_t>(cocaine::format("{}.connections.accepted", prototype->name())),
-        context.metrics_hub().counter<std::int64_t>(cocaine::format("{}.connections.rejected", prototype->name()))
+        context.metrics_hub().counter<std::int64_t>(cocaine::format("{}.connections.rejected", prototype->name())),
+        context.metrics_hub().timer(cocaine::format("{}.endpoints.resolve", prototype->name()))
     }),
     m_prototype(std::move(prototype))
 {}
@@ -143,7 +149,8 @@ actor_t::actor_t(context_t& context, const std::shared_ptr<io_service>& asio,
     m_asio(asio),
     metrics(new metrics_t{
         context.metrics_hub().counter<std::int64_t>(cocaine::format("{}.connections.accepted", service->prototype().name())),
-        context.metrics_hub().counter<std::int64_t>(cocaine::format("{}.connections.rejected", service->prototype().name()))
+        context.metrics_hub().counter<std::int64_t>(cocaine::format("{}.connections.rejected", service->prototype().name())),
+        context.metrics_hub().timer(cocaine::format("{}.endpoints.resolve", service->prototype().name()))
     })
 {
     basic_dispatch_t* prototype = &service->prototype();
@@ -159,7 +166,12 @@ actor_t::~actor_t() = default;
 
 std::vector<tcp::endpoint>
 actor_t::endpoints() const {
-    tcp::resolver::iterator begin;
+    return *m_endpoints.synchronize();
+}
+
+std::vector<tcp::endpoint>
+actor_t::resolve() const {
+    const auto timer = metrics->resolve->context();
 
     try {
         const auto local = m_acceptor.apply(
@@ -172,21 +184,26 @@ actor_t::endpoints() const {
             }
         });
 
-        if(!local.address().is_unspecified()) {
-            return std::vector<tcp::endpoint>({local});
-        }
-
-        const tcp::resolver::query::flags flags = tcp::resolver::query::address_configured
-                                                | tcp::resolver::query::numeric_service;
-
-        begin = tcp::resolver(*m_asio).resolve(tcp::resolver::query(
-            m_context.config().network().hostname(), std::to_string(local.port()),
-            flags
-        ));
+        return resolve(*m_asio, m_context.config().network().hostname(), local);
     } catch(const std::system_error& e) {
         COCAINE_LOG_ERROR(m_log, "unable to resolve local endpoints: {}", error::to_string(e));
         return std::vector<tcp::endpoint>();
     }
+}
+
+std::vector<tcp::endpoint>
+actor_t::resolve(asio::io_service& asio, const std::string& hostname, const tcp::endpoint& local) {
+    if(!local.address().is_unspecified()) {
+        return std::vector<tcp::endpoint>({local});
+    }
+
+    const tcp::resolver::query::flags flags = tcp::resolver::query::address_configured
+                                            | tcp::resolver::query::numeric_service;
+
+    const auto begin = tcp::resolver(asio).resolve(tcp::resolver::query(
+        hostname, std::to_string(local.port()),
+        flags
+    ));
 
     // For unspecified bind addresses, actual address set has to be resolved first. In other words,
     // unspecified means every available and reachable address for the host.
@@ -200,6 +217,28 @@ actor_t::endpoints() const {
     return endpoints;
 }
 
+tcp::endpoint
+actor_t::bound() const {
+    return m_acceptor.apply([](const std::unique_ptr<tcp::acceptor>& ptr) -> tcp::endpoint {
+        std::error_code ec;
+        return ptr ? ptr->local_endpoint(ec) : tcp::endpoint();
+    });
+}
+
+bool
+actor_t::update(std::vector<tcp::endpoint> endpoints) {
+    COCAINE_LOG_DEBUG(m_log, "resolved {:d} local endpoint(s)", endpoints.size());
+
+    return m_endpoints.apply([&](std::vector<tcp::endpoint>& cached) -> bool {
+        if(cached == endpoints) {
+            return false;
+        }
+
+        cached = std::move(endpoints);
+        return true;
+    });
+}
+
 bool
 actor_t::is_active() const {
     return static_cast<bool>(*m_acceptor.synchronize());
@@ -238,6 +277,8 @@ actor_t::run() {
         COCAINE_LOG_INFO(m_log, "exposing service on local endpoint {}", ptr->local_endpoint(ec));
     });
 
+    update(resolve());
+
     m_asio->post(std::bind(&accept_action_t::operator(),
         std::make_shared<accept_action_t>(*this)
     ));
@@ -269,4 +310,8 @@ actor_t::terminate() {
 
     // Mark this service's port as free.
     m_context.mapper().retain(m_prototype->name());
+
+    m_endpoints.apply([](std::vector<tcp::endpoint>& cached) {
+        cached.clear();
+    });
 }
@@ -34,11 +34,20 @@
 #include "cocaine/traits/tuple.hpp"
 #include "cocaine/traits/vector.hpp"
 
+#include "cocaine/unique_id.hpp"
+
 #include <asio/io_service.hpp>
 #include <asio/ip/multicast.hpp>
 
 #include <blackhole/logger.hpp>
 
+#include <metrics/registry.hpp>
+
+#include <boost/optional/optional.hpp>
+
+#include <cstring>
+#include <random>
+
 using namespace cocaine::io;
 using namespace cocaine::cluster;
 
@@ -84,6 +93,8 @@ struct dynamic_converter<multicast_cfg_t> {
             source.as_object().at("interval", 5u).as_uint()
         );
 
+        result.legacy = source.as_object().at("legacy", true).as_bool();
+
         return result;
     }
 };
@@ -92,13 +103,260 @@ struct dynamic_converter<multicast_cfg_t> {
 
 struct
 multicast_t::announce_t {
-    // Maps node UUID to a list of node endpoints.
+    // Maps node UUID to a list of node endpoints. Legacy announce format.
     typedef std::tuple<std::string, std::vector<tcp::endpoint>> tuple_type;
 
     std::array<char, 65536> buffer;
     udp::endpoint endpoint;
 };
 
+struct multicast_t::metrics_t {
+    // Announces received from remote nodes and those of them which were ignored because nothing
+    // has changed since the previous announce from the same node.
+    metrics::shared_metric<std::atomic<std::int64_t>> received;
+    metrics::shared_metric<std::atomic<std::int64_t>> ignored;
+};
+
+namespace {
+
+// Compact announce format, all integers are in network byte order:
+//
+//   magic (1) | version (1) | flags (1) | uuid | generation (8) | count (1) | endpoints...
+//
+// The uuid is either 16 raw bytes, if the flag is set, or a length-prefixed string (1 + N). Each
+// endpoint is an address family (1, either 4 or 6), an address (4 or 16) and a port (2). Legacy
+// announces are msgpack arrays, so they never start with the magic byte.
+
+const std::uint8_t kMagic   = 0xCA;
+const std::uint8_t kVersion = 1;
+
+const std::uint8_t kBinaryUUID = 1;
+
+class announce_writer_t {
+    std::string m_buffer;
+
+public:
+    void
+    put(std::uint8_t value) {
+        m_buffer.push_back(static_cast<char>(value));
+    }
+
+    template<class T>
+    void
+    put_be(T value) {
+        for(size_t i = sizeof(T); i != 0; --i) {
+            put(static_cast<std::uint8_t>(value >> ((i - 1) * 8)));
+        }
+    }
+
+    template<class Range>
+    void
+    put_bytes(const Range& range) {
+        m_buffer.append(reinterpret_cast<const char*>(range.data()), range.size());
+    }
+
+    const std::string&
+    buffer() const {
+        return m_buffer;
+    }
+};
+
+class announce_reader_t {
+    const std::uint8_t* m_data;
+    size_t m_size;
+
+public:
+    announce_reader_t(const char* data, size_t size):
+        m_data(reinterpret_cast<const std::uint8_t*>(data)),
+        m_size(size)
+    { }
+
+    bool
+    get(std::uint8_t& value) {
+        if(m_size < 1) {
+            return false;
+        }
+
+        value = *m_data;
+        m_data += 1;
+        m_size -= 1;
+
+        return true;
+    }
+
+    template<class T>
+    bool
+    get_be(T& value) {
+        if(m_size < sizeof(T)) {
+            return false;
+        }
+
+        value = 0;
+
+        for(size_t i = 0; i < sizeof(T); ++i) {
+            value = static_cast<T>((value << 8) | m_data[i]);
+        }
+
+        m_data += sizeof(T);
+        m_size -= sizeof(T);
+
+        return true;
+    }
+
+    bool
+    get_bytes(void* target, size_t size) {
+        if(m_size < size) {
+            return false;
+        }
+
+        std::memcpy(target, m_data, size);
+        m_data += size;
+        m_size -= size;
+
+        return true;
+    }
+};
+
+std::string
+encode_announce(const std::string& uuid, std::uint64_t generation, const std::vector<tcp::endpoint>& endpoints) {
+    announce_writer_t writer;
+
+    writer.put(kMagic);
+    writer.put(kVersion);
+
+    // Node uuids are usually generated, but can be set to an arbitrary string in the config.
+    boost::optional<unique_id_t> id;
+
+    try {
+        id = unique_id_t(uuid);
+    } catch(const std::system_error&) {
+        // Not an uuid at all.
+    }
+
+    if(id && id->string() == uuid) {
+        writer.put(kBinaryUUID);
+        writer.put_bytes(std::string(reinterpret_cast<const char*>(id->uuid.data()), 16));
+    } else {
+        writer.put(0);
+        writer.put(static_cast<std::uint8_t>(std::min<size_t>(uuid.size(), 255)));
+        writer.put_bytes(uuid.substr(0, 255));
+    }
+
+    writer.put_be(generation);
+    writer.put(static_cast<std::uint8_t>(std::min<size_t>(endpoints.size(), 255)));
+
+    for(size_t i = 0; i < std::min<size_t>(endpoints.size(), 255); ++i) {
+        const auto& address = endpoints[i].address();
+
+        if(address.is_v4()) {
+            writer.put(4);
+            writer.put_bytes(address.to_v4().to_bytes());
+        } else {
+            writer.put(6);
+            writer.put_bytes(address.to_v6().to_bytes());
+        }
+
+        writer.put_be(endpoints[i].port());
+    }
+
+    return writer.buffer();
+}
+
+// Decodes the announce header, i.e. everything but the endpoints, so that repeated announces
+// could be dropped early.
+bool
+decode_header(announce_reader_t& reader, std::string& uuid, std::uint64_t& generation) {
+    std::uint8_t magic, version, flags;
+
+    if(!reader.get(magic) || !reader.get(version) || !reader.get(flags)) {
+        return false;
+    }
+
+    if(magic != kMagic || version != kVersion) {
+        return false;
+    }
+
+    if(flags & kBinaryUUID) {
+        unique_id_t id;
+
+        if(!reader.get_bytes(id.uuid.data(), 16)) {
+            return false;
+        }
+
+        uuid = id.string();
+    } else {
+        std::uint8_t size;
+
+        if(!reader.get(size)) {
+            return false;
+        }
+
+        uuid.resize(size);
+
+        if(!reader.get_bytes(&uuid[0], size)) {
+            return false;
+        }
+    }
+
+    return reader.get_be(generation);
+}
+
+// Peers which haven't announced themselves for this long are considered gone.
+std::chrono::milliseconds
+expiration_timeout(const multicast_cfg_t& cfg) {
+    return std::chrono::milliseconds((cfg.interval * 3).total_milliseconds());
+}
+
+bool
+decode_endpoints(announce_reader_t& reader, std::vector<tcp::endpoint>& endpoints) {
+    std::uint8_t count;
+
+    if(!reader.get(count)) {
+        return false;
+    }
+
+    for(std::uint8_t i = 0; i < count; ++i) {
+        std::uint8_t family;
+        std::uint16_t port;
+
+        if(!reader.get(family)) {
+            return false;
+        }
+
+        address target;
+
+        if(family == 4) {
+            address_v4::bytes_type bytes;
+
+            if(!reader.get_bytes(bytes.data(), bytes.size())) {
+                return false;
+            }
+
+            target = address_v4(bytes);
+        } else if(family == 6) {
+            address_v6::bytes_type bytes;
+
+            if(!reader.get_bytes(bytes.data(), bytes.size())) {
+                return false;
+            }
+
+            target = address_v6(bytes);
+        } else {
+            return false;
+        }
+
+        if(!reader.get_be(port)) {
+            return false;
+        }
+
+        endpoints.emplace_back(target, port);
+    }
+
+    return true;
+}
+
+} // namespace
+
 multicast_t::multicast_t(context_t& context, interface& locator, mode_t mode, const std::string& name, const dynamic_t& args):
     category_type(context, locator, mode, name, args),
     m_context(context),
@@ -106,8 +364,25 @@ multicast_t::multicast_t(context_t& context, interface& locator, mode_t mode, co
     m_locator(locator),
     m_cfg(args.to<multicast_cfg_t>()),
     m_socket(locator.asio()),
-    m_timer(locator.asio())
+    m_timer(locator.asio()),
+    m_expirations(
+        std::max(std::chrono::milliseconds(m_cfg.interval.total_milliseconds() / 4), std::chrono::milliseconds(100)),
+        64
+    ),
+    m_expiration_timer(locator.asio()),
+    m_metrics(new metrics_t{
+        context.metrics_hub().counter<std::int64_t>(cocaine::format("{}.announces.received", name)),
+        context.metrics_hub().counter<std::int64_t>(cocaine::format("{}.announces.ignored", name))
+    })
 {
+    // Random initial generation, so that receivers could tell a restarted node from the old one
+    // even if it has the same uuid. Zero is reserved for legacy announces.
+    std::random_device device;
+
+    do {
+        m_generation = (static_cast<std::uint64_t>(device()) << 32) | device();
+    } while(m_generation == 0);
+
     m_socket.open(m_cfg.endpoint.protocol());
     m_socket.set_option(socket_base::reuse_address(true));
 
@@ -137,6 +412,8 @@ multicast_t::multicast_t(context_t& context, interface& locator, mode_t mode, co
     m_socket.set_option(multicast::join_group(m_cfg.endpoint.address()));
 
     if(mode == mode_t::full) {
+        on_expiration_tick(std::error_code());
+
         const auto announce = std::make_shared<announce_t>();
 
         m_socket.async_receive_from(buffer(announce->buffer.data(), announce->buffer.size()),
@@ -155,11 +432,7 @@ multicast_t::~multicast_t() {
     m_timer.cancel();
     m_socket.close();
 
-    for(auto it = m_expirations.begin(); it != m_expirations.end(); ++it) {
-        it->second->cancel();
-    }
-
-    m_expirations.clear();
+    m_expiration_timer.cancel();
 }
 
 void
@@ -180,16 +453,29 @@ multicast_t::on_publish(const std::error_code& ec) {
             {"uuid", m_locator.uuid()}
         }));
 
-        msgpack::sbuffer target;
-        msgpack::packer<msgpack::sbuffer> packer(target);
+        if(quote->endpoints != m_endpoints) {
+            m_endpoints = quote->endpoints;
 
-        type_traits<announce_t::tuple_type>::pack(packer, std::forward_as_tuple(
-            m_locator.uuid(),
-            std::move(quote->endpoints)
-        ));
+            // Let the receivers know they should relink, skipping zero.
+            if(++m_generation == 0) m_generation++;
+        }
+
+        const auto target = encode_announce(m_locator.uuid(), m_generation, m_endpoints);
 
         try {
             m_socket.send_to(buffer(target.data(), target.size()), m_cfg.endpoint);
+
+            if(m_cfg.legacy) {
+                msgpack::sbuffer legacy;
+                msgpack::packer<msgpack::sbuffer> packer(legacy);
+
+                type_traits<announce_t::tuple_type>::pack(packer, std::forward_as_tuple(
+                    m_locator.uuid(),
+                    m_endpoints
+                ));
+
+                m_socket.send_to(buffer(legacy.data(), legacy.size()), m_cfg.endpoint);
+            }
         } catch(const std::system_error& e) {
             COCAINE_LOG_ERROR(m_log, "unable to announce local endpoints: {}", error::to_string(e));
         }
@@ -214,41 +500,47 @@ multicast_t::on_receive(const std::error_code& ec, size_t bytes_received,
         return;
     }
 
-    msgpack::unpacked unpacked;
-
-    try {
-        msgpack::unpack(&unpacked, ptr->buffer.data(), bytes_received);
-    } catch(const msgpack::unpack_error& e) {
-        COCAINE_LOG_ERROR(m_log, "unable to unpack announce: {}", e.what());
-        return;
-    }
+    ++(*m_metrics->received.get());
 
     std::string uuid;
+    std::uint64_t generation = 0;
     std::vector<tcp::endpoint> endpoints;
 
-    try {
-        type_traits<announce_t::tuple_type>::unpack(unpacked.get(), std::tie(uuid, endpoints));
-    } catch(const msgpack::type_error& e) {
-        COCAINE_LOG_ERROR(m_log, "unable to decode announce: {}", e.what());
-        return;
-    }
-
-    if(uuid != m_locator.uuid()) {
-        COCAINE_LOG_DEBUG(m_log, "received {:d} endpoint(s) from {}", endpoints.size(), ptr->endpoint, attribute_list({
-            {"uuid", uuid}
-        }));
-
-        auto& expiration = m_expirations[uuid];
-
-        if(!expiration) {
-            expiration = std::make_unique<deadline_timer>(m_locator.asio());
+    announce_reader_t reader(ptr->buffer.data(), bytes_received);
+
+    if(bytes_received != 0 && static_cast<std::uint8_t>(ptr->buffer[0]) == kMagic) {
+        if(!decode_header(reader, uuid, generation)) {
+            COCAINE_LOG_ERROR(m_log, "unable to decode announce header from {}", ptr->endpoint);
+        } else if(uuid == m_locator.uuid()) {
+            // Our own announce.
+        } else if(is_known(uuid, generation)) {
+            // Nothing has changed, so there's no need to even decode the endpoints.
+            ++(*m_metrics->ignored.get());
+        } else if(!decode_endpoints(reader, endpoints)) {
+            COCAINE_LOG_ERROR(m_log, "unable to decode announce endpoints from {}", ptr->endpoint);
+        } else {
+            on_announce(uuid, generation, endpoints);
         }
+    } else {
+        msgpack::unpacked unpacked;
 
-        // Link node always on announce - delegate decision of establishing connection to locator
-        m_locator.link_node(uuid, endpoints);
-
-        expiration->expires_from_now(m_cfg.interval * 3);
-        expiration->async_wait(std::bind(&multicast_t::on_expired, this, ph::_1, uuid));
+        try {
+            msgpack::unpack(&unpacked, ptr->buffer.data(), bytes_received);
+            type_traits<announce_t::tuple_type>::unpack(unpacked.get(), std::tie(uuid, endpoints));
+
+            if(uuid == m_locator.uuid()) {
+                // Our own announce.
+            } else if(is_legacy_duplicate(uuid, endpoints)) {
+                // Either a copy of the compact announce, or a legacy node with the same endpoints.
+                ++(*m_metrics->ignored.get());
+            } else {
+                on_announce(uuid, 0, endpoints);
+            }
+        } catch(const msgpack::unpack_error& e) {
+            COCAINE_LOG_ERROR(m_log, "unable to unpack announce: {}", e.what());
+        } catch(const msgpack::type_error& e) {
+            COCAINE_LOG_ERROR(m_log, "unable to decode announce: {}", e.what());
+        }
     }
 
     const auto announce = std::make_shared<announce_t>();
@@ -259,16 +551,71 @@ multicast_t::on_receive(const std::error_code& ec, size_t bytes_received,
     );
 }
 
+bool
+multicast_t::is_known(const std::string& uuid, std::uint64_t generation) {
+    auto it = m_peers.find(uuid);
+
+    if(it == m_peers.end() || it->second.generation != generation) {
+        return false;
+    }
+
+    m_expirations.schedule(uuid, timing_wheel<std::string>::clock_type::now() + expiration_timeout(m_cfg));
+
+    // Linking known nodes is cheap for the locator, and it has to be done anyway, because the
+    // locator might have dropped the node, e.g. after failing to connect to it.
+    m_locator.link_node(uuid, it->second.endpoints);
+
+    return true;
+}
+
+bool
+multicast_t::is_legacy_duplicate(const std::string& uuid, const std::vector<tcp::endpoint>& endpoints) {
+    auto it = m_peers.find(uuid);
+
+    if(it == m_peers.end()) {
+        return false;
+    }
+
+    // Nodes sending both formats are tracked by the compact announces, which carry generations.
+    if(it->second.generation == 0 && it->second.endpoints != endpoints) {
+        return false;
+    }
+
+    return is_known(uuid, it->second.generation);
+}
+
 void
-multicast_t::on_expired(const std::error_code& ec, const std::string& uuid) {
+multicast_t::on_announce(const std::string& uuid, std::uint64_t generation,
+                         const std::vector<tcp::endpoint>& endpoints)
+{
+    COCAINE_LOG_DEBUG(m_log, "received {:d} endpoint(s), generation {:d}", endpoints.size(), generation, attribute_list({
+        {"uuid", uuid}
+    }));
+
+    m_peers[uuid] = peer_t{generation, endpoints};
+    m_expirations.schedule(uuid, timing_wheel<std::string>::clock_type::now() + expiration_timeout(m_cfg));
+
+    // Link node on every new generation - delegate decision of establishing connection to locator.
+    m_locator.link_node(uuid, endpoints);
+}
+
+void
+multicast_t::on_expiration_tick(const std::error_code& ec) {
     if(ec == asio::error::operation_aborted) {
         return;
     }
 
-    COCAINE_LOG_ERROR(m_log, "remote endpoints have expired", {
-        {"uuid", uuid}
+    m_expirations.advance(timing_wheel<std::string>::clock_type::now(), [this](const std::string& uuid) {
+        COCAINE_LOG_ERROR(m_log, "remote endpoints have expired", {
+            {"uuid", uuid}
+        });
+
+        m_locator.drop_node(uuid);
+        m_peers.erase(uuid);
     });
 
-    m_locator.drop_node(uuid);
-    m_expirations.erase(uuid);
+    const auto tick = std::chrono::duration_cast<std::chrono::milliseconds>(m_expirations.tick());
+
+    m_expiration_timer.expires_from_now(boost::posix_time::milliseconds(tick.count()));
+    m_expiration_timer.async_wait(std::bind(&multicast_t::on_expiration_tick, this, ph::_1));
 }
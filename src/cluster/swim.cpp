@@ -0,0 +1,793 @@
+/*
+    Copyright (c) 2011-2014 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2014 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cocaine/detail/cluster/swim.hpp"
+
+#include "cocaine/context.hpp"
+#include "cocaine/context/signal.hpp"
+#include "cocaine/context/quote.hpp"
+#include "cocaine/dynamic.hpp"
+#include "cocaine/logging.hpp"
+
+#include "cocaine/rpc/dispatch.hpp"
+
+#include "cocaine/traits/endpoint.hpp"
+#include "cocaine/traits/tuple.hpp"
+#include "cocaine/traits/vector.hpp"
+
+#include <asio/io_service.hpp>
+
+#include <blackhole/logger.hpp>
+
+#include <algorithm>
+#include <array>
+
+using namespace cocaine::io;
+using namespace cocaine::cluster;
+
+using namespace asio;
+using namespace asio::ip;
+
+using blackhole::attribute_list;
+
+namespace cocaine {
+
+namespace ph = std::placeholders;
+
+template<>
+struct dynamic_converter<swim_cfg_t> {
+    typedef swim_cfg_t result_type;
+
+    static
+    result_type
+    convert(const dynamic_t& source) {
+        result_type result;
+
+        const auto& args = source.as_object();
+
+        result.endpoint = udp::endpoint(
+            address::from_string(args.at("address", "::").as_string()),
+            args.at("port", 10054u).as_uint()
+        );
+
+        if(args.count("advertise")) {
+            result.advertise = parse(args.at("advertise").as_string());
+        }
+
+        auto& membership = result.membership;
+
+        membership.interval   = std::chrono::milliseconds(args.at("interval", 1000u).as_uint());
+        membership.timeout    = std::chrono::milliseconds(args.at("timeout", 300u).as_uint());
+        membership.indirect   = args.at("indirect", 3u).as_uint();
+        membership.suspicion  = args.at("suspicion", 3u).as_uint();
+        membership.retransmit = args.at("retransmit", 3u).as_uint();
+        membership.piggyback  = args.at("piggyback", 8u).as_uint();
+        membership.sync       = args.at("sync", 30u).as_uint();
+
+        if(membership.timeout >= membership.interval) {
+            throw cocaine::error_t("probe timeout must be less than the protocol period");
+        }
+
+        const auto seeds = args.at("seeds", dynamic_t::empty_array).as_array();
+
+        for(auto it = seeds.begin(); it != seeds.end(); ++it) {
+            membership.seeds.push_back(parse(it->as_string()));
+        }
+
+        return result;
+    }
+
+private:
+    // Resolves "host:port" strings.
+    static
+    udp::endpoint
+    parse(const std::string& addr) {
+        io_service service;
+        udp::resolver resolver(service);
+
+        try {
+            return *resolver.resolve(udp::resolver::query(
+                addr.substr(0, addr.rfind(":")), addr.substr(addr.rfind(":") + 1)
+            ));
+        } catch(const std::system_error& e) {
+            throw std::system_error(e.code(), cocaine::format("unable to resolve gossip endpoint '{}'", addr));
+        }
+    }
+};
+
+} // namespace cocaine
+
+namespace cocaine { namespace cluster { namespace swim {
+
+namespace {
+
+typedef std::tuple<
+    std::string,
+    udp::endpoint,
+    std::vector<tcp::endpoint>,
+    std::uint64_t,
+    std::uint8_t
+> update_tuple_t;
+
+typedef std::tuple<
+    std::uint8_t,
+    std::uint64_t,
+    udp::endpoint,
+    std::vector<update_tuple_t>
+> message_tuple_t;
+
+// Headroom for the header of the updates array, which grows with the number of updates.
+const size_t kArrayHeadroom = 4;
+
+update_tuple_t
+to_tuple(const update_t& update) {
+    return update_tuple_t(update.uuid, update.gossip, update.endpoints, update.incarnation,
+        static_cast<std::uint8_t>(update.state));
+}
+
+} // namespace
+
+std::string
+encode(const message_t& message) {
+    std::vector<update_tuple_t> updates;
+
+    for(auto it = message.updates.begin(); it != message.updates.end(); ++it) {
+        updates.push_back(to_tuple(*it));
+    }
+
+    msgpack::sbuffer buffer;
+    msgpack::packer<msgpack::sbuffer> packer(buffer);
+
+    type_traits<message_tuple_t>::pack(packer, message_tuple_t(
+        static_cast<std::uint8_t>(message.type),
+        message.seq,
+        message.target,
+        std::move(updates)
+    ));
+
+    return std::string(buffer.data(), buffer.size());
+}
+
+size_t
+encoded_size(const update_t& update) {
+    msgpack::sbuffer buffer;
+    msgpack::packer<msgpack::sbuffer> packer(buffer);
+
+    type_traits<update_tuple_t>::pack(packer, to_tuple(update));
+
+    return buffer.size();
+}
+
+bool
+decode(const char* data, size_t size, message_t& message) {
+    message_tuple_t tuple;
+
+    try {
+        msgpack::unpacked unpacked;
+        msgpack::unpack(&unpacked, data, size);
+
+        type_traits<message_tuple_t>::unpack(unpacked.get(), tuple);
+    } catch(const msgpack::unpack_error&) {
+        return false;
+    } catch(const msgpack::type_error&) {
+        return false;
+    } catch(const std::system_error&) {
+        // Malformed addresses.
+        return false;
+    }
+
+    if(std::get<0>(tuple) > static_cast<std::uint8_t>(message_t::types::sync)) {
+        return false;
+    }
+
+    message.type   = static_cast<message_t::types>(std::get<0>(tuple));
+    message.seq    = std::get<1>(tuple);
+    message.target = std::get<2>(tuple);
+
+    message.updates.clear();
+
+    for(auto it = std::get<3>(tuple).begin(); it != std::get<3>(tuple).end(); ++it) {
+        if(std::get<4>(*it) > static_cast<std::uint8_t>(states::dead)) {
+            return false;
+        }
+
+        message.updates.push_back(update_t{
+            std::move(std::get<0>(*it)),
+            std::get<1>(*it),
+            std::move(std::get<2>(*it)),
+            std::get<3>(*it),
+            static_cast<states>(std::get<4>(*it))
+        });
+    }
+
+    return true;
+}
+
+membership_t::membership_t(membership_cfg_t cfg, update_t self, handlers_t handlers, time_point now):
+    m_cfg(std::move(cfg)),
+    m_handlers(std::move(handlers)),
+    m_self(std::move(self)),
+    m_position(0),
+    m_probe(probe_t{false, false, false, std::string(), 0, now}),
+    m_seq(0),
+    m_rounds(0),
+    m_next_round(now),
+    m_random(std::random_device()())
+{
+    m_self.state = states::alive;
+
+    // Announce ourselves to the cluster.
+    enqueue(m_self);
+}
+
+void
+membership_t::tick(time_point now) {
+    // Escalate to an indirect probe if the target hasn't responded in time.
+    if(m_probe.active && !m_probe.acked && !m_probe.indirect && now >= m_probe.started + m_cfg.timeout) {
+        m_probe.indirect = true;
+
+        const auto target = m_members.find(m_probe.target);
+
+        if(target != m_members.end()) {
+            std::vector<const member_t*> candidates;
+
+            for(auto it = m_members.begin(); it != m_members.end(); ++it) {
+                if(it->second.info.state == states::alive && it->first != m_probe.target) {
+                    candidates.push_back(&it->second);
+                }
+            }
+
+            std::shuffle(candidates.begin(), candidates.end(), m_random);
+
+            for(size_t i = 0; i < std::min(m_cfg.indirect, candidates.size()); ++i) {
+                send(candidates[i]->info.gossip, message_t::types::ping_req, m_probe.seq, target->second.info.gossip);
+            }
+        }
+    }
+
+    if(now >= m_next_round) {
+        if(m_probe.active && !m_probe.acked) {
+            suspect(m_probe.target, now);
+        }
+
+        m_probe.active = false;
+        m_next_round = now + m_cfg.interval;
+
+        if(alive() == 0) {
+            join();
+        } else if(m_cfg.sync != 0 && ++m_rounds % m_cfg.sync == 0) {
+            push_pull();
+        }
+
+        probe(now);
+    }
+
+    for(auto it = m_members.begin(); it != m_members.end(); /***/) {
+        auto& info = it->second.info;
+
+        if(info.state == states::suspect && now >= it->second.deadline) {
+            // The suspicion hasn't been refuted in time.
+            info.state = states::dead;
+            it->second.deadline = now + m_cfg.interval * m_cfg.suspicion * scale() * 2;
+
+            enqueue(info);
+            m_handlers.dead(it->first);
+        } else if(info.state == states::dead && now >= it->second.deadline) {
+            // Forget the dead node. Its tombstone has been kept long enough to outlive any stale
+            // gossip about it.
+            m_gossip.erase(it->first);
+            it = m_members.erase(it);
+            continue;
+        }
+
+        ++it;
+    }
+
+    for(auto it = m_relays.begin(); it != m_relays.end(); /***/) {
+        if(now >= it->second.deadline) {
+            it = m_relays.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void
+membership_t::receive(const udp::endpoint& from, const message_t& message, time_point now) {
+    const bool snapshot = message.type == message_t::types::join || message.type == message_t::types::sync;
+
+    for(auto it = message.updates.begin(); it != message.updates.end(); ++it) {
+        if(snapshot) {
+            merge(*it, now);
+        } else {
+            apply(*it, now);
+        }
+    }
+
+    switch(message.type) {
+    case message_t::types::ping:
+        send(from, message_t::types::ack, message.seq);
+        break;
+
+    case message_t::types::ack:
+        if(m_probe.active && m_probe.seq == message.seq) {
+            m_probe.acked = true;
+        } else {
+            auto relay = m_relays.find(message.seq);
+
+            if(relay != m_relays.end()) {
+                send(relay->second.origin, message_t::types::ack, relay->second.seq);
+                m_relays.erase(relay);
+            }
+        }
+        break;
+
+    case message_t::types::ping_req: {
+        const auto seq = ++m_seq;
+
+        m_relays[seq] = relay_t{from, message.seq, now + m_cfg.interval};
+        send(message.target, message_t::types::ping, seq);
+        break;
+    }
+
+    case message_t::types::join:
+        send_snapshot(from, message_t::types::sync, message.seq);
+        break;
+
+    case message_t::types::sync:
+        // Already applied.
+        break;
+    }
+}
+
+std::vector<std::string>
+membership_t::members() const {
+    std::vector<std::string> result;
+
+    for(auto it = m_members.begin(); it != m_members.end(); ++it) {
+        if(it->second.info.state != states::dead) {
+            result.push_back(it->first);
+        }
+    }
+
+    return result;
+}
+
+void
+membership_t::probe(time_point now) {
+    // Pick the next member in the current pass, starting a new shuffled pass if needed.
+    for(size_t attempt = 0; attempt < 2; ++attempt) {
+        while(m_position < m_order.size()) {
+            const auto it = m_members.find(m_order[m_position++]);
+
+            if(it == m_members.end() || it->second.info.state == states::dead) {
+                continue;
+            }
+
+            m_probe = probe_t{true, false, false, it->first, ++m_seq, now};
+            send(it->second.info.gossip, message_t::types::ping, m_probe.seq);
+            return;
+        }
+
+        m_order.clear();
+        m_position = 0;
+
+        for(auto it = m_members.begin(); it != m_members.end(); ++it) {
+            if(it->second.info.state != states::dead) {
+                m_order.push_back(it->first);
+            }
+        }
+
+        std::shuffle(m_order.begin(), m_order.end(), m_random);
+    }
+}
+
+void
+membership_t::join() {
+    for(auto it = m_cfg.seeds.begin(); it != m_cfg.seeds.end(); ++it) {
+        if(*it == m_self.gossip) {
+            continue;
+        }
+
+        // Explicitly introduce ourselves, in case the initial announce has already been sent out.
+        send_snapshot(*it, message_t::types::join, ++m_seq);
+    }
+}
+
+void
+membership_t::push_pull() {
+    std::vector<const member_t*> candidates;
+
+    for(auto it = m_members.begin(); it != m_members.end(); ++it) {
+        if(it->second.info.state != states::dead) {
+            candidates.push_back(&it->second);
+        }
+    }
+
+    if(candidates.empty()) {
+        return;
+    }
+
+    const auto target = std::uniform_int_distribution<size_t>(0, candidates.size() - 1)(m_random);
+
+    send_snapshot(candidates[target]->info.gossip, message_t::types::join, ++m_seq);
+}
+
+void
+membership_t::apply(const update_t& update, time_point now) {
+    if(update.uuid == m_self.uuid) {
+        if(update.state != states::alive && update.incarnation >= m_self.incarnation) {
+            // Refute the suspicion.
+            m_self.incarnation = update.incarnation + 1;
+            enqueue(m_self);
+        }
+
+        return;
+    }
+
+    auto it = m_members.find(update.uuid);
+
+    if(it == m_members.end()) {
+        if(update.state == states::dead) {
+            // Nothing to do about nodes we've never known.
+            return;
+        }
+
+        const auto deadline = update.state == states::suspect ?
+            now + m_cfg.interval * m_cfg.suspicion * scale() :
+            time_point::max();
+
+        m_members.insert({update.uuid, member_t{update, deadline}});
+
+        enqueue(update);
+        m_handlers.alive(update.uuid, update.endpoints);
+
+        return;
+    }
+
+    auto& member = it->second;
+    bool accept = false;
+
+    switch(update.state) {
+    case states::alive:
+        accept = update.incarnation > member.info.incarnation;
+        break;
+
+    case states::suspect:
+        accept = update.incarnation > member.info.incarnation ||
+            (update.incarnation == member.info.incarnation && member.info.state == states::alive);
+        break;
+
+    case states::dead:
+        accept = update.incarnation >= member.info.incarnation && member.info.state != states::dead;
+        break;
+    }
+
+    if(!accept) {
+        return;
+    }
+
+    const auto previous = member.info;
+
+    member.info = update;
+
+    switch(update.state) {
+    case states::alive:
+        member.deadline = time_point::max();
+        break;
+
+    case states::suspect:
+        member.deadline = now + m_cfg.interval * m_cfg.suspicion * scale();
+        break;
+
+    case states::dead:
+        member.deadline = now + m_cfg.interval * m_cfg.suspicion * scale() * 2;
+        break;
+    }
+
+    enqueue(update);
+
+    if(update.state == states::dead) {
+        m_handlers.dead(update.uuid);
+    } else if(previous.state == states::dead || previous.endpoints != update.endpoints) {
+        m_handlers.alive(update.uuid, update.endpoints);
+    }
+}
+
+void
+membership_t::merge(const update_t& update, time_point now) {
+    if(update.state != states::dead || update.uuid == m_self.uuid) {
+        apply(update, now);
+        return;
+    }
+
+    // Tombstones from other nodes might be stale, e.g. if they've been partitioned from the rest of
+    // the cluster, so they only make known nodes suspects, giving them a chance to refute.
+    if(m_members.count(update.uuid)) {
+        auto suspect = update;
+
+        suspect.state = states::suspect;
+        apply(suspect, now);
+    }
+}
+
+void
+membership_t::suspect(const std::string& uuid, time_point now) {
+    auto it = m_members.find(uuid);
+
+    if(it == m_members.end() || it->second.info.state != states::alive) {
+        return;
+    }
+
+    it->second.info.state = states::suspect;
+    it->second.deadline = now + m_cfg.interval * m_cfg.suspicion * scale();
+
+    enqueue(it->second.info);
+}
+
+void
+membership_t::enqueue(const update_t& update) {
+    m_gossip[update.uuid] = std::make_pair(update, 0u);
+}
+
+void
+membership_t::send(const udp::endpoint& target, message_t::types type, std::uint64_t seq,
+                   const udp::endpoint& subject)
+{
+    message_t message{type, seq, subject, std::vector<update_t>()};
+
+    // Piggyback the least disseminated updates.
+    std::vector<std::map<std::string, std::pair<update_t, unsigned int>>::iterator> pending;
+
+    for(auto it = m_gossip.begin(); it != m_gossip.end(); ++it) {
+        pending.push_back(it);
+    }
+
+    const auto count = std::min(m_cfg.piggyback, pending.size());
+
+    std::partial_sort(pending.begin(), pending.begin() + count, pending.end(),
+        [](const decltype(pending)::value_type& lhs, const decltype(pending)::value_type& rhs)
+    {
+        return lhs->second.second < rhs->second.second;
+    });
+
+    const auto limit = m_cfg.retransmit * scale();
+
+    auto size = encode(message).size() + kArrayHeadroom;
+
+    for(size_t i = 0; i < count; ++i) {
+        const auto length = encoded_size(pending[i]->second.first);
+
+        // The rest is piggybacked on the following messages.
+        if(!message.updates.empty() && size + length > max_datagram_size) {
+            break;
+        }
+
+        size += length;
+        message.updates.push_back(pending[i]->second.first);
+
+        if(++pending[i]->second.second >= limit) {
+            m_gossip.erase(pending[i]);
+        }
+    }
+
+    m_handlers.send(target, message);
+}
+
+void
+membership_t::send_snapshot(const udp::endpoint& target, message_t::types type, std::uint64_t seq) {
+    std::vector<update_t> snapshot(1, m_self);
+
+    for(auto it = m_members.begin(); it != m_members.end(); ++it) {
+        snapshot.push_back(it->second.info);
+    }
+
+    // Snapshots are split into as many datagrams as needed, the first one has the requested type and
+    // the rest are syncs.
+    message_t message{type, seq, udp::endpoint(), std::vector<update_t>()};
+
+    const auto overhead = encode(message).size() + kArrayHeadroom;
+    auto size = overhead;
+
+    for(auto it = snapshot.begin(); it != snapshot.end(); ++it) {
+        const auto length = encoded_size(*it);
+
+        if(!message.updates.empty() && size + length > max_datagram_size) {
+            m_handlers.send(target, message);
+
+            message = message_t{message_t::types::sync, seq, udp::endpoint(), std::vector<update_t>()};
+            size = overhead;
+        }
+
+        size += length;
+        message.updates.push_back(*it);
+    }
+
+    m_handlers.send(target, message);
+}
+
+size_t
+membership_t::alive() const {
+    size_t result = 0;
+
+    for(auto it = m_members.begin(); it != m_members.end(); ++it) {
+        result += it->second.info.state != states::dead;
+    }
+
+    return result;
+}
+
+unsigned int
+membership_t::scale() const {
+    unsigned int result = 1;
+
+    // Ceiling of log2(N + 1), where N is the number of members including this node.
+    while((1ul << result) < m_members.size() + 2) {
+        result++;
+    }
+
+    return result;
+}
+
+}}} // namespace cocaine::cluster::swim
+
+struct
+swim_t::datagram_t {
+    std::array<char, 65536> buffer;
+    udp::endpoint endpoint;
+};
+
+swim_t::swim_t(context_t& context, interface& locator, mode_t mode, const std::string& name, const dynamic_t& args):
+    category_type(context, locator, mode, name, args),
+    m_context(context),
+    m_log(context.log(name)),
+    m_locator(locator),
+    m_mode(mode),
+    m_cfg(args.to<swim_cfg_t>()),
+    m_socket(locator.asio()),
+    m_timer(locator.asio())
+{
+    m_socket.open(m_cfg.endpoint.protocol());
+    m_socket.set_option(socket_base::reuse_address(true));
+    m_socket.bind(m_cfg.endpoint);
+
+    COCAINE_LOG_INFO(m_log, "listening for gossip on {} with {:d} seed(s)", m_socket.local_endpoint(),
+        m_cfg.membership.seeds.size(), attribute_list({{"uuid", m_locator.uuid()}}));
+
+    m_signals = std::make_shared<dispatch<context_tag>>(name);
+    m_signals->on<io::context::prepared>(std::bind(&swim_t::on_prepared, this));
+
+    context.signal_hub().listen(m_signals, m_locator.asio());
+}
+
+swim_t::~swim_t() {
+    m_timer.cancel();
+    m_socket.close();
+}
+
+void
+swim_t::on_prepared() {
+    const auto quote = m_context.locate("locator");
+
+    if(!quote || quote->endpoints.empty()) {
+        COCAINE_LOG_ERROR(m_log, "unable to join the cluster: locator is not available");
+        return;
+    }
+
+    swim::update_t self;
+
+    self.uuid      = m_locator.uuid();
+    self.endpoints = quote->endpoints;
+    self.state     = swim::states::alive;
+
+    // Nodes restarted with the same uuid must override their own tombstones.
+    self.incarnation = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    if(m_cfg.advertise != udp::endpoint()) {
+        self.gossip = m_cfg.advertise;
+    } else {
+        // The locator endpoints are reachable by other nodes, so is the gossip port on them.
+        self.gossip = udp::endpoint(quote->endpoints.front().address(), m_socket.local_endpoint().port());
+    }
+
+    swim::membership_t::handlers_t handlers;
+
+    handlers.send = [this](const udp::endpoint& target, const swim::message_t& message) {
+        const auto datagram = swim::encode(message);
+
+        std::error_code ec;
+        m_socket.send_to(buffer(datagram.data(), datagram.size()), target, 0, ec);
+
+        if(ec) {
+            COCAINE_LOG_ERROR(m_log, "unable to send gossip to {}: [{:d}] {}", target, ec.value(), ec.message());
+        }
+    };
+
+    handlers.alive = [this](const std::string& uuid, const std::vector<tcp::endpoint>& endpoints) {
+        COCAINE_LOG_INFO(m_log, "node has joined the cluster with {:d} endpoint(s)", endpoints.size(),
+            attribute_list({{"uuid", uuid}}));
+
+        if(m_mode == mode_t::full) {
+            m_locator.link_node(uuid, endpoints);
+        }
+    };
+
+    handlers.dead = [this](const std::string& uuid) {
+        COCAINE_LOG_ERROR(m_log, "node has left the cluster", attribute_list({{"uuid", uuid}}));
+
+        if(m_mode == mode_t::full) {
+            m_locator.drop_node(uuid);
+        }
+    };
+
+    m_membership = std::make_unique<swim::membership_t>(m_cfg.membership, std::move(self),
+        std::move(handlers), swim::membership_t::clock_type::now());
+
+    receive();
+    on_tick(std::error_code());
+}
+
+void
+swim_t::on_tick(const std::error_code& ec) {
+    if(ec == asio::error::operation_aborted) {
+        return;
+    }
+
+    m_membership->tick(swim::membership_t::clock_type::now());
+
+    // Ticks are frequent enough to notice both probe timeouts and protocol period ends in time.
+    const auto period = std::min(m_cfg.membership.timeout, m_cfg.membership.interval - m_cfg.membership.timeout);
+
+    m_timer.expires_from_now(boost::posix_time::milliseconds(std::max<std::int64_t>(10, period.count() / 2)));
+    m_timer.async_wait(std::bind(&swim_t::on_tick, this, ph::_1));
+}
+
+void
+swim_t::receive() {
+    const auto datagram = std::make_shared<datagram_t>();
+
+    m_socket.async_receive_from(buffer(datagram->buffer.data(), datagram->buffer.size()),
+        datagram->endpoint,
+        std::bind(&swim_t::on_receive, this, ph::_1, ph::_2, datagram)
+    );
+}
+
+void
+swim_t::on_receive(const std::error_code& ec, size_t bytes_received, const std::shared_ptr<datagram_t>& ptr) {
+    if(ec) {
+        if(ec != asio::error::operation_aborted) {
+            COCAINE_LOG_ERROR(m_log, "unexpected error in swim_t::on_receive(): [{:d}] {}",
+                ec.value(), ec.message());
+        }
+
+        return;
+    }
+
+    swim::message_t message;
+
+    if(swim::decode(ptr->buffer.data(), bytes_received, message)) {
+        m_membership->receive(ptr->endpoint, message, swim::membership_t::clock_type::now());
+    } else {
+        COCAINE_LOG_ERROR(m_log, "unable to decode gossip from {}", ptr->endpoint);
+    }
+
+    receive();
+}
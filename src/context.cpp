@@ -26,12 +26,14 @@
 #include "cocaine/context/mapper.hpp"
 #include "cocaine/context/quote.hpp"
 #include "cocaine/context/signal.hpp"
+#include "cocaine/detail/chamber.hpp"
 #include "cocaine/detail/essentials.hpp"
 #include "cocaine/engine.hpp"
 #include "cocaine/format.hpp"
 #include "cocaine/idl/context.hpp"
 #include "cocaine/logging.hpp"
 #include "cocaine/rpc/actor.hpp"
+#include "cocaine/rpc/dispatch.hpp"
 #include "cocaine/repository/service.hpp"
 #include "cocaine/trace/logger.hpp"
 #include "cocaine/format/vector.hpp"
@@ -45,28 +47,27 @@
 
 #include <metrics/registry.hpp>
 
-#include <deque>
+#include <list>
+#include <unordered_map>
+
+#include <signal.h>
 
 namespace cocaine {
 
-namespace {
+using blackhole::scope::holder_t;
 
-struct match {
-    template<class T>
-    bool
-    operator()(const T& service) const {
-        return name == service.first;
-    }
+class context_impl_t : public context_t {
+    typedef std::list<std::pair<std::string, std::unique_ptr<actor_t>>> service_list_t;
 
-    const std::string& name;
-};
+    struct service_registry_t {
+        // Services in the initialization order.
+        service_list_t list;
 
-}
+        // Services indexed by name.
+        std::unordered_map<std::string, service_list_t::iterator> index;
+    };
 
-using blackhole::scope::holder_t;
-
-class context_impl_t : public context_t {
-    typedef std::deque<std::pair<std::string, std::unique_ptr<actor_t>>> service_list_t;
+    typedef std::unordered_map<std::string, context::quote_t> service_snapshot_t;
 
     // TODO: There was an idea to use the Repository to enable pluggable sinks and whatever else for
     // for the Blackhole, when all the common stuff is extracted to a separate library.
@@ -79,13 +80,25 @@ class context_impl_t : public context_t {
     // A pool of execution units - threads responsible for doing all the service invocations.
     std::vector<std::unique_ptr<execution_unit_t>> m_pool;
 
-    // Services are stored as a vector of pairs to preserve the initialization order. Synchronized,
-    // because services are allowed to start and stop other services during their lifetime.
-    synchronized<service_list_t> m_services;
+    // Services are stored as a list of pairs to preserve the initialization order, indexed by name.
+    // Synchronized, because services are allowed to start and stop other services during their
+    // lifetime.
+    synchronized<service_registry_t> m_services;
+
+    // Immutable snapshot of the running services for lookups, so that resolving services doesn't
+    // contend with other lookups or service registration. Rebuilt with the registry lock held on
+    // every change and swapped atomically.
+    std::shared_ptr<const service_snapshot_t> m_snapshot;
 
     // Context signalling hub.
     retroactive_signal<io::context_tag> m_signals;
 
+    // A single SIGHUP listener shared by all the services to re-resolve their endpoints, running in
+    // its own thread, so that slow hostname resolution doesn't block any service.
+    std::shared_ptr<asio::io_service> m_refresher;
+    std::unique_ptr<io::chamber_t> m_refresher_chamber;
+    std::shared_ptr<dispatch<io::context_tag>> m_refresher_slot;
+
     // Metrics.
     metrics::registry_t m_metrics_registry;
 
@@ -100,6 +113,7 @@ public:
                    std::unique_ptr<api::repository_t> _repository) :
         m_log(new logging::trace_wrapper_t(std::move(_log))),
         m_repository(std::move(_repository)),
+        m_snapshot(std::make_shared<service_snapshot_t>()),
         m_config(std::move(_config)),
         m_mapper(*m_config)
     {
@@ -122,6 +136,19 @@ public:
             m_pool.emplace_back(std::make_unique<execution_unit_t>(*this));
         }
 
+        // Subscribe before any service is started, while the signal history is still empty, so that
+        // nothing is replayed.
+        m_refresher = std::make_shared<asio::io_service>();
+        m_refresher_chamber = std::make_unique<io::chamber_t>("core/refresher", m_refresher);
+        m_refresher_slot = std::make_shared<dispatch<io::context_tag>>("core/refresher");
+        m_refresher_slot->on<io::context::os_signal>([this](int signum, siginfo_t) {
+            if(signum == SIGHUP) {
+                refresh();
+            }
+        });
+
+        m_signals.listen(m_refresher_slot, *m_refresher);
+
         COCAINE_LOG_INFO(m_log, "starting {:d} service(s)", m_config->services().size());
 
         std::vector<std::string> errored;
@@ -233,9 +260,8 @@ public:
     insert_with(const std::string& name, std::function<std::unique_ptr<actor_t>()> fn) {
         const holder_t scoped(*m_log, {{"source", "core"}});
 
-        auto actor = m_services.apply([&](service_list_t& list) {
-            auto it = std::find_if(list.begin(), list.end(), match{name});
-            if(it != list.end()) {
+        m_services.apply([&](service_registry_t& registry) {
+            if(registry.index.count(name)) {
                 throw cocaine::error_t("service '{}' already exists", name);
             }
 
@@ -248,17 +274,98 @@ public:
                 {"service", name}
             });
 
-            list.emplace_back(name, std::move(service));
+            registry.index[name] = registry.list.emplace(registry.list.end(), name, std::move(service));
+
+            context::quote_t quote{actor->endpoints(), actor->prototype()};
+
+            auto snapshot = std::make_shared<service_snapshot_t>(*std::atomic_load(&m_snapshot));
+            snapshot->insert({name, quote});
+            std::atomic_store(&m_snapshot, std::shared_ptr<const service_snapshot_t>(std::move(snapshot)));
 
-            return actor;
+            // Fire off the signal to alert concerned subscribers about the service exposure event.
+            // Signalled with the lock held, so that it can't be overtaken by an endpoint update.
+            m_signals.invoke<io::context::service::exposed>(quote.prototype->name(), std::forward_as_tuple(
+                quote.endpoints,
+                quote.prototype->version(),
+                quote.prototype->root()
+            ));
         });
+    }
 
-        // Fire off the signal to alert concerned subscribers about the service removal event.
-        m_signals.invoke<io::context::service::exposed>(actor->prototype()->name(), std::forward_as_tuple(
-            actor->endpoints(),
-            actor->prototype()->version(),
-            actor->prototype()->root()
-        ));
+    // Re-resolves endpoints of all the running services, republishing quotes of those which have
+    // changed.
+    void
+    refresh() {
+        const holder_t scoped(*m_log, {{"source", "core"}});
+
+        // Resolving might take a while, so it's done without the registry lock, based on the bound
+        // endpoints of the services.
+        std::vector<std::pair<std::string, asio::ip::tcp::endpoint>> bound;
+
+        m_services.apply([&](service_registry_t& registry) {
+            for(const auto& entry: registry.list) {
+                bound.emplace_back(entry.first, entry.second->bound());
+            }
+        });
+
+        std::vector<std::vector<asio::ip::tcp::endpoint>> resolved(bound.size());
+
+        for(size_t i = 0; i < bound.size(); ++i) try {
+            if(bound[i].second.port() == 0) {
+                // Not running.
+                continue;
+            }
+
+            resolved[i] = actor_t::resolve(*m_refresher, m_config->network().hostname(), bound[i].second);
+        } catch(const std::system_error& e) {
+            COCAINE_LOG_ERROR(m_log, "unable to resolve local endpoints: {}", error::to_string(e), blackhole::attribute_list({
+                {"service", bound[i].first}
+            }));
+        }
+
+        std::vector<std::pair<std::string, context::quote_t>> changed;
+
+        m_services.apply([&](service_registry_t& registry) {
+            for(size_t i = 0; i < bound.size(); ++i) {
+                const auto it = registry.index.find(bound[i].first);
+
+                // Services removed or restarted in the meantime have their endpoints resolved anew.
+                if(it == registry.index.end() || it->second->second->bound() != bound[i].second) {
+                    continue;
+                }
+
+                const auto& actor = it->second->second;
+
+                if(!resolved[i].empty() && actor->update(std::move(resolved[i]))) {
+                    changed.emplace_back(bound[i].first, context::quote_t{actor->endpoints(), actor->prototype()});
+                }
+            }
+
+            if(changed.empty()) {
+                return;
+            }
+
+            auto snapshot = std::make_shared<service_snapshot_t>(*std::atomic_load(&m_snapshot));
+            for(const auto& entry: changed) {
+                snapshot->erase(entry.first);
+                snapshot->insert(entry);
+            }
+            std::atomic_store(&m_snapshot, std::shared_ptr<const service_snapshot_t>(std::move(snapshot)));
+
+            // Subscribers replace whatever they know about these services. Signalled with the lock
+            // held, so that a concurrent removal can't be signalled before the update.
+            for(const auto& entry: changed) {
+                const auto& quote = entry.second;
+
+                m_signals.invoke<io::context::service::updated>(quote.prototype->name(), std::forward_as_tuple(
+                    quote.endpoints,
+                    quote.prototype->version(),
+                    quote.prototype->root()
+                ));
+            }
+        });
+
+        COCAINE_LOG_INFO(m_log, "refreshed endpoints of {:d} service(s)", changed.size());
     }
 
     std::unique_ptr<actor_t>
@@ -267,14 +374,19 @@ public:
 
         std::unique_ptr<actor_t> service;
 
-        m_services.apply([&](service_list_t& list) {
-            auto it = std::find_if(list.begin(), list.end(), match{name});
-            if(it != list.end()) {
-                service = std::move(it->second);
-                list.erase(it);
+        m_services.apply([&](service_registry_t& registry) {
+            auto it = registry.index.find(name);
+            if(it != registry.index.end()) {
+                service = std::move(it->second->second);
+                registry.list.erase(it->second);
+                registry.index.erase(it);
             } else {
                 throw cocaine::error_t("service '{}' doesn't exist", name);
             }
+
+            auto snapshot = std::make_shared<service_snapshot_t>(*std::atomic_load(&m_snapshot));
+            snapshot->erase(name);
+            std::atomic_store(&m_snapshot, std::shared_ptr<const service_snapshot_t>(std::move(snapshot)));
         });
 
         service->terminate();
@@ -298,27 +410,23 @@ public:
 
     boost::optional<context::quote_t>
     locate(const std::string& name) const {
-        return m_services.apply([&](const service_list_t& list) -> boost::optional<context::quote_t> {
-            auto it = std::find_if(list.begin(), list.end(), match{name});
-            if (it == list.end() || !it->second->is_active()) {
-                return boost::none;
-            }
+        const auto snapshot = std::atomic_load(&m_snapshot);
 
-            return boost::make_optional(context::quote_t{it->second->endpoints(), it->second->prototype()});
-        });
+        // NOTE: Only running services are in the snapshot, because they are started before being
+        // inserted and are removed before being terminated.
+        auto it = snapshot->find(name);
+        if (it == snapshot->end()) {
+            return boost::none;
+        }
+
+        return boost::make_optional(it->second);
     }
 
     std::map<std::string, context::quote_t>
     snapshot() const {
-        return m_services.apply([&](const service_list_t& list) {
-            std::map<std::string, context::quote_t> result;
-            for(auto& service_pair: list) {
-                auto name = service_pair.first;
-                const auto& actor = service_pair.second;
-                result.emplace(std::move(name), context::quote_t{actor->endpoints(), actor->prototype()});
-            }
-            return result;
-        });
+        const auto snapshot = std::atomic_load(&m_snapshot);
+
+        return std::map<std::string, context::quote_t>(snapshot->begin(), snapshot->end());
     }
 
     execution_unit_t&
@@ -332,12 +440,16 @@ public:
 
     void
     terminate() {
-        COCAINE_LOG_INFO(m_log, "stopping {:d} service(s)", m_services->size());
+        COCAINE_LOG_INFO(m_log, "stopping {:d} service(s)", m_services->list.size());
 
         // Fire off to alert concerned subscribers about the shutdown. This signal happens before all
         // the outstanding connections are closed, so services have a chance to send their last wishes.
         m_signals.invoke<io::context::shutdown>();
 
+        // Stop refreshing service endpoints before the services go away.
+        m_refresher_slot = nullptr;
+        m_refresher_chamber = nullptr;
+
         // Stop the service from accepting new clients or doing any processing. Pop them from the active
         // service list into this temporary storage, and then destroy them all at once. This is needed
         // because sessions in the execution units might still have references to the services, and their
@@ -354,7 +466,7 @@ public:
 
         // There should be no outstanding services left. All the extra services spawned by others, like
         // app invocation services from the node service, should be dead by now.
-        BOOST_ASSERT(m_services->empty());
+        BOOST_ASSERT(m_services->list.empty());
 
         COCAINE_LOG_INFO(m_log, "stopping {:d} execution unit(s)", m_pool.size());
 
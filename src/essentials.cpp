@@ -22,11 +22,13 @@
 
 #include "cocaine/detail/cluster/multicast.hpp"
 #include "cocaine/detail/cluster/predefine.hpp"
+#include "cocaine/detail/cluster/swim.hpp"
 #include "cocaine/detail/gateway/adhoc.hpp"
 #include "cocaine/detail/service/locator.hpp"
 #include "cocaine/detail/service/logging.hpp"
 #include "cocaine/detail/service/storage.hpp"
 #include "cocaine/detail/storage/files.hpp"
+#include "cocaine/detail/storage/journal.hpp"
 #include "cocaine/repository/authentication.hpp"
 #include "cocaine/repository/authorization.hpp"
 #include "cocaine/repository/cluster.hpp"
@@ -49,9 +51,11 @@ cocaine::essentials::initialize(api::repository_t& repository) {
     repository.insert<authorization::unicorn::disabled_t>("disabled");
     repository.insert<cluster::multicast_t>("multicast");
     repository.insert<cluster::predefine_t>("predefine");
+    repository.insert<cluster::swim_t>("swim");
     repository.insert<gateway::adhoc_t>("adhoc");
     repository.insert<service::locator_t>("locator");
     repository.insert<service::logging_t>("logging");
     repository.insert<service::storage_t>("storage");
     repository.insert<storage::files_t>("files");
+    repository.insert<storage::journal_t>("journal");
 }
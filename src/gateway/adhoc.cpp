@@ -29,37 +29,77 @@
 
 #include <boost/optional/optional.hpp>
 
+#include <algorithm>
+#include <functional>
+
 namespace cocaine {
 namespace gateway {
 
 adhoc_t::adhoc_t(context_t& context, const std::string& _local_uuid, const std::string& name, const dynamic_t& args):
     category_type(context, _local_uuid, name, args),
-    m_log(context.log(name))
+    m_log(context.log(name)),
+    m_mean(0)
 {
-    std::random_device rd;
-    m_random_generator.seed(rd());
+    for(auto it = m_snapshot.begin(); it != m_snapshot.end(); ++it) {
+        *it = std::make_shared<snapshot_t>();
+    }
+
+    const auto balancer = args.as_object().at("balancer", "random").as_string();
+
+    if(balancer == "random") {
+        m_balancer = balancer_t::random;
+    } else if(balancer == "p2c") {
+        m_balancer = balancer_t::p2c;
+    } else {
+        throw error_t("unknown adhoc gateway balancer '{}'", balancer);
+    }
 }
 
 auto
 adhoc_t::resolve(const std::string& name) const -> service_description_t {
-    return m_remotes.apply([&](const remote_map_t& remotes) {
-        auto by_service_it = remotes.find(name);
-        if(by_service_it == remotes.end() || by_service_it->second.empty()) {
-            throw std::system_error(error::service_not_available);
+    const auto snapshot = std::atomic_load(&m_snapshot[shard(name)]);
+
+    auto by_service_it = snapshot->find(name);
+    if(by_service_it == snapshot->end() || by_service_it->second->empty()) {
+        throw std::system_error(error::service_not_available);
+    }
+
+    // Each thread rolls its own dice, so resolving doesn't contend on a shared generator.
+    static thread_local std::default_random_engine generator{std::random_device()()};
+
+    const auto& remotes = *by_service_it->second;
+
+    std::uniform_int_distribution<size_t> distribution(0, remotes.size() - 1);
+
+    auto index = distribution(generator);
+    auto chosen = remotes[index].get();
+
+    if(m_balancer == balancer_t::p2c && remotes.size() > 1) {
+        // Pick another remote, distinct from the first one, and keep the less loaded of the two.
+        auto other = std::uniform_int_distribution<size_t>(0, remotes.size() - 2)(generator);
+
+        if(other >= index) {
+            other++;
         }
 
-        // roll the dice and choose random one
-        auto& services_by_uuid = by_service_it->second;
-        auto it = services_by_uuid.begin();
-        std::uniform_int_distribution<int> distribution(0, services_by_uuid.size() - 1);
-        std::advance(it, distribution(m_random_generator));
+        // Nodes with no latency samples are assumed to be average, otherwise they would always win
+        // and get all the load at once.
+        const auto mean = m_mean.load();
+        const auto load = [mean](const remote_t& remote) -> std::uint64_t {
+            const auto latency = remote.node->latency.load();
+            return latency ? latency : mean;
+        };
 
-        COCAINE_LOG_DEBUG(m_log, "providing service using remote actor", blackhole::attribute_list({
-            {"uuid", it->second.uuid}
-        }));
+        if(load(*remotes[other]) < load(*chosen)) {
+            chosen = remotes[other].get();
+        }
+    }
 
-        return service_description_t{it->second.endpoints, it->second.protocol, it->second.version};
-    });
+    COCAINE_LOG_DEBUG(m_log, "providing service using remote actor", blackhole::attribute_list({
+        {"uuid", chosen->uuid}
+    }));
+
+    return service_description_t{chosen->endpoints, chosen->protocol, chosen->version};
 }
 
 auto
@@ -69,60 +109,225 @@ adhoc_t::consume(const std::string& uuid,
                  const std::vector<asio::ip::tcp::endpoint>& endpoints,
                  const io::graph_root_t& protocol) -> void
 {
-    m_remotes.apply([&](remote_map_t& remotes){
-        bool inserted;
-        std::tie(std::ignore, inserted) = remotes[name].insert({uuid, remote_t{uuid, version, endpoints, protocol}});
-
-        if(!inserted) {
+    m_state.apply([&](state_t& state){
+        if(!insert(state, uuid, name, version, endpoints, protocol)) {
             throw error_t(error::gateway_duplicate_service,
                           "failed to add remote service {} located on {} to gateway: service already registered",
                           name, uuid);
-        } else {
-            COCAINE_LOG_DEBUG(m_log, "registered {}/{} destination with {:d} endpoints from {}",
-                              name, version, endpoints.size(), uuid);
         }
 
+        publish(state, {name});
     });
 }
 
 auto
 adhoc_t::cleanup(const std::string& uuid, const std::string& name) -> void {
-    m_remotes.apply([&](remote_map_t& remotes){
-        if(remotes[name].erase(uuid)) {
-            COCAINE_LOG_DEBUG(m_log, "removed service {} provided by {} from gateway", name, uuid);
-        } else {
+    m_state.apply([&](state_t& state){
+        if(!erase(state, uuid, name)) {
             throw error_t(error::gateway_missing_service,
                           "failed to remove service {} provided by {} from gateway: not found", name, uuid);
         }
+
+        publish(state, {name});
+    });
+}
+
+auto
+adhoc_t::update(const std::string& uuid, const std::map<std::string, service_description_t>& services) -> void {
+    m_state.apply([&](state_t& state){
+        std::vector<std::string> changed;
+
+        for(auto it = services.begin(); it != services.end(); ++it) {
+            // Services are replaced as a whole, so that updates don't have to be split in two.
+            const bool removed = erase(state, uuid, it->first);
+
+            if(!it->second.endpoints.empty()) {
+                insert(state, uuid, it->first, it->second.version, it->second.endpoints, it->second.protocol);
+            } else if(!removed) {
+                continue;
+            }
+
+            changed.push_back(it->first);
+        }
+
+        publish(state, changed);
     });
 }
 
 auto
 adhoc_t::cleanup(const std::string& uuid) -> void {
-    m_remotes.apply([&](remote_map_t& remotes){
-        size_t removed = 0;
-        for(auto it = remotes.begin(); it != remotes.end();) {
-            removed += it->second.erase(uuid);
-            if(it->second.empty()) {
-                it = remotes.erase(it);
-            } else {
-                it++;
+    m_state.apply([&](state_t& state){
+        std::vector<std::string> removed;
+
+        auto provided = state.services.find(uuid);
+
+        if(provided != state.services.end()) {
+            for(auto name = provided->second.begin(); name != provided->second.end(); ++name) {
+                auto it = state.remotes.find(*name);
+
+                if(it == state.remotes.end() || !it->second.erase(uuid)) {
+                    continue;
+                }
+
+                removed.push_back(*name);
+
+                if(it->second.empty()) {
+                    state.remotes.erase(it);
+                }
             }
+
+            state.services.erase(provided);
         }
-        COCAINE_LOG_INFO(m_log, "removed {} services from {} remote", removed, uuid);
+
+        auto node = state.nodes.find(uuid);
+
+        if(node != state.nodes.end()) {
+            unmeasure(state, *node->second);
+            state.nodes.erase(node);
+        }
+
+        publish(state, removed);
+        COCAINE_LOG_INFO(m_log, "removed {} services from {} remote", removed.size(), uuid);
     });
 }
 
 auto
-adhoc_t::total_count(const std::string& name) const -> size_t {
-    return m_remotes.apply([&](const remote_map_t& remotes) -> size_t {
-        const auto it = remotes.find(name);
-        if(it == remotes.end()) {
-            return 0ul;
+adhoc_t::feedback(const std::string& uuid, std::chrono::microseconds latency) -> void {
+    m_state.apply([&](state_t& state){
+        auto& node = state.nodes[uuid];
+
+        if(!node) {
+            node = std::make_shared<node_t>();
         }
-        return it->second.size();
+
+        const std::uint64_t sample = std::max<std::int64_t>(1, latency.count());
+        const std::uint64_t average = node->latency.load();
+        const std::uint64_t updated = average == 0 ? sample : (average * 7 + sample) / 8;
+
+        // Writers are serialized by the state lock, readers don't care about torn averages.
+        node->latency.store(updated);
+
+        if(average == 0) {
+            state.measured++;
+        }
+
+        state.measured_sum += updated - average;
+        m_mean.store(state.measured_sum / state.measured);
     });
 }
 
+size_t
+adhoc_t::shard(const std::string& name) {
+    return std::hash<std::string>()(name) % kShards;
+}
+
+bool
+adhoc_t::insert(state_t& state, const std::string& uuid, const std::string& name, unsigned int version,
+                const std::vector<asio::ip::tcp::endpoint>& endpoints, const io::graph_root_t& protocol)
+{
+    auto& node = state.nodes[uuid];
+
+    if(!node) {
+        node = std::make_shared<node_t>();
+    }
+
+    auto remote = std::make_shared<const remote_t>(remote_t{uuid, version, endpoints, protocol, node});
+
+    if(!state.remotes[name].insert({uuid, std::move(remote)}).second) {
+        return false;
+    }
+
+    COCAINE_LOG_DEBUG(m_log, "registered {}/{} destination with {:d} endpoints from {}",
+                      name, version, endpoints.size(), uuid);
+
+    state.services[uuid].insert(name);
+
+    return true;
+}
+
+bool
+adhoc_t::erase(state_t& state, const std::string& uuid, const std::string& name) {
+    auto it = state.remotes.find(name);
+
+    if(it == state.remotes.end() || !it->second.erase(uuid)) {
+        return false;
+    }
+
+    COCAINE_LOG_DEBUG(m_log, "removed service {} provided by {} from gateway", name, uuid);
+
+    if(it->second.empty()) {
+        state.remotes.erase(it);
+    }
+
+    auto provided = state.services.find(uuid);
+
+    if(provided != state.services.end()) {
+        provided->second.erase(name);
+
+        if(provided->second.empty()) {
+            state.services.erase(provided);
+        }
+    }
+
+    return true;
+}
+
+void
+adhoc_t::unmeasure(state_t& state, const node_t& node) {
+    const std::uint64_t latency = node.latency.load();
+
+    if(latency == 0) {
+        return;
+    }
+
+    state.measured--;
+    state.measured_sum -= latency;
+    m_mean.store(state.measured ? state.measured_sum / state.measured : 0);
+}
+
+auto
+adhoc_t::total_count(const std::string& name) const -> size_t {
+    const auto snapshot = std::atomic_load(&m_snapshot[shard(name)]);
+    const auto it = snapshot->find(name);
+    if(it == snapshot->end()) {
+        return 0ul;
+    }
+    return it->second->size();
+}
+
+void
+adhoc_t::publish(const state_t& state, const std::vector<std::string>& names) {
+    std::map<size_t, std::vector<std::string>> affected;
+
+    for(auto name = names.begin(); name != names.end(); ++name) {
+        affected[shard(*name)].push_back(*name);
+    }
+
+    for(auto it = affected.begin(); it != affected.end(); ++it) {
+        // Only the shard index is copied, remote arrays of other services are shared with the
+        // original one.
+        auto snapshot = std::make_shared<snapshot_t>(*std::atomic_load(&m_snapshot[it->first]));
+
+        for(auto name = it->second.begin(); name != it->second.end(); ++name) {
+            const auto remotes = state.remotes.find(*name);
+
+            if(remotes == state.remotes.end()) {
+                snapshot->erase(*name);
+                continue;
+            }
+
+            auto vector = std::make_shared<remote_vector_t>();
+
+            for(auto remote = remotes->second.begin(); remote != remotes->second.end(); ++remote) {
+                vector->push_back(remote->second);
+            }
+
+            (*snapshot)[*name] = std::move(vector);
+        }
+
+        std::atomic_store(&m_snapshot[it->first], std::shared_ptr<const snapshot_t>(std::move(snapshot)));
+    }
+}
+
 } // namespace gateway
 } // namespace cocaine
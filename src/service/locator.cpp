@@ -60,6 +60,13 @@
 #include <boost/range/algorithm/transform.hpp>
 #include <boost/range/numeric.hpp>
 
+#include <metrics/registry.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+
 using namespace cocaine;
 using namespace cocaine::io;
 using namespace cocaine::service;
@@ -75,6 +82,23 @@ using blackhole::scope::holder_t;
 
 // Locator internals
 
+struct locator_t::metrics_t {
+    // Number of service update batches announced to remote locators and the total number of
+    // service updates in them, i.e. their ratio is the average batch size.
+    metrics::shared_metric<std::atomic<std::int64_t>> announced_batches;
+    metrics::shared_metric<std::atomic<std::int64_t>> announced_services;
+
+    // Service states received over mesh links which were newer than the known ones, and those
+    // which were not, i.e. duplicates delivered via multiple paths.
+    metrics::shared_metric<std::atomic<std::int64_t>> mesh_accepted;
+    metrics::shared_metric<std::atomic<std::int64_t>> mesh_ignored;
+
+    // Number of remote nodes whose links are currently in each state, and the number of times each
+    // state has been entered, indexed by the link state.
+    std::vector<metrics::shared_metric<std::atomic<std::int64_t>>> peers;
+    std::vector<metrics::shared_metric<std::atomic<std::int64_t>>> transitions;
+};
+
 class locator_t::connect_sink_t: public dispatch<event_traits<locator::connect>::upstream_type> {
     locator_t  *const parent;
     std::string const uuid;
@@ -134,19 +158,22 @@ locator_t::connect_sink_t::on_announce(const std::string& node,
 
     auto lock = parent->m_clients.synchronize();
 
+    // The whole batch is applied at once, so that the gateway index is rebuilt only once.
+    std::map<std::string, api::gateway_t::service_description_t> services;
+
     for(auto it = update.begin(); it != update.end(); ++it) tuple::invoke(
         std::move(it->second),
         [&](std::vector<tcp::endpoint>&& location, unsigned int versions, graph_root_t&& protocol)
     {
-        std::string name(it->first);
-
-        if(location.empty()) {
-            parent->m_gateway->cleanup(uuid, name);
-        } else {
-            parent->m_gateway->consume(uuid, name, versions, location, protocol);
-        }
+        services[it->first] = api::gateway_t::service_description_t{
+            std::move(location),
+            std::move(protocol),
+            versions
+        };
     });
 
+    parent->m_gateway->update(uuid, services);
+
     const auto joined = boost::algorithm::join(update | boost::adaptors::map_keys, ", ");
 
     COCAINE_LOG_INFO(parent->m_log, "remote client updated {:d} service(s): {}", update.size(), joined, attribute_list({
@@ -163,6 +190,92 @@ locator_t::connect_sink_t::on_shutdown() {
     parent->drop_node(uuid);
 }
 
+// Measures the round trip of a single request to a remote locator, any response will do.
+class locator_t::probe_sink_t: public dispatch<event_traits<locator::resolve>::upstream_type> {
+    typedef io::protocol<event_traits<locator::resolve>::upstream_type>::scope protocol;
+
+    locator_t  *const parent;
+    std::string const uuid;
+
+    const std::chrono::steady_clock::time_point started;
+
+public:
+    probe_sink_t(locator_t *const parent_, const std::string& uuid_):
+        dispatch<event_traits<locator::resolve>::upstream_type>(parent_->name() + ":probe"),
+        parent(parent_),
+        uuid(uuid_),
+        started(std::chrono::steady_clock::now())
+    {
+        on<protocol::value>([this](const std::vector<tcp::endpoint>&, unsigned int, const graph_root_t&) {
+            on_response();
+        });
+
+        on<protocol::error>([this](const std::error_code&, const std::string&) {
+            on_response();
+        });
+    }
+
+private:
+    void
+    on_response() {
+        parent->m_gateway->feedback(uuid, std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - started));
+    }
+};
+
+class locator_t::mesh_sink_t: public dispatch<event_traits<locator::mesh>::upstream_type> {
+    locator_t  *const parent;
+    std::string const uuid;
+
+public:
+    mesh_sink_t(locator_t *const parent_, const std::string& uuid_):
+        dispatch<event_traits<locator::mesh>::upstream_type>(parent_->name() + ":peer"),
+        parent(parent_),
+        uuid(uuid_)
+    {
+        typedef io::protocol<event_traits<locator::mesh>::upstream_type>::scope protocol;
+
+        on<protocol::chunk>(std::bind(&mesh_sink_t::on_update, this, ph::_1, ph::_2));
+        on<protocol::choke>(std::bind(&mesh_sink_t::on_shutdown, this));
+    }
+
+    virtual
+    void
+    discard(const std::error_code& ec);
+
+private:
+    void
+    on_update(const results::mesh_versions& versions, results::mesh_states&& states);
+
+    void
+    on_shutdown();
+};
+
+void
+locator_t::mesh_sink_t::discard(const std::error_code& ec) {
+    if(ec.value() == 0) return;
+
+    COCAINE_LOG_ERROR(parent->m_log, "remote peer discarded: [{:d}] {}", ec.value(), ec.message(), attribute_list({
+        {"uuid", uuid}
+    }));
+
+    parent->relink(uuid);
+}
+
+void
+locator_t::mesh_sink_t::on_update(const results::mesh_versions& versions, results::mesh_states&& states) {
+    parent->on_mesh_update(uuid, versions, std::move(states));
+}
+
+void
+locator_t::mesh_sink_t::on_shutdown() {
+    COCAINE_LOG_INFO(parent->m_log, "remote peer closed its stream", {
+        {"uuid", uuid}
+    });
+
+    parent->relink(uuid);
+}
+
 class locator_t::publish_slot_t: public basic_slot<locator::publish> {
     struct publish_lock_t: public basic_slot<locator::publish>::dispatch_type {
         publish_slot_t *const parent;
@@ -241,17 +354,51 @@ private:
     }
 };
 
-class locator_t::routing_slot_t: public basic_slot<locator::routing> {
-    struct routing_lock_t: public basic_slot<locator::routing>::dispatch_type {
+class locator_t::resolve_slot_t: public basic_slot<locator::resolve> {
+    typedef std::shared_ptr<basic_slot::dispatch_type> result_type;
+    typedef io::protocol<event_traits<locator::resolve>::upstream_type>::scope protocol;
+
+    locator_t *const parent;
+
+public:
+    resolve_slot_t(locator_t *const parent_): parent(parent_) { }
+
+    auto
+    operator()(const std::vector<hpack::header_t>&,
+               tuple_type&& args,
+               upstream_type&& upstream) -> boost::optional<result_type>
+    {
+        try {
+            upstream.send<protocol::value>(cocaine::tuple::invoke(std::move(args),
+                [this](std::string&& name, std::string&& seed) -> results::packed_resolve
+            {
+                return parent->on_resolve(name, seed);
+            }));
+        } catch(const std::system_error& e) {
+            upstream.send<protocol::error>(e.code(), std::string(e.what()));
+        } catch(const std::exception& e) {
+            upstream.send<protocol::error>(error::uncaught_error, std::string(e.what()));
+        }
+
+        return boost::make_optional<result_type>(nullptr);
+    }
+};
+
+// Both routing protocol versions share the dispatch, differing only in the outgoing streams.
+template<class Event>
+class locator_t::routing_slot_t: public basic_slot<Event> {
+    typedef basic_slot<Event> base_type;
+
+    struct routing_lock_t: public base_type::dispatch_type {
         routing_slot_t *const parent;
         std::string     const handle;
 
         routing_lock_t(routing_slot_t *const parent_, const std::string& handle_):
-            basic_slot<locator::routing>::dispatch_type("routing"),
+            base_type::dispatch_type("routing"),
             parent(parent_),
             handle(handle_)
         {
-            on<locator::routing::discard>([this] { discard({}); });
+            this->template on<locator::routing::discard>([this] { discard({}); });
         }
 
         virtual
@@ -259,12 +406,27 @@ class locator_t::routing_slot_t: public basic_slot<locator::routing> {
         discard(const std::error_code& ec) { parent->discard(ec, handle); }
     };
 
-    typedef std::shared_ptr<basic_slot::dispatch_type> result_type;
+    typedef std::shared_ptr<typename base_type::dispatch_type> result_type;
+
+    typedef typename base_type::tuple_type tuple_type;
+    typedef typename base_type::upstream_type upstream_type;
+
+    typedef streamed<typename result_of<Event>::type> stream_type;
+
+    typedef stream_type (locator_t::*attach_type)(const std::string&);
+    typedef synchronized<std::map<std::string, stream_type>> locator_t::*routers_type;
 
     locator_t *const parent;
 
+    const attach_type attach;
+    const routers_type routers;
+
 public:
-    routing_slot_t(locator_t *const parent_): parent(parent_) { }
+    routing_slot_t(locator_t *const parent_, attach_type attach_, routers_type routers_):
+        parent(parent_),
+        attach(attach_),
+        routers(routers_)
+    { }
 
     auto
     operator()(tuple_type&& args,
@@ -280,10 +442,10 @@ public:
     {
         const auto ruid = std::get<0>(args);
 
-        auto rv = parent->on_routing(ruid, true);
+        auto rv = (parent->*attach)(ruid);
         auto dispatch = std::make_shared<routing_lock_t>(this, ruid);
 
-        // Try to flush the initial routing group information (if available). This can throw.
+        // Try to flush the initial routing table snapshot. This can throw.
         rv.attach(std::move(upstream));
 
         return boost::make_optional(result_type(dispatch));
@@ -296,18 +458,296 @@ private:
             handle,
             ec.value(), ec.message());
 
-        parent->m_routers->erase(handle);
+        (parent->*routers)->erase(handle);
+    }
+};
+
+class locator_t::mesh_slot_t: public basic_slot<locator::mesh> {
+    struct mesh_link_t: public basic_slot<locator::mesh>::dispatch_type {
+        mesh_slot_t  *const parent;
+        std::string   const handle;
+        std::uint64_t const id;
+
+        mesh_link_t(mesh_slot_t *const parent_, const std::string& handle_, std::uint64_t id_):
+            basic_slot<locator::mesh>::dispatch_type("mesh"),
+            parent(parent_),
+            handle(handle_),
+            id(id_)
+        {
+            on<locator::mesh::update>(std::bind(&mesh_link_t::on_update, this, ph::_1, ph::_2));
+        }
+
+        virtual
+        void
+        discard(const std::error_code& ec) { parent->discard(ec, handle, id); }
+
+    private:
+        void
+        on_update(const results::mesh_versions& versions, results::mesh_states&& states) {
+            parent->parent->on_mesh_update(handle, versions, std::move(states));
+        }
+    };
+
+    typedef std::shared_ptr<basic_slot::dispatch_type> result_type;
+
+    locator_t *const parent;
+
+    // Used to tag incoming links.
+    std::atomic<std::uint64_t> links;
+
+public:
+    mesh_slot_t(locator_t *const parent_): parent(parent_), links(0) { }
+
+    auto
+    operator()(tuple_type&& args,
+               upstream_type&& upstream) -> boost::optional<result_type>
+    {
+        return operator()({}, std::move(args), std::move(upstream));
+    }
+
+    auto
+    operator()(const std::vector<hpack::header_t>&,
+               tuple_type&& args,
+               upstream_type&& upstream) -> boost::optional<result_type>
+    {
+        const auto uuid = std::get<0>(args);
+        const auto id = ++links;
+
+        auto rv = parent->on_mesh(uuid, std::get<1>(args), id);
+        auto dispatch = std::make_shared<mesh_link_t>(this, uuid, id);
+
+        // Try to flush the initial service states. This can throw.
+        rv.attach(std::move(upstream));
+
+        return boost::make_optional(result_type(dispatch));
+    }
+
+private:
+    void
+    discard(const std::error_code& ec, const std::string& handle, std::uint64_t id) {
+        COCAINE_LOG_DEBUG(parent->m_log, "detaching incoming mesh link from '{}': [{:d}] {}",
+            handle,
+            ec.value(), ec.message());
+
+        parent->m_remotes.apply([&](remote_map_t&) {
+            auto it = parent->m_mesh.incoming.find(handle);
+
+            // The peer might have set up a new link already.
+            if(it != parent->m_mesh.incoming.end() && it->second.first == id) {
+                parent->m_mesh.incoming.erase(it);
+            }
+        });
     }
 };
 
+namespace {
+
+// Invokes the given function for each index in [0, count) using a bounded number of threads. The
+// function must not throw.
+template<class F>
+void
+parallel_for(size_t count, F fn) {
+    const size_t concurrency = std::min<size_t>(count, std::max(1u, std::thread::hardware_concurrency()));
+
+    if(concurrency <= 1) {
+        for(size_t i = 0; i < count; ++i) fn(i);
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+
+    for(size_t worker = 0; worker < concurrency; ++worker) {
+        workers.emplace_back([&] {
+            for(size_t i = next++; i < count; i = next++) fn(i);
+        });
+    }
+
+    for(auto it = workers.begin(); it != workers.end(); ++it) {
+        it->join();
+    }
+}
+
+// Builds continuums for all the routing groups in the given mapping.
+template<class Mapping>
+results::routing_table
+continuums(const Mapping& mapping) {
+    results::routing_table table;
+
+    for(auto it = mapping.begin(); it != mapping.end(); ++it) {
+        table.insert({it->first, it->second->routing->all()});
+    }
+
+    return table;
+}
+
+// Enqueues the given chunk to all the router streams, dropping those which have failed.
+template<class Routers, class Chunk>
+void
+enqueue(logging::logger_t& log, Routers& routers, const Chunk& chunk) {
+    std::vector<std::string> failed;
+
+    for(auto it = routers.begin(); it != routers.end(); ++it) {
+        if(auto ec = it->second.write(chunk)) {
+            COCAINE_LOG_WARNING(log, "unable to enqueue routing updates for router '{}': [{:d}] {}",
+                it->first,
+                ec.value(), ec.message());
+            failed.push_back(it->first);
+        }
+    }
+
+    for(auto it = failed.begin(); it != failed.end(); ++it) {
+        routers.erase(*it);
+    }
+}
+
+// Service states as exchanged over mesh links. Deltas mark removed services with no endpoints.
+typedef std::map<std::string, results::resolve> mesh_services_t;
+
+mesh_services_t
+patch(mesh_services_t services, const mesh_services_t& delta) {
+    for(auto it = delta.begin(); it != delta.end(); ++it) {
+        if(std::get<0>(it->second).empty()) {
+            services.erase(it->first);
+        } else {
+            services[it->first] = it->second;
+        }
+    }
+
+    return services;
+}
+
+mesh_services_t
+diff(const mesh_services_t& before, const mesh_services_t& after) {
+    mesh_services_t delta;
+
+    for(auto it = before.begin(); it != before.end(); ++it) {
+        if(!after.count(it->first)) {
+            delta.insert({it->first, results::resolve()});
+        }
+    }
+
+    // Protocol graphs are not compared, they only change along with the service endpoints.
+    for(auto it = after.begin(); it != after.end(); ++it) {
+        const auto prev = before.find(it->first);
+
+        if(prev == before.end() || std::get<0>(prev->second) != std::get<0>(it->second) ||
+                                   std::get<1>(prev->second) != std::get<1>(it->second))
+        {
+            delta.insert(*it);
+        }
+    }
+
+    return delta;
+}
+
+} // namespace
+
 // Locator
 
+locator_t::rg_t::rg_t(std::unique_ptr<logging::logger_t> log, routing_group_t::stored_type group_,
+                      routing_group_t::algorithm_type algorithm, routing_group_t::hash_type hash):
+    group(std::move(group_)),
+    routing(make_routing_group(algorithm, std::move(log), group, hash))
+{ }
+
+namespace {
+
+routing_group_t::algorithm_type
+parse_algorithm(const std::string& name) {
+    typedef routing_group_t::algorithm_type algorithm_type;
+
+    if(name == "ketama") {
+        return algorithm_type::ketama;
+    } else if(name == "maglev") {
+        return algorithm_type::maglev;
+    } else if(name == "jump") {
+        return algorithm_type::jump;
+    } else if(name == "rendezvous") {
+        return algorithm_type::rendezvous;
+    }
+
+    throw cocaine::error_t("unknown routing group algorithm '{}'", name);
+}
+
+} // namespace
+
 locator_cfg_t::locator_cfg_t(const std::string& name_, const dynamic_t& root):
     name(name_),
     uuid(root.as_object().at("uuid", unique_id_t().string()).as_string())
 {
     restricted = root.as_object().at("restrict", dynamic_t::array_t()).to<std::set<std::string>>();
     restricted.insert(name);
+
+    const auto hash_name = root.as_object().at("hash", "md5").as_string();
+
+    if(hash_name == "md5") {
+        hash = routing_group_t::hash_type::md5;
+    } else if(hash_name == "fnv1a") {
+        hash = routing_group_t::hash_type::fnv1a;
+    } else {
+        throw cocaine::error_t("unknown routing group hash function '{}'", hash_name);
+    }
+
+    algorithm = parse_algorithm(root.as_object().at("algorithm", "ketama").as_string());
+
+    const auto overrides = root.as_object().at("algorithms", dynamic_t::object_t()).as_object();
+
+    for(auto it = overrides.begin(); it != overrides.end(); ++it) {
+        algorithms[it->first] = parse_algorithm(it->second.as_string());
+    }
+
+    advertise = root.as_object().at("advertise", true).as_bool();
+
+    if(advertise) {
+        if(!is_advertisable(algorithm)) {
+            throw cocaine::error_t("default routing group algorithm can't be advertised to routers");
+        }
+
+        for(auto it = algorithms.begin(); it != algorithms.end(); ++it) {
+            if(!is_advertisable(it->second)) {
+                throw cocaine::error_t("routing group '{}' algorithm can't be advertised to routers",
+                    it->first);
+            }
+        }
+    }
+
+    announce_window = boost::posix_time::milliseconds(
+        root.as_object().at("announce_window", 50u).as_uint()
+    );
+
+    backoff_min = boost::posix_time::milliseconds(
+        std::max<dynamic_t::uint_t>(1, root.as_object().at("backoff_min", 500u).as_uint())
+    );
+
+    backoff_max = boost::posix_time::milliseconds(
+        std::max<dynamic_t::uint_t>(1, root.as_object().at("backoff_max", 60000u).as_uint())
+    );
+
+    max_connects = std::max<dynamic_t::uint_t>(1, root.as_object().at("max_connects", 16u).as_uint());
+
+    probe_interval = boost::posix_time::milliseconds(
+        root.as_object().at("probe_interval", 5000u).as_uint()
+    );
+
+    shards = std::max<dynamic_t::uint_t>(1, root.as_object().at("shards",
+        std::max(1u, std::thread::hardware_concurrency())).as_uint());
+
+    const auto topology_name = root.as_object().at("topology", "full").as_string();
+
+    if(topology_name == "full") {
+        topology = topologies::full;
+    } else if(topology_name == "mesh") {
+        topology = topologies::mesh;
+    } else {
+        throw cocaine::error_t("unknown cluster topology '{}'", topology_name);
+    }
+
+    fanout = std::max<dynamic_t::uint_t>(1, root.as_object().at("fanout", 4u).as_uint());
+
+    mesh_expiration = boost::posix_time::seconds(
+        root.as_object().at("mesh_expiration", 600u).as_uint()
+    );
 }
 
 locator_t::locator_t(context_t& context, io_service& asio, const std::string& name, const dynamic_t& root):
@@ -316,15 +756,50 @@ locator_t::locator_t(context_t& context, io_service& asio, const std::string& na
     m_context(context),
     m_log(context.log(name)),
     m_cfg(name, root),
-    m_asio(asio)
+    m_asio(asio),
+    m_rgs(std::make_shared<rg_map_t>(), m_cfg.shards),
+    m_rgs_version(0),
+    m_cache(std::make_shared<cache_map_t>(), m_cfg.shards),
+    m_connecting(0),
+    m_random(std::random_device()()),
+    m_announce_timer(asio),
+    m_announce_armed(false),
+    m_probe_timer(asio),
+    m_expiration_timer(asio),
+    m_expiration_armed(false),
+    m_metrics(new metrics_t{
+        context.metrics_hub().counter<std::int64_t>(cocaine::format("{}.announces.batches", name)),
+        context.metrics_hub().counter<std::int64_t>(cocaine::format("{}.announces.services", name)),
+        context.metrics_hub().counter<std::int64_t>(cocaine::format("{}.mesh.accepted", name)),
+        context.metrics_hub().counter<std::int64_t>(cocaine::format("{}.mesh.ignored", name)),
+        {},
+        {}
+    })
 {
-    on<locator::resolve>(std::bind(&locator_t::on_resolve, this, ph::_1, ph::_2));
+    // Nodes restarted with the same uuid must override their own stale service states.
+    m_mesh.version = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    static const char* states[] = { "queued", "connecting", "backoff", "connected" };
+
+    for(auto it = std::begin(states); it != std::end(states); ++it) {
+        m_metrics->peers.push_back(context.metrics_hub().counter<std::int64_t>(
+            cocaine::format("{}.peers.{}", name, *it)));
+        m_metrics->transitions.push_back(context.metrics_hub().counter<std::int64_t>(
+            cocaine::format("{}.peers.{}.entered", name, *it)));
+    }
+
     on<locator::connect>(std::bind(&locator_t::on_connect, this, ph::_1));
     on<locator::refresh>(std::bind(&locator_t::on_refresh, this, ph::_1));
     on<locator::cluster>(std::bind(&locator_t::on_cluster, this));
 
+    on<locator::resolve>(std::make_shared<resolve_slot_t>(this));
     on<locator::publish>(std::make_shared<publish_slot_t>(this));
-    on<locator::routing>(std::make_shared<routing_slot_t>(this));
+    on<locator::routing>(std::make_shared<routing_slot_t<locator::routing>>(this,
+        &locator_t::on_routing, &locator_t::m_routers));
+    on<locator::routing_v2>(std::make_shared<routing_slot_t<locator::routing_v2>>(this,
+        &locator_t::on_routing_v2, &locator_t::m_routers_v2));
+    on<locator::mesh>(std::make_shared<mesh_slot_t>(this));
 
     // Service restrictions
 
@@ -341,9 +816,11 @@ locator_t::locator_t(context_t& context, io_service& asio, const std::string& na
 
     // Clustering components
 
-    m_signals->on<io::context::service::exposed>(std::bind(&locator_t::on_service, this,
+    m_signals->on<io::context::service::exposed>(std::bind(&locator_t::on_local_service, this,
                                                            ph::_1, ph::_2, modes::exposed));
-    m_signals->on<io::context::service::removed>(std::bind(&locator_t::on_service, this,
+    m_signals->on<io::context::service::updated>(std::bind(&locator_t::on_local_service, this,
+                                                           ph::_1, ph::_2, modes::updated));
+    m_signals->on<io::context::service::removed>(std::bind(&locator_t::on_local_service, this,
                                                            ph::_1, ph::_2, modes::removed));
 
     if(root.as_object().count("gateway")) {
@@ -361,10 +838,16 @@ locator_t::locator_t(context_t& context, io_service& asio, const std::string& na
         const auto type = conf.at("type", "unspecified").as_string();
         const auto args = conf.at("args", dynamic_t::object_t());
 
-        COCAINE_LOG_INFO(m_log, "using '{}' as a cluster manager, enabling synchronization", type);
+        COCAINE_LOG_INFO(m_log, "using '{}' as a cluster manager, enabling synchronization in {} topology",
+            type,
+            m_cfg.topology == locator_cfg_t::topologies::mesh ? "mesh" : "full");
 
         api::cluster_t::mode_t mode = m_gateway ? api::cluster_t::mode_t::full : api::cluster_t::mode_t::announce_only;
         m_cluster = m_context.repository().get<api::cluster_t>(type, m_context, *this, mode, name + ":cluster", args);
+
+        if(m_gateway && m_cfg.probe_interval.total_milliseconds() != 0) {
+            probe();
+        }
     }
 
 
@@ -397,91 +880,160 @@ locator_t::asio() {
 
 void
 locator_t::link_node(const std::string& uuid, const std::vector<tcp::endpoint>& endpoints) {
-    auto mapping = m_clients.synchronize();
+    std::vector<std::shared_ptr<session<tcp>>> detached;
 
-    if(!m_gateway || mapping->count(uuid) != 0) {
-        return;
-    }
+    m_clients.apply([&](client_map_t& mapping) {
+        if(!m_gateway) {
+            return;
+        }
 
-    auto  socket = std::make_shared<tcp::socket>(m_asio);
-    auto& uplink = ((*mapping)[uuid] = {endpoints, nullptr});
+        if(m_cfg.topology == locator_cfg_t::topologies::full) {
+            link(mapping, uuid, endpoints);
+            return;
+        }
 
-    asio::async_connect(*socket, uplink.endpoints.begin(), uplink.endpoints.end(),
-        [=](const std::error_code& ec, std::vector<tcp::endpoint>::const_iterator endpoint)
-    {
-        const holder_t scoped(*m_log, {{"uuid", uuid}});
+        if(uuid == m_cfg.uuid) {
+            return;
+        }
 
-        auto session = m_clients.apply(
-            [&](client_map_t& mapping) -> std::shared_ptr<cocaine::session<tcp>>
-        {
-            if(mapping.count(uuid) == 0) {
-                COCAINE_LOG_ERROR(m_log, "remote disappeared while connecting");
-                return nullptr;
-            }
+        auto it = m_known.find(uuid);
 
-            if(ec) {
-                COCAINE_LOG_ERROR(m_log, "unable to connect to remote: [{:d}] {}", ec.value(), ec.message());
-                mapping.erase(uuid);
+        if(it != m_known.end()) {
+            it->second = endpoints;
 
-                // TODO: Wrap link_node() in some sort of exponential back-off.
-                m_asio.post([=] { link_node(uuid, endpoints); });
-                return nullptr;
+            if(mapping.count(uuid)) {
+                link(mapping, uuid, endpoints);
             }
 
-            COCAINE_LOG_DEBUG(m_log, "connected to remote via {}", *endpoint);
+            return;
+        }
 
-            // Uniquify the socket object.
-            auto ptr = std::make_unique<tcp::socket>(std::move(*socket));
+        m_known.insert({uuid, endpoints});
 
-            std::shared_ptr<cocaine::session<tcp>> session;
-            try {
-                session = m_context.engine().attach(std::move(ptr), nullptr);
-                mapping.at(uuid).ptr = session;
-            } catch (const std::system_error& err) {
-                COCAINE_LOG_ERROR(m_log, "unable to set up remote client: {}", error::to_string(err));
-                mapping.erase(uuid);
+        // The node might have been dropped before, in which case its latest known services are
+        // exposed again until it sends a newer state.
+        m_remotes.apply([&](remote_map_t&) {
+            auto origin = m_mesh.origins.find(uuid);
 
-                m_asio.post([=] { link_node(uuid, endpoints); });
+            if(origin != m_mesh.origins.end() && !origin->second.active) {
+                origin->second.active = true;
+                expose(uuid, service_map_t(), origin->second.services);
             }
-
-            return session;
         });
 
-        // Something went wrong in the session creation code above, bail out.
-        if(!session) return;
+        detached = rebalance(mapping);
+    });
 
-        auto upstream = session->fork(std::make_shared<connect_sink_t>(this, uuid));
+    for(auto it = detached.begin(); it != detached.end(); ++it) {
+        (*it)->detach(std::error_code());
+    }
+}
 
-        try {
-            upstream->send<locator::connect>(m_cfg.uuid);
-        } catch(const std::system_error& e) {
-            COCAINE_LOG_ERROR(m_log, "unable to set up remote stream: {}", error::to_string(e));
-            m_clients->erase(uuid);
+void
+locator_t::drop_node(const std::string& uuid) {
+    std::vector<std::shared_ptr<session<tcp>>> detached;
+
+    m_clients.apply([&](client_map_t& mapping) {
+        if(!m_gateway) {
+            return;
+        }
+
+        if(auto session = unlink(mapping, uuid)) {
+            detached.push_back(session);
+        }
+
+        if(m_cfg.topology == locator_cfg_t::topologies::full || m_known.erase(uuid) == 0) {
+            return;
         }
+
+        m_remotes.apply([&](remote_map_t&) {
+            auto origin = m_mesh.origins.find(uuid);
+
+            if(origin != m_mesh.origins.end() && origin->second.active) {
+                origin->second.active = false;
+                origin->second.expires = asio::deadline_timer::traits_type::now() + m_cfg.mesh_expiration;
+
+                m_gateway->cleanup(uuid);
+                expire();
+            }
+        });
+
+        const auto rebalanced = rebalance(mapping);
+        detached.insert(detached.end(), rebalanced.begin(), rebalanced.end());
     });
 
-    COCAINE_LOG_INFO(m_log, "setting up remote client, trying {:d} route(s)", endpoints.size(), attribute_list({
+    for(auto it = detached.begin(); it != detached.end(); ++it) {
+        (*it)->detach(std::error_code());
+    }
+}
+
+void
+locator_t::link(client_map_t& mapping, const std::string& uuid, const std::vector<tcp::endpoint>& endpoints) {
+    auto it = mapping.find(uuid);
+
+    if(it != mapping.end()) {
+        // Cluster managers link known nodes over and over again, which must not interfere with
+        // back-off. But newly advertised endpoints are used for the next attempt.
+        if(it->second.state == uplink_t::states::queued || it->second.state == uplink_t::states::backoff) {
+            it->second.endpoints = endpoints;
+        }
+
+        return;
+    }
+
+    it = mapping.insert({uuid, uplink_t{endpoints, nullptr, uplink_t::states::queued, 0, nullptr, nullptr}}).first;
+
+    // New uplinks are counted as queued right away, so that the transition below doesn't skew the
+    // gauges.
+    ++(*m_metrics->peers[static_cast<int>(uplink_t::states::queued)].get());
+
+    transition(it->second, uplink_t::states::queued);
+
+    m_connect_queue.push_back(uuid);
+    connect_pending(mapping);
+}
+
+auto
+locator_t::unlink(client_map_t& mapping, const std::string& uuid) -> std::shared_ptr<session<tcp>> {
+    auto it = mapping.find(uuid);
+
+    if(it == mapping.end()) {
+        return nullptr;
+    }
+
+    COCAINE_LOG_INFO(m_log, "shutting down remote client", attribute_list({
         {"uuid", uuid}
     }));
+
+    if(it->second.timer) {
+        it->second.timer->cancel();
+    }
+
+    auto session = it->second.ptr;
+    forget(mapping, it);
+
+    if(m_cfg.topology == locator_cfg_t::topologies::mesh) {
+        m_remotes.apply([&](remote_map_t&) { m_mesh.outgoing.erase(uuid); });
+    }
+
+    return session;
 }
 
 void
-locator_t::drop_node(const std::string& uuid) {
+locator_t::relink(const std::string& uuid) {
     std::shared_ptr<session<tcp>> session;
 
     m_clients.apply([&](client_map_t& mapping) {
         auto it = mapping.find(uuid);
 
-        if(!m_gateway || it == mapping.end()) {
+        if(it == mapping.end() || it->second.state != uplink_t::states::connected) {
             return;
         }
 
-        COCAINE_LOG_INFO(m_log, "shutting down remote client", attribute_list({
-            {"uuid", uuid}
-        }));
+        m_remotes.apply([&](remote_map_t&) { m_mesh.outgoing.erase(uuid); });
 
-        session = it->second.ptr;
-        mapping.erase(it);
+        session = std::move(it->second.ptr);
+        reconnect(mapping, uuid);
     });
 
     if(session) {
@@ -489,34 +1041,331 @@ locator_t::drop_node(const std::string& uuid) {
     }
 }
 
+auto
+locator_t::rebalance(client_map_t& mapping) -> std::vector<std::shared_ptr<session<tcp>>> {
+    const auto selected = select_peers();
+
+    std::vector<std::shared_ptr<session<tcp>>> detached;
+
+    for(auto it = mapping.begin(); it != mapping.end(); /***/) {
+        const auto uuid = it++->first;
+
+        if(selected.count(uuid) == 0) {
+            if(auto session = unlink(mapping, uuid)) {
+                detached.push_back(session);
+            }
+        }
+    }
+
+    for(auto it = selected.begin(); it != selected.end(); ++it) {
+        link(mapping, *it, m_known.at(*it));
+    }
+
+    COCAINE_LOG_DEBUG(m_log, "linked {:d} peer(s) out of {:d} known node(s)", mapping.size(), m_known.size());
+
+    return detached;
+}
+
+auto
+locator_t::select_peers() const -> std::set<std::string> {
+    std::set<std::string> selected;
+
+    if(m_known.empty()) {
+        return selected;
+    }
+
+    // The successor of this node on the ring of uuids. Links are bidirectional, so as long as all
+    // the nodes agree on the membership, these links alone keep the whole cluster connected.
+    const auto successor = m_known.upper_bound(m_cfg.uuid);
+
+    selected.insert(successor != m_known.end() ? successor->first : m_known.begin()->first);
+
+    // The rest are picked by rendezvous hashing over both uuids, which scatters them randomly but
+    // stably across the ring, keeping the number of hops between any two nodes logarithmic.
+    std::vector<std::pair<std::size_t, std::string>> scores;
+
+    for(auto it = m_known.begin(); it != m_known.end(); ++it) {
+        scores.emplace_back(std::hash<std::string>()(m_cfg.uuid + it->first), it->first);
+    }
+
+    std::sort(scores.begin(), scores.end(), std::greater<std::pair<std::size_t, std::string>>());
+
+    for(auto it = scores.begin(); it != scores.end() && selected.size() < m_cfg.fanout; ++it) {
+        selected.insert(it->second);
+    }
+
+    return selected;
+}
+
+void
+locator_t::connect_pending(client_map_t& mapping) {
+    while(m_connecting < m_cfg.max_connects && !m_connect_queue.empty()) {
+        const auto uuid = m_connect_queue.front();
+        m_connect_queue.pop_front();
+
+        auto it = mapping.find(uuid);
+
+        // The node might have been dropped while waiting in the queue.
+        if(it != mapping.end() && it->second.state == uplink_t::states::queued) {
+            connect(mapping, uuid);
+        }
+    }
+}
+
+void
+locator_t::connect(client_map_t& mapping, const std::string& uuid) {
+    auto& uplink = mapping.at(uuid);
+    auto  socket = std::make_shared<tcp::socket>(m_asio);
+
+    uplink.socket = socket;
+    transition(uplink, uplink_t::states::connecting);
+
+    m_connecting++;
+
+    const auto started = std::chrono::steady_clock::now();
+
+    asio::async_connect(*socket, uplink.endpoints.begin(), uplink.endpoints.end(),
+        [=](const std::error_code& ec, std::vector<tcp::endpoint>::const_iterator endpoint)
+    {
+        const holder_t scoped(*m_log, {{"uuid", uuid}});
+
+        auto session = m_clients.apply(
+            [&](client_map_t& mapping) -> std::shared_ptr<cocaine::session<tcp>>
+        {
+            m_connecting--;
+
+            auto it = mapping.find(uuid);
+
+            if(it == mapping.end() || it->second.socket != socket) {
+                COCAINE_LOG_ERROR(m_log, "remote disappeared while connecting");
+                return nullptr;
+            }
+
+            auto& uplink = it->second;
+
+            uplink.socket = nullptr;
+
+            if(ec) {
+                COCAINE_LOG_ERROR(m_log, "unable to connect to remote: [{:d}] {}", ec.value(), ec.message());
+                reconnect(mapping, uuid);
+                return nullptr;
+            }
+
+            COCAINE_LOG_DEBUG(m_log, "connected to remote via {}", *endpoint);
+
+            // Uniquify the socket object.
+            auto ptr = std::make_unique<tcp::socket>(std::move(*socket));
+
+            try {
+                uplink.ptr = m_context.engine().attach(std::move(ptr), nullptr);
+            } catch (const std::system_error& err) {
+                COCAINE_LOG_ERROR(m_log, "unable to set up remote client: {}", error::to_string(err));
+                reconnect(mapping, uuid);
+                return nullptr;
+            }
+
+            uplink.failures = 0;
+            transition(uplink, uplink_t::states::connected);
+
+            // Let the gateway know how responsive this node is.
+            m_gateway->feedback(uuid, std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - started));
+
+            return uplink.ptr;
+        });
+
+        // The connection slot is free now, so let the next node in the queue have it.
+        m_clients.apply([this](client_map_t& mapping) { connect_pending(mapping); });
+
+        // Something went wrong in the session creation code above, bail out.
+        if(!session) return;
+
+        if(m_cfg.topology == locator_cfg_t::topologies::mesh) {
+            auto upstream = session->fork(std::make_shared<mesh_sink_t>(this, uuid));
+
+            m_clients.apply([&](client_map_t& mapping) {
+                auto it = mapping.find(uuid);
+
+                // The peer might have been unlinked in the meantime.
+                if(it == mapping.end() || it->second.ptr != session) {
+                    return;
+                }
+
+                m_remotes.apply([&](remote_map_t&) {
+                    try {
+                        upstream->send<locator::mesh>(m_cfg.uuid, versions());
+                    } catch(const std::system_error& e) {
+                        COCAINE_LOG_ERROR(m_log, "unable to set up mesh link: {}", error::to_string(e));
+                        return;
+                    }
+
+                    m_mesh.outgoing[uuid] = upstream;
+                });
+            });
+
+            return;
+        }
+
+        auto upstream = session->fork(std::make_shared<connect_sink_t>(this, uuid));
+
+        try {
+            upstream->send<locator::connect>(m_cfg.uuid);
+        } catch(const std::system_error& e) {
+            COCAINE_LOG_ERROR(m_log, "unable to set up remote stream: {}", error::to_string(e));
+
+            m_clients.apply([&](client_map_t& mapping) {
+                auto it = mapping.find(uuid);
+
+                if(it != mapping.end()) {
+                    forget(mapping, it);
+                }
+            });
+        }
+    });
+
+    COCAINE_LOG_INFO(m_log, "setting up remote client, trying {:d} route(s)", uplink.endpoints.size(), attribute_list({
+        {"uuid", uuid}
+    }));
+}
+
+void
+locator_t::reconnect(client_map_t& mapping, const std::string& uuid) {
+    auto& uplink = mapping.at(uuid);
+
+    uplink.failures++;
+
+    // Exponential back-off with equal jitter: the delay is drawn from [d/2, d], where d doubles
+    // with every consecutive failure until it hits the upper bound.
+    const auto lower = m_cfg.backoff_min.total_milliseconds();
+    const auto upper = m_cfg.backoff_max.total_milliseconds();
+
+    auto delay = lower;
+
+    for(unsigned i = 1; i < uplink.failures && delay < upper; ++i) {
+        delay *= 2;
+    }
+
+    delay = std::min(delay, upper);
+    delay = std::uniform_int_distribution<decltype(delay)>(delay / 2, delay)(m_random);
+
+    auto timer = std::make_shared<asio::deadline_timer>(m_asio);
+
+    uplink.timer = timer;
+    transition(uplink, uplink_t::states::backoff);
+
+    COCAINE_LOG_INFO(m_log, "retrying to connect to remote in {:d} ms after {:d} failure(s)",
+        delay,
+        uplink.failures);
+
+    timer->expires_from_now(boost::posix_time::milliseconds(delay));
+    timer->async_wait([=](const std::error_code& ec) {
+        if(ec == asio::error::operation_aborted) {
+            return;
+        }
+
+        m_clients.apply([&](client_map_t& mapping) {
+            auto it = mapping.find(uuid);
+
+            // The node might have been dropped or relinked in the meantime.
+            if(it == mapping.end() || it->second.timer != timer) {
+                return;
+            }
+
+            it->second.timer = nullptr;
+            transition(it->second, uplink_t::states::queued);
+
+            m_connect_queue.push_back(uuid);
+            connect_pending(mapping);
+        });
+    });
+}
+
+void
+locator_t::probe() {
+    m_probe_timer.expires_from_now(m_cfg.probe_interval);
+    m_probe_timer.async_wait([this](const std::error_code& ec) {
+        // The timer is only cancelled on shutdown, when the locator might be already gone.
+        if(ec == asio::error::operation_aborted) {
+            return;
+        }
+
+        m_clients.apply([this](client_map_t& mapping) {
+            for(auto it = mapping.begin(); it != mapping.end(); ++it) {
+                if(it->second.state != uplink_t::states::connected || !it->second.ptr) {
+                    continue;
+                }
+
+                try {
+                    it->second.ptr->fork(std::make_shared<probe_sink_t>(this, it->first))
+                        ->send<locator::resolve>(m_cfg.name, std::string());
+                } catch(const std::system_error& e) {
+                    COCAINE_LOG_DEBUG(m_log, "unable to probe remote client: {}", error::to_string(e),
+                        attribute_list({{"uuid", it->first}}));
+                }
+            }
+
+            probe();
+        });
+    });
+}
+
+void
+locator_t::transition(uplink_t& uplink, uplink_t::states state) {
+    --(*m_metrics->peers[static_cast<int>(uplink.state)].get());
+    ++(*m_metrics->peers[static_cast<int>(state)].get());
+    ++(*m_metrics->transitions[static_cast<int>(state)].get());
+
+    uplink.state = state;
+}
+
+void
+locator_t::forget(client_map_t& mapping, client_map_t::iterator it) {
+    --(*m_metrics->peers[static_cast<int>(it->second.state)].get());
+
+    mapping.erase(it);
+}
+
 std::string
 locator_t::uuid() const {
     return m_cfg.uuid;
 }
 
-results::resolve
+results::packed_resolve
 locator_t::on_resolve(const std::string& name, const std::string& seed) const {
-    const auto remapped = m_rgs.apply([&](const rg_map_t& mapping) -> std::string {
-        if(!mapping.count(name)) {
+    const auto remapped = [&]() -> std::string {
+        const auto mapping = m_rgs.load();
+        const auto it = mapping->find(name);
+
+        if(it == mapping->end()) {
             return name;
         } else {
-            return seed.empty() ? mapping.at(name).get() : mapping.at(name).get(seed);
+            return seed.empty() ? it->second->routing->get() : it->second->routing->get(seed);
         }
-    });
+    }();
 
     const holder_t scoped(*m_log, {{"service", remapped}});
 
     // If we don't have gateway or it resolves only remote services try to lookup service locally
     // first.
     if(!m_gateway || m_gateway->resolve_policy() == api::gateway_t::resolve_policy_t::remote_only) {
+        const auto cache = m_cache.load();
+        const auto cached = cache->find(remapped);
+
+        if(cached != cache->end()) {
+            COCAINE_LOG_DEBUG(m_log, "providing service using local actor");
+            return cached->second;
+        }
+
+        // NOTE: Context signals are delivered asynchronously, so the service might not be in the
+        // cache yet even if it's already in the context.
         const auto provided = m_context.locate(remapped);
         if(provided) {
             COCAINE_LOG_DEBUG(m_log, "providing service using local actor");
-            return results::resolve {
+            return results::packed_resolve(results::resolve {
                 provided->endpoints,
                 provided->prototype->version(),
                 provided->prototype->root()
-            };
+            });
         }
     }
 
@@ -526,11 +1375,11 @@ locator_t::on_resolve(const std::string& name, const std::string& seed) const {
     }
 
     auto provided = m_gateway->resolve(remapped);
-    return results::resolve {
+    return results::packed_resolve(results::resolve {
         std::move(provided.endpoints),
         std::move(provided.version),
         std::move(provided.protocol)
-    };
+    });
 }
 
 auto
@@ -560,64 +1409,470 @@ locator_t::on_connect(const std::string& uuid) -> streamed<results::connect> {
     return stream;
 }
 
-void
-locator_t::on_refresh(const std::vector<std::string>& groups) {
-    typedef std::vector<std::string> ruid_vector_t;
+auto
+locator_t::on_mesh(const std::string& uuid, const results::mesh_versions& versions, std::uint64_t id)
+    -> streamed<results::mesh>
+{
+    streamed<results::mesh> stream;
 
-    const auto storage = api::storage(m_context, "core");
-    const auto updated = storage->find("groups", std::vector<std::string>({"group", "active"})).get();
+    const holder_t scoped(*m_log, {{"uuid", uuid}});
 
-    m_rgs.apply([&](rg_map_t& original) {
-        // Make a deep copy of the original routing group mapping to use as the accumulator, for
-        // guaranteed atomicity of routing group updates.
-        rg_map_t clone = original;
+    auto mapping = m_remotes.synchronize();
 
-        original = std::move(std::accumulate(groups.begin(), groups.end(), std::ref(clone),
-            [&](rg_map_t& result, const std::string& group) -> std::reference_wrapper<rg_map_t>
-        {
-            const holder_t scoped(*m_log, {{"rg", group}});
+    if(!m_cluster || m_cfg.topology != locator_cfg_t::topologies::mesh) {
+        // Nodes in the full topology are linked by every other node directly.
+        stream.close();
+        return stream;
+    }
+
+    COCAINE_LOG_INFO(m_log, "attaching incoming mesh link");
 
-            result.erase(group);
+    m_mesh.incoming[uuid] = std::make_pair(id, stream);
+
+    // Let the peer know what this node knows, and catch it up at once. Whatever it knows better
+    // is sent back in response to the version vector.
+    stream.write(this->versions(), lacking(versions));
+    return stream;
+}
 
-            if(std::find(updated.begin(), updated.end(), group) == updated.end()) {
-                COCAINE_LOG_INFO(m_log, "removing routing group");
+void
+locator_t::on_mesh_update(const std::string& uuid, const results::mesh_versions& versions,
+                          results::mesh_states&& states)
+{
+    const holder_t scoped(*m_log, {{"uuid", uuid}});
 
-                // There's no routing group with this name in the storage anymore, so do nothing.
-                return std::ref(result);
+    m_remotes.apply([&](remote_map_t&) {
+        if(!versions.empty()) {
+            const auto update = lacking(versions);
+
+            if(!update.empty()) {
+                reply(uuid, results::mesh_versions(), update);
             }
+        }
 
-            try {
-                COCAINE_LOG_INFO(m_log, "updating routing group");
-
-                result.insert(std::make_pair(group, continuum_t(
-                    std::make_unique<blackhole::wrapper_t>(*m_log, blackhole::attributes_t()),
-                    storage->get<continuum_t::stored_type>("groups", group).get())));
-            } catch(const std::system_error& e) {
-                COCAINE_LOG_ERROR(m_log, "unable to pre-load routing group data for update: {}",
-                    error::to_string(e));
-                throw std::system_error(error::routing_storage_error);
+        bool gap = false;
+
+        const auto accepted = merge(std::move(states), gap);
+
+        if(gap) {
+            COCAINE_LOG_DEBUG(m_log, "remote peer sent out of order service state deltas, requesting full states");
+
+            // The peer sends back full service states of whatever this node lags behind in.
+            reply(uuid, this->versions(), results::mesh_states());
+        }
+
+        if(accepted.empty()) {
+            return;
+        }
+
+        const auto joined = boost::algorithm::join(accepted | boost::adaptors::map_keys, ", ");
+
+        COCAINE_LOG_DEBUG(m_log, "remote peer updated service state(s) of {:d} node(s): {}", accepted.size(), joined);
+
+        // Pass the updates further, except back to where they came from. Nodes that have already
+        // got them via other paths will just ignore them.
+        broadcast(accepted, uuid);
+    });
+}
+
+auto
+locator_t::versions() const -> results::mesh_versions {
+    results::mesh_versions result;
+
+    for(auto it = m_mesh.origins.begin(); it != m_mesh.origins.end(); ++it) {
+        result.insert({it->first, it->second.version});
+    }
+
+    result[m_cfg.uuid] = m_mesh.version;
+
+    return result;
+}
+
+auto
+locator_t::lacking(const results::mesh_versions& versions) const -> results::mesh_states {
+    results::mesh_states result;
+
+    const auto newer = [&](const std::string& uuid, std::uint64_t version) -> bool {
+        const auto it = versions.find(uuid);
+        return it == versions.end() || it->second < version;
+    };
+
+    if(newer(m_cfg.uuid, m_mesh.version)) {
+        result.insert({m_cfg.uuid, std::make_tuple(m_mesh.version, std::uint64_t(0), m_snapshots)});
+    }
+
+    for(auto it = m_mesh.origins.begin(); it != m_mesh.origins.end(); ++it) {
+        if(it->second.active && newer(it->first, it->second.version)) {
+            result.insert({it->first, std::make_tuple(it->second.version, std::uint64_t(0),
+                it->second.services)});
+        }
+    }
+
+    return result;
+}
+
+auto
+locator_t::merge(results::mesh_states&& states, bool& gap) -> results::mesh_states {
+    results::mesh_states accepted;
+
+    for(auto it = states.begin(); it != states.end(); ++it) {
+        const auto version = std::get<0>(it->second);
+        const auto base    = std::get<1>(it->second);
+
+        // This node is the only source of truth about itself.
+        if(it->first == m_cfg.uuid) {
+            continue;
+        }
+
+        auto origin = m_mesh.origins.find(it->first);
+
+        const std::uint64_t known = origin != m_mesh.origins.end() ? origin->second.version : 0;
+
+        if(known >= version) {
+            ++(*m_metrics->mesh_ignored.get());
+            continue;
+        }
+
+        if(base != 0 && base != known) {
+            // Some earlier delta has been missed, so this one can't be applied.
+            gap = true;
+            continue;
+        }
+
+        ++(*m_metrics->mesh_accepted.get());
+
+        if(origin == m_mesh.origins.end()) {
+            origin = m_mesh.origins.insert({it->first, origin_t{
+                0, service_map_t(), true, asio::deadline_timer::time_type()
+            }}).first;
+        }
+
+        auto services = base != 0 ?
+            patch(origin->second.services, std::get<2>(it->second)) :
+            std::move(std::get<2>(it->second));
+
+        if(origin->second.active) {
+            expose(it->first, origin->second.services, services);
+        }
+
+        // Peers are passed only what has changed since the state known to this node, which is a
+        // full state if this node knew nothing about the origin.
+        accepted.insert({it->first, std::make_tuple(version, known, diff(origin->second.services, services))});
+
+        origin->second.version = version;
+        origin->second.services = std::move(services);
+    }
+
+    return accepted;
+}
+
+void
+locator_t::broadcast(const results::mesh_states& states, const std::string& except) {
+    // Packed once for all the links of each kind.
+    const results::packed_mesh chunk(results::mesh_versions(), states);
+    const results::packed_mesh_update update(results::mesh_versions(), states);
+
+    for(auto it = m_mesh.incoming.begin(); it != m_mesh.incoming.end(); /***/) {
+        if(it->first == except) {
+            it++;
+        } else if(auto ec = it->second.second.write(chunk)) {
+            COCAINE_LOG_WARNING(m_log, "unable to enqueue service updates for peer '{}': [{:d}] {}",
+                it->first,
+                ec.value(), ec.message());
+            it = m_mesh.incoming.erase(it);
+        } else {
+            it++;
+        }
+    }
+
+    for(auto it = m_mesh.outgoing.begin(); it != m_mesh.outgoing.end(); /***/) {
+        if(it->first == except) {
+            it++;
+            continue;
+        }
+
+        try {
+            it->second->send<locator::mesh::update>(update);
+            it++;
+        } catch(const std::system_error& e) {
+            COCAINE_LOG_WARNING(m_log, "unable to send service updates to peer '{}': {}",
+                it->first,
+                error::to_string(e));
+            it = m_mesh.outgoing.erase(it);
+        }
+    }
+}
+
+void
+locator_t::reply(const std::string& uuid, const results::mesh_versions& versions, const results::mesh_states& states) {
+    auto outgoing = m_mesh.outgoing.find(uuid);
+
+    if(outgoing != m_mesh.outgoing.end()) try {
+        outgoing->second->send<locator::mesh::update>(versions, states);
+        return;
+    } catch(const std::system_error& e) {
+        COCAINE_LOG_WARNING(m_log, "unable to send service updates to peer '{}': {}", uuid, error::to_string(e));
+        m_mesh.outgoing.erase(outgoing);
+    }
+
+    auto incoming = m_mesh.incoming.find(uuid);
+
+    if(incoming == m_mesh.incoming.end()) {
+        return;
+    }
+
+    if(auto ec = incoming->second.second.write(versions, states)) {
+        COCAINE_LOG_WARNING(m_log, "unable to enqueue service updates for peer '{}': [{:d}] {}",
+            uuid,
+            ec.value(), ec.message());
+        m_mesh.incoming.erase(incoming);
+    }
+}
+
+void
+locator_t::expire() {
+    if(m_expiration_armed) {
+        return;
+    }
+
+    auto deadline = asio::deadline_timer::time_type(boost::posix_time::pos_infin);
+
+    for(auto it = m_mesh.origins.begin(); it != m_mesh.origins.end(); ++it) {
+        if(!it->second.active) {
+            deadline = std::min(deadline, it->second.expires);
+        }
+    }
+
+    if(deadline.is_pos_infinity()) {
+        return;
+    }
+
+    m_expiration_armed = true;
+
+    m_expiration_timer.expires_at(deadline);
+    m_expiration_timer.async_wait([this](const std::error_code& ec) {
+        if(ec == asio::error::operation_aborted) {
+            return;
+        }
+
+        m_remotes.apply([this](remote_map_t&) {
+            m_expiration_armed = false;
+
+            const auto now = asio::deadline_timer::traits_type::now();
+
+            for(auto it = m_mesh.origins.begin(); it != m_mesh.origins.end(); /***/) {
+                if(!it->second.active && it->second.expires <= now) {
+                    COCAINE_LOG_DEBUG(m_log, "forgetting service state of dropped node", attribute_list({
+                        {"uuid", it->first}
+                    }));
+
+                    it = m_mesh.origins.erase(it);
+                } else {
+                    it++;
+                }
             }
 
-            return std::ref(result);
-        }).get());
+            expire();
+        });
     });
+}
 
-    const auto ruids = boost::accumulate(*m_routers.synchronize(), ruid_vector_t{},
-        [](ruid_vector_t result, const router_map_t::value_type& value) -> ruid_vector_t
-    {
-        result.push_back(value.first); return result;
+void
+locator_t::expose(const std::string& uuid, const service_map_t& before, const service_map_t& after) {
+    if(!m_gateway) {
+        return;
+    }
+
+    // Protocol graphs are not compared, they only change along with the service endpoints.
+    const auto changed = [](const results::resolve& lhs, const results::resolve& rhs) -> bool {
+        return std::get<0>(lhs) != std::get<0>(rhs) || std::get<1>(lhs) != std::get<1>(rhs);
+    };
+
+    // Removed services have no endpoints, changed ones are replaced as a whole.
+    std::map<std::string, api::gateway_t::service_description_t> services;
+
+    for(auto it = before.begin(); it != before.end(); ++it) {
+        if(!after.count(it->first)) {
+            services[it->first] = api::gateway_t::service_description_t();
+        }
+    }
+
+    for(auto it = after.begin(); it != after.end(); ++it) {
+        const auto prev = before.find(it->first);
+
+        if(prev == before.end() || changed(prev->second, it->second)) {
+            services[it->first] = api::gateway_t::service_description_t{
+                std::get<0>(it->second),
+                std::get<2>(it->second),
+                std::get<1>(it->second)
+            };
+        }
+    }
+
+    if(services.empty()) {
+        return;
+    }
+
+    try {
+        m_gateway->update(uuid, services);
+    } catch(const std::system_error& e) {
+        COCAINE_LOG_WARNING(m_log, "unable to expose remote services: {}", error::to_string(e), attribute_list({
+            {"uuid", uuid}
+        }));
+    }
+}
+
+void
+locator_t::on_refresh(const std::vector<std::string>& groups) {
+    const auto storage = api::storage(m_context, "core");
+    const auto updated = storage->find("groups", std::vector<std::string>({"group", "active"})).get();
+
+    // Only one refresh at a time, but resolving goes on while the routing groups are rebuilt.
+    std::lock_guard<std::mutex> guard(m_rgs_mutex);
+
+    const auto original = m_rgs.load();
+
+    std::vector<std::string> removed;
+    std::vector<std::string> fetched;
+
+    for(auto it = groups.begin(); it != groups.end(); ++it) {
+        if(std::find(updated.begin(), updated.end(), *it) == updated.end()) {
+            removed.push_back(*it);
+        } else {
+            fetched.push_back(*it);
+        }
+    }
+
+    // Fetch all the routing group definitions at once, so that the storage could serve them
+    // concurrently.
+    std::vector<std::future<routing_group_t::stored_type>> futures;
+
+    for(auto it = fetched.begin(); it != fetched.end(); ++it) {
+        futures.push_back(storage->get<routing_group_t::stored_type>("groups", *it));
+    }
+
+    std::vector<routing_group_t::stored_type> definitions(fetched.size());
+
+    for(size_t i = 0; i < fetched.size(); ++i) try {
+        definitions[i] = futures[i].get();
+    } catch(const std::system_error& e) {
+        const holder_t scoped(*m_log, {{"rg", fetched[i]}});
+
+        COCAINE_LOG_ERROR(m_log, "unable to pre-load routing group data for update: {}",
+            error::to_string(e));
+        throw std::system_error(error::routing_storage_error);
+    }
+
+    // Skip the routing groups that haven't changed since the last refresh.
+    std::vector<size_t> changed;
+
+    for(size_t i = 0; i < fetched.size(); ++i) {
+        const auto it = original->find(fetched[i]);
+
+        if(it == original->end() || it->second->group != definitions[i]) {
+            changed.push_back(i);
+        } else {
+            COCAINE_LOG_DEBUG(m_log, "routing group is up to date", {{"rg", fetched[i]}});
+        }
+    }
+
+    // Rebuild the changed routing groups in parallel.
+    std::vector<std::shared_ptr<const rg_t>> rebuilt(changed.size());
+    std::vector<std::exception_ptr> errors(changed.size());
+
+    parallel_for(changed.size(), [&](size_t i) {
+        const auto& group = fetched[changed[i]];
+
+        const holder_t scoped(*m_log, {{"rg", group}});
+
+        COCAINE_LOG_INFO(m_log, "updating routing group");
+
+        try {
+            const auto it = m_cfg.algorithms.find(group);
+
+            rebuilt[i] = std::make_shared<rg_t>(
+                std::make_unique<blackhole::wrapper_t>(*m_log, blackhole::attributes_t()),
+                std::move(definitions[changed[i]]),
+                it != m_cfg.algorithms.end() ? it->second : m_cfg.algorithm,
+                m_cfg.hash);
+        } catch(...) {
+            errors[i] = std::current_exception();
+        }
     });
 
-    for(auto it = ruids.begin(); it != ruids.end(); ++it) try {
-        on_routing(*it);
+    for(size_t i = 0; i < changed.size(); ++i) try {
+        if(errors[i]) std::rethrow_exception(errors[i]);
     } catch(const std::system_error& e) {
-        COCAINE_LOG_WARNING(m_log, "unable to enqueue routing updates for router '{}': {}",
-            *it,
+        const holder_t scoped(*m_log, {{"rg", fetched[changed[i]]}});
+
+        COCAINE_LOG_ERROR(m_log, "unable to pre-load routing group data for update: {}",
             error::to_string(e));
-        m_routers->erase(*it);
+        throw std::system_error(error::routing_storage_error);
+    }
+
+    if(removed.empty() && changed.empty()) {
+        COCAINE_LOG_DEBUG(m_log, "no routing groups have changed");
+        return;
+    }
+
+    // Only the map itself is copied, unchanged routing groups are shared with the original one.
+    auto mapping = std::make_shared<rg_map_t>(*original);
+
+    for(auto it = removed.begin(); it != removed.end(); ++it) {
+        // There's no routing group with this name in the storage anymore, so just drop it.
+        if(mapping->erase(*it)) {
+            COCAINE_LOG_INFO(m_log, "removing routing group", {{"rg", *it}});
+        }
+    }
+
+    for(size_t i = 0; i < changed.size(); ++i) {
+        (*mapping)[fetched[changed[i]]] = std::move(rebuilt[i]);
     }
 
-    COCAINE_LOG_DEBUG(m_log, "enqueued sending routing updates to {:d} router(s)", ruids.size());
+    if(!m_cfg.advertise) {
+        m_rgs.store(std::move(mapping));
+        return;
+    }
+
+    // Only the changed routing groups are sent out to routers, removed ones with empty continuums.
+    results::routing_table delta;
+
+    for(auto it = removed.begin(); it != removed.end(); ++it) {
+        if(original->count(*it)) {
+            delta.insert({*it, {}});
+        }
+    }
+
+    for(size_t i = 0; i < changed.size(); ++i) {
+        delta[fetched[changed[i]]] = mapping->at(fetched[changed[i]])->routing->all();
+    }
+
+    m_rgs.store(std::move(mapping));
+
+    m_rgs_version++;
+    m_rgs_table = boost::none;
+    m_rgs_snapshot = boost::none;
+
+    // Deltas and full tables are serialized once for all the routers.
+    const results::packed_routing_v2 chunk(m_rgs_version, false, delta);
+
+    m_routers_v2.apply([&](router_v2_map_t& routers) {
+        enqueue(*m_log, routers, chunk);
+
+        COCAINE_LOG_DEBUG(m_log, "enqueued sending routing table v{:d} delta of {:d} group(s) to "
+            "{:d} router(s)", m_rgs_version, delta.size(), routers.size());
+    });
+
+    m_routers.apply([&](router_map_t& routers) {
+        if(routers.empty()) {
+            return;
+        }
+
+        enqueue(*m_log, routers, routing_table());
+
+        COCAINE_LOG_DEBUG(m_log, "enqueued sending full routing table v{:d} to {:d} legacy router(s)",
+            m_rgs_version, routers.size());
+    });
 }
 
 results::cluster
@@ -635,28 +1890,66 @@ locator_t::on_cluster() const {
 }
 
 auto
-locator_t::on_routing(const std::string& ruid, bool replace) -> streamed<results::routing> {
-    auto results = results::routing();
-    auto builder = std::inserter(results, results.end());
+locator_t::routing_table() -> const results::packed_routing& {
+    if(!m_rgs_table) {
+        m_rgs_table = results::packed_routing(continuums(*m_rgs.load()));
+    }
 
-    boost::transform(*m_rgs.synchronize(), builder,
-        [](const rg_map_t::value_type& value) -> results::routing::value_type
-    {
-        return {value.first, value.second.all()};
-    });
+    return *m_rgs_table;
+}
+
+auto
+locator_t::on_routing(const std::string& ruid) -> streamed<results::routing> {
+    // Hold the routing group mutex, so that no update could slip in between the snapshot and the
+    // moment the router stream is registered.
+    std::lock_guard<std::mutex> guard(m_rgs_mutex);
+
+    if(!m_cfg.advertise) {
+        throw cocaine::error_t("routing groups are not advertised to routers");
+    }
 
     auto stream = m_routers.apply([&](router_map_t& mapping) -> streamed<results::routing> {
-        if(mapping.count(ruid) == 0 || (replace && mapping.erase(ruid))) {
-            COCAINE_LOG_INFO(m_log, "attaching outgoing stream for router '{}'", ruid);
-        }
+        COCAINE_LOG_INFO(m_log, "attaching outgoing stream for legacy router '{}'", ruid);
 
-        return mapping[ruid];
+        return mapping[ruid] = streamed<results::routing>();
     });
 
-    // NOTE: Even if there's nothing to return, still send out an empty update.
-    if(auto ec = stream.write(results)) {
+    // NOTE: Even if there's nothing to return, still send out an empty routing table.
+    if(auto ec = stream.write(routing_table())) {
+        m_routers->erase(ruid);
         throw std::system_error(ec, format("failed to write to outgoing stream '{}'", ruid));
     }
+
+    return stream;
+}
+
+auto
+locator_t::on_routing_v2(const std::string& ruid) -> streamed<results::routing_v2> {
+    // Hold the routing group mutex, so that no delta could slip in between the snapshot and the
+    // moment the router stream is registered.
+    std::lock_guard<std::mutex> guard(m_rgs_mutex);
+
+    if(!m_cfg.advertise) {
+        throw cocaine::error_t("routing groups are not advertised to routers");
+    }
+
+    if(!m_rgs_snapshot) {
+        m_rgs_snapshot = results::packed_routing_v2(m_rgs_version, true, continuums(*m_rgs.load()));
+    }
+
+    auto stream = m_routers_v2.apply([&](router_v2_map_t& mapping) -> streamed<results::routing_v2> {
+        COCAINE_LOG_INFO(m_log, "attaching outgoing stream for router '{}'", ruid);
+
+        // Reattaching replaces the old stream, the new one starts with a full snapshot.
+        return mapping[ruid] = streamed<results::routing_v2>();
+    });
+
+    // NOTE: Even if there's nothing to return, still send out an empty snapshot.
+    if(auto ec = stream.write(*m_rgs_snapshot)) {
+        m_routers_v2->erase(ruid);
+        throw std::system_error(ec, format("failed to write to outgoing stream '{}'", ruid));
+    }
+
     return stream;
 }
 
@@ -665,6 +1958,16 @@ locator_t::on_service(const std::string& name, const results::resolve& meta, mod
     if(m_gateway) {
         if(mode == modes::exposed) {
             m_gateway->consume(uuid(), name, std::get<1>(meta), std::get<0>(meta), std::get<2>(meta));
+        } else if(mode == modes::updated) {
+            std::map<std::string, api::gateway_t::service_description_t> services;
+
+            services[name] = api::gateway_t::service_description_t{
+                std::get<0>(meta),
+                std::get<2>(meta),
+                std::get<1>(meta)
+            };
+
+            m_gateway->update(uuid(), services);
         } else {
             m_gateway->cleanup(uuid(), name);
         }
@@ -677,30 +1980,117 @@ locator_t::on_service(const std::string& name, const results::resolve& meta, mod
 
     auto mapping = m_remotes.synchronize();
 
+    const auto pending = m_pending.find(name);
+    const auto exposed = pending != m_pending.end() ?
+        !std::get<0>(pending->second).empty() :
+        m_snapshots.count(name) != 0;
+
     if(mode == modes::exposed) {
-        if(m_snapshots.count(name) != 0) {
+        if(exposed) {
             COCAINE_LOG_ERROR(m_log, "duplicate service detected");
             return;
         }
 
-        m_snapshots[name] = meta;
+        m_pending[name] = meta;
+    } else if(mode == modes::updated) {
+        // Replaces both the pending update and the announced state, if any.
+        m_pending[name] = meta;
+    } else if(m_snapshots.count(name) != 0) {
+        m_pending[name] = meta;
     } else {
-        m_snapshots.erase(name);
+        // The service has never been announced, so there's nothing to retract.
+        m_pending.erase(name);
+    }
+
+    if(m_cfg.announce_window.total_milliseconds() == 0) {
+        announce(*mapping);
+        return;
     }
 
-    const auto response = results::connect{m_cfg.uuid, {{name, meta}}};
+    if(!m_announce_armed && !m_pending.empty()) {
+        m_announce_armed = true;
 
-    for(auto it = mapping->begin(); it != mapping->end(); /***/) try {
-        it->second.write(response);
-        it++;
-    } catch(const std::system_error& e) {
-        COCAINE_LOG_WARNING(m_log, "unable to enqueue service updates for locator '{}': {}",
-            it->first,
-            error::to_string(e));
-        it = mapping->erase(it);
+        m_announce_timer.expires_from_now(m_cfg.announce_window);
+        m_announce_timer.async_wait([this](const std::error_code& ec) {
+            // The timer is only cancelled on shutdown, when the locator might be already gone.
+            if(ec == asio::error::operation_aborted) {
+                return;
+            }
+
+            m_remotes.apply([this](remote_map_t& mapping) {
+                m_announce_armed = false;
+                announce(mapping);
+            });
+        });
+    }
+}
+
+void
+locator_t::announce(remote_map_t& mapping) {
+    if(m_pending.empty()) {
+        return;
     }
 
-    COCAINE_LOG_DEBUG(m_log, "enqueued sending service updates to {} locators", mapping->size());
+    for(auto it = m_pending.begin(); it != m_pending.end(); ++it) {
+        if(std::get<0>(it->second).empty()) {
+            m_snapshots.erase(it->first);
+        } else {
+            m_snapshots[it->first] = it->second;
+        }
+    }
+
+    if(m_cfg.topology == locator_cfg_t::topologies::mesh) {
+        const auto base = m_mesh.version++;
+
+        // Peers get only the pending updates on top of the previous version. Those which have
+        // missed some of them ask for the whole local state.
+        results::mesh_states states;
+        states.insert({m_cfg.uuid, std::make_tuple(m_mesh.version, base, m_pending)});
+
+        broadcast(states, std::string());
+    }
+
+    // The whole batch is serialized once for all the remote locators.
+    const results::packed_connect update(m_cfg.uuid, m_pending);
+
+    for(auto it = mapping.begin(); it != mapping.end(); /***/) {
+        if(auto ec = it->second.write(update)) {
+            COCAINE_LOG_WARNING(m_log, "unable to enqueue service updates for locator '{}': [{:d}] {}",
+                it->first,
+                ec.value(), ec.message());
+            it = mapping.erase(it);
+        } else {
+            it++;
+        }
+    }
+
+    ++(*m_metrics->announced_batches.get());
+    (*m_metrics->announced_services.get()) += m_pending.size();
+
+    COCAINE_LOG_DEBUG(m_log, "enqueued sending {:d} service update(s) to {:d} locator(s)",
+        m_pending.size(),
+        mapping.size());
+
+    m_pending.clear();
+}
+
+void
+locator_t::on_local_service(const std::string& name, const results::resolve& meta, modes mode) {
+    {
+        std::lock_guard<std::mutex> guard(m_cache_mutex);
+
+        auto mapping = std::make_shared<cache_map_t>(*m_cache.load());
+
+        mapping->erase(name);
+
+        if(mode != modes::removed) {
+            mapping->insert({name, results::packed_resolve(meta)});
+        }
+
+        m_cache.store(std::move(mapping));
+    }
+
+    on_service(name, meta, mode);
 }
 
 void
@@ -708,24 +2098,49 @@ locator_t::on_context_shutdown() {
     COCAINE_LOG_DEBUG(m_log, "shutting down distributed components");
 
     m_clients.apply([this](client_map_t& mapping) {
+        m_known.clear();
+        m_probe_timer.cancel();
+
         if(mapping.empty()) {
             return;
         } else {
             COCAINE_LOG_DEBUG(m_log, "shutting down {:d} remote client(s)", mapping.size());
         }
 
-        mapping.clear();
+        for(auto it = mapping.begin(); it != mapping.end(); /***/) {
+            if(it->second.timer) {
+                it->second.timer->cancel();
+            }
+
+            forget(mapping, it++);
+        }
+
+        m_connect_queue.clear();
     });
 
     m_remotes.apply([this](remote_map_t& mapping) {
         m_cluster = nullptr;
 
+        for(auto it = m_mesh.incoming.begin(); it != m_mesh.incoming.end(); ++it) {
+            it->second.second.close();
+        }
+
+        m_mesh.incoming.clear();
+        m_mesh.outgoing.clear();
+
+        m_expiration_timer.cancel();
+
         if(mapping.empty()) {
             return;
         } else {
             COCAINE_LOG_DEBUG(m_log, "closing {:d} outgoing locator streams", mapping.size());
         }
 
+        // Pending service updates are dropped, remote locators will get rid of all the services
+        // from this node anyway.
+        m_announce_timer.cancel();
+        m_pending.clear();
+
         boost::for_each(mapping | boost::adaptors::map_values, [](streamed<results::connect>& s) {
             s.close();
         });
@@ -735,7 +2150,7 @@ locator_t::on_context_shutdown() {
         if(mapping.empty()) {
             return;
         } else {
-            COCAINE_LOG_DEBUG(m_log, "closing {:d} outgoing routing streams", mapping.size());
+            COCAINE_LOG_DEBUG(m_log, "closing {:d} outgoing legacy routing streams", mapping.size());
         }
 
         boost::for_each(mapping | boost::adaptors::map_values, [](streamed<results::routing>& s) {
@@ -743,5 +2158,17 @@ locator_t::on_context_shutdown() {
         });
     });
 
+    m_routers_v2.apply([this](router_v2_map_t& mapping) {
+        if(mapping.empty()) {
+            return;
+        } else {
+            COCAINE_LOG_DEBUG(m_log, "closing {:d} outgoing routing streams", mapping.size());
+        }
+
+        boost::for_each(mapping | boost::adaptors::map_values, [](streamed<results::routing_v2>& s) {
+            s.close();
+        });
+    });
+
     m_signals = nullptr;
 }
@@ -21,11 +21,17 @@
 #include "cocaine/detail/service/locator/routing.hpp"
 #include "cocaine/errors.hpp"
 #include "cocaine/logging.hpp"
+#include "cocaine/memory.hpp"
 
 #include <math.h>
 
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <tuple>
+
 #include <boost/range/adaptor/map.hpp>
-#include <boost/range/algorithm/adjacent_find.hpp>
 #include <boost/range/numeric.hpp>
 
 #define PROTOTYPES
@@ -34,51 +40,166 @@
 
 #include <blackhole/logger.hpp>
 
+using namespace cocaine;
 using namespace cocaine::service;
 
-continuum_t::continuum_t(std::unique_ptr<logging::logger_t> log, const stored_type& group):
-    m_log(std::move(log))
+namespace {
+
+typedef routing_group_t::point_type point_type;
+typedef routing_group_t::index_type index_type;
+typedef routing_group_t::hash_type  hash_type;
+
+typedef std::vector<std::tuple<point_type, std::string>> points_type;
+
+union digest_t {
+    char       hashed[16];
+    point_type points[sizeof(hashed) / sizeof(point_type)];
+};
+
+const uint64_t kFNVOffsetBasis = 14695981039346656037ULL;
+const uint64_t kFNVPrime       = 1099511628211ULL;
+const uint64_t kSplitMixGamma  = 0x9E3779B97F4A7C15ULL;
+
+uint64_t
+fnv1a(const void* data, size_t size, uint64_t hash = kFNVOffsetBasis) {
+    auto ptr = static_cast<const unsigned char*>(data);
+
+    for(size_t i = 0; i < size; ++i) {
+        hash = (hash ^ ptr[i]) * kFNVPrime;
+    }
+
+    return hash;
+}
+
+// FNV-1a has a rather poor avalanche on short inputs, so its results are additionally passed
+// through the SplitMix64 finalizer.
+uint64_t
+finalize(uint64_t hash) {
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+
+    return hash ^ (hash >> 31);
+}
+
+unsigned int
+gcd(unsigned int lhs, unsigned int rhs) {
+    return rhs ? gcd(rhs, lhs % rhs) : lhs;
+}
+
+uint64_t
+fingerprint(const std::string& value) {
+    return finalize(fnv1a(value.data(), value.size()));
+}
+
+void
+md5(digest_t& digest, const std::string& value, const size_t* step) {
+    MHASH thread = mhash_init(MHASH_MD5);
+    mhash(thread, value.data(), value.size());
+
+    if(step) {
+        mhash(thread, step, sizeof(*step));
+    }
+
+    mhash_deinit(thread, digest.hashed);
+}
+
+void
+fast(digest_t& digest, const std::string& value, const size_t* step) {
+    uint64_t hash = fnv1a(value.data(), value.size());
+
+    if(step) {
+        hash = fnv1a(step, sizeof(*step), hash);
+    }
+
+    const uint64_t lo = finalize(hash);
+    const uint64_t hi = finalize(hash ^ kSplitMixGamma);
+
+    digest.points[0] = static_cast<point_type>(lo);
+    digest.points[1] = static_cast<point_type>(lo >> 32);
+    digest.points[2] = static_cast<point_type>(hi);
+    digest.points[3] = static_cast<point_type>(hi >> 32);
+}
+
+void
+hash(hash_type type, digest_t& digest, const std::string& value, const size_t* step) {
+    switch(type) {
+    case hash_type::md5:
+        return md5(digest, value, step);
+    case hash_type::fnv1a:
+        return fast(digest, value, step);
+    }
+}
+
+// Ketama algorithm implementation
+
+class continuum_t:
+    public routing_group_t
 {
-    const size_t length = group.size();
-    const double weight = boost::accumulate(group | boost::adaptors::map_values, 0.0f);
+    typedef std::pair<point_type, index_type> element_t;
 
-    COCAINE_LOG_DEBUG(m_log, "populating continuum based on {} group elements, total weight: {:.2f}",
-        length, weight);
+    // The hashring, stored as two parallel arrays of points and indices into the interned names,
+    // laid out in the Eytzinger (breadth-first) order for cache-friendly branchless searching. The
+    // first slot is not part of the tree and holds the lowest point, to wrap around the continuum.
+    std::vector<point_type> m_points;
+    std::vector<index_type> m_indices;
 
-    // Each item in a routing group has its own positive integer weight, so the total weight must
-    // be more than 0.
-    if(!length || weight < std::numeric_limits<double>::epsilon()) {
-        throw cocaine::error_t("the total weight of the routing group must be positive");
+public:
+    continuum_t(std::unique_ptr<logging::logger_t> log, const stored_type& group, hash_type hash);
+
+    virtual
+    points_type
+    all() const;
+
+    virtual
+    size_t
+    footprint() const {
+        return m_points.capacity() * sizeof(point_type) + m_indices.capacity() * sizeof(index_type);
     }
 
-    union digest_t {
-        char       hashed[16];
-        point_type points[sizeof(hashed) / sizeof(point_type)];
-    } digest;
+protected:
+    virtual
+    index_type
+    select(point_type point) const {
+        return m_indices[lookup(point)];
+    }
 
-    auto builder = std::back_inserter(m_elements);
+private:
+    size_t
+    lookup(point_type point) const;
 
-    for(auto it = group.begin(); it != group.end(); ++it) {
-        const double slice = it->second / weight;
+    size_t
+    populate(const std::vector<element_t>& sorted, size_t i, size_t k);
+};
+
+continuum_t::continuum_t(std::unique_ptr<logging::logger_t> log, const stored_type& group, hash_type hash):
+    routing_group_t(std::move(log), group, hash)
+{
+    const size_t length = m_values.size();
+    const double weight = std::accumulate(m_weights.begin(), m_weights.end(), 0.0f);
+
+    COCAINE_LOG_DEBUG(m_log, "populating continuum based on {} group elements, total weight: {:.2f}",
+        length, weight);
+
+    digest_t digest;
+
+    std::vector<element_t> elements;
+
+    for(size_t index = 0; index < length; ++index) {
+        const double slice = m_weights[index] / weight;
 
         // Given a group element with a 100% weight, derive 64 content-based 16-byte hashes and
         // create four 4-byte points, based on those hashes. To support various weights, figure out
         // the proportional number of required hashes for this element.
         const size_t steps = ::lround(slice * (64 * length));
-        const auto&  value = it->first;
+        const auto&  value = m_values[index];
 
         for(size_t step = 0; step < steps; ++step) {
-            MHASH thread = mhash_init(MHASH_MD5);
-            mhash(thread, value.data(), value.size());
-            mhash(thread, &step, sizeof(step));
-            mhash_deinit(thread, digest.hashed);
+            ::hash(m_hash, digest, value, &step);
 
             // Generate four 4-byte points out of a 16-byte hash.
-            std::transform(std::begin(digest.points), std::end(digest.points), builder,
-                [&](const point_type& point) -> element_t
-            {
-                return {point, value};
-            });
+            for(size_t i = 0; i < sizeof(digest.points) / sizeof(point_type); ++i) {
+                elements.emplace_back(digest.points[i], static_cast<index_type>(index));
+            }
         }
 
         COCAINE_LOG_DEBUG(m_log, "added {} quads for {}, weight: {:.2f}%, {}/{}", steps, value,
@@ -87,73 +208,395 @@ continuum_t::continuum_t(std::unique_ptr<logging::logger_t> log, const stored_ty
         );
     }
 
-    // Sort the ring to enable binary searching.
-    std::sort(m_elements.begin(), m_elements.end());
+    // NOTE: An element might get no points at all if its weight is negligible.
+    if(elements.empty()) {
+        throw cocaine::error_t("the routing group continuum must not be empty");
+    }
+
+    // Sort the ring to enable binary searching. Colliding points are ordered by their values, so
+    // that the ring doesn't depend on the sort implementation or the group element order.
+    std::sort(elements.begin(), elements.end(), [this](const element_t& lhs, const element_t& rhs) {
+        return std::tie(lhs.first, m_values[lhs.second]) < std::tie(rhs.first, m_values[rhs.second]);
+    });
 
     COCAINE_LOG_DEBUG(m_log, "resulting continuum population: {:d} points, unique: {}",
-        m_elements.size(),
-        boost::adjacent_find(m_elements) == m_elements.end()
+        elements.size(),
+        std::adjacent_find(elements.begin(), elements.end(),
+            [](const element_t& lhs, const element_t& rhs) { return lhs.first == rhs.first; }
+        ) == elements.end()
     );
 
-    // Prepare the RNG.
-    std::random_device rd; m_rng.seed(rd());
+    m_points.resize(elements.size() + 1);
+    m_indices.resize(elements.size() + 1);
+
+    m_points [0] = elements.front().first;
+    m_indices[0] = elements.front().second;
+
+    populate(elements, 0, 1);
 }
 
-std::string
-continuum_t::get(const std::string& key) const {
-    union digest_t {
-        char       hashed[16];
-        point_type points[sizeof(hashed) / sizeof(point_type)];
-    } digest;
+points_type
+continuum_t::all() const {
+    points_type tuples;
+    tuples.reserve(m_points.size() - 1);
 
-    MHASH thread = mhash_init(MHASH_MD5);
-    mhash(thread, key.data(), key.size());
-    mhash_deinit(thread, digest.hashed);
+    for(size_t k = 1; k < m_points.size(); ++k) {
+        // NOTE: Tuple constructor is explicit for some reason, so have to use full form.
+        tuples.push_back(std::make_tuple(m_points[k], m_values[m_indices[k]]));
+    }
 
-    // Derive the target point by XORing each 4-byte part of the hash.
-    const point_type point = boost::accumulate(digest.points, 0, std::bit_xor<point_type>());
+    std::sort(tuples.begin(), tuples.end(), [](const points_type::value_type& lhs,
+                                               const points_type::value_type& rhs)
+    {
+        return lhs < rhs;
+    });
 
-    // Return the next biggest number on the continuum relative to the hashed value, or the first
-    // continuum element, if the hashed value is above all the other elements in the continuum.
-    auto  it = std::upper_bound(m_elements.begin(), m_elements.end(), point);
-    auto& rv = it != m_elements.end() ? *it : m_elements.front();
+    return tuples;
+}
 
-    COCAINE_LOG_DEBUG(m_log, "hashed key '{}' -> point {:d} mapped to {}, value: {}", key, point,
-        rv.point, rv.value
-    );
+size_t
+continuum_t::lookup(point_type point) const {
+    const size_t length = m_points.size();
 
-    return rv.value;
+    // Find the next biggest point on the continuum relative to the given one. Descending the
+    // implicit tree appends a bit per level to the position, with no branches but the loop one.
+    size_t k = 1;
+
+    while(k < length) {
+        k = 2 * k + (m_points[k] <= point);
+    }
+
+    // Strip the trailing right turns and the last left one to get the position of the lowest point
+    // above the given one. If there's no such point, the position becomes 0, which holds the first
+    // continuum element, as if the continuum was wrapped around.
+    return k >> __builtin_ffsll(~static_cast<unsigned long long>(k));
 }
 
-std::string
-continuum_t::get() const {
-    const point_type point = m_distribution(m_rng);
+// Recursively populates the Eytzinger layout with the sorted elements, so that the in-order
+// traversal of the implicit tree yields the original order.
+size_t
+continuum_t::populate(const std::vector<element_t>& sorted, size_t i, size_t k) {
+    if(k < m_points.size()) {
+        i = populate(sorted, i, 2 * k);
 
-    // Return the next biggest number on the continuum relative to the random value, or the first
-    // continuum element, if the random value is above all the other elements in the continuum.
-    auto  it = std::upper_bound(m_elements.begin(), m_elements.end(), point);
-    auto& rv = it != m_elements.end() ? *it : m_elements.front();
+        m_points [k] = sorted[i].first;
+        m_indices[k] = sorted[i].second;
 
-    COCAINE_LOG_DEBUG(m_log, "randomized keyless point {:d} mapped to {:d}, value: {}", point,
-        rv.point, rv.value
-    );
+        i = populate(sorted, i + 1, 2 * k + 1);
+    }
 
-    return rv.value;
+    return i;
 }
 
-auto
-continuum_t::all() const -> std::vector<std::tuple<point_type, std::string>> {
-    typedef std::vector<std::tuple<point_type, std::string>> result_type;
+// Maglev algorithm implementation
+
+class maglev_t:
+    public routing_group_t
+{
+    // Prime, so that every element's slot permutation covers the whole table.
+    static const uint64_t kTableSize = 65537;
 
-    result_type tuples;
-    tuples.reserve(m_elements.size());
+    std::vector<index_type> m_table;
 
-    std::transform(m_elements.begin(), m_elements.end(), std::back_inserter(tuples),
-        [](const element_t& element) -> result_type::value_type
-    {
-        // NOTE: Tuple constructor is explicit for some reason, so have to use full form.
-        return std::make_tuple(element.point, element.value);
-    });
+public:
+    maglev_t(std::unique_ptr<logging::logger_t> log, const stored_type& group, hash_type hash);
+
+    virtual
+    points_type
+    all() const;
+
+    virtual
+    size_t
+    footprint() const {
+        return m_table.capacity() * sizeof(index_type);
+    }
+
+protected:
+    // Points are mapped onto the table by range, so that the table could be represented as a
+    // continuum. The very last slot would wrap around on the continuum, so it's folded onto the
+    // first one.
+    virtual
+    index_type
+    select(point_type point) const {
+        const uint64_t slot = (static_cast<uint64_t>(point) * kTableSize) >> 32;
+        return m_table[slot == kTableSize - 1 ? 0 : slot];
+    }
+};
+
+const uint64_t maglev_t::kTableSize;
+
+maglev_t::maglev_t(std::unique_ptr<logging::logger_t> log, const stored_type& group, hash_type hash):
+    routing_group_t(std::move(log), group, hash),
+    m_table(kTableSize, std::numeric_limits<index_type>::max())
+{
+    const size_t length = m_values.size();
+    const double maximum = *std::max_element(m_weights.begin(), m_weights.end());
+
+    std::vector<uint64_t> offsets(length), skips(length), next(length, 0);
+    std::vector<double> credits(length, 0.0);
+
+    for(size_t i = 0; i < length; ++i) {
+        const uint64_t fingerprint = ::fingerprint(m_values[i]);
+
+        offsets[i] = fingerprint % kTableSize;
+        skips[i] = finalize(fingerprint) % (kTableSize - 1) + 1;
+    }
+
+    // Elements take turns claiming their next preferred free slot. To support various weights,
+    // every element accumulates credit proportional to its weight on each round, and claims a slot
+    // only when it has enough of it.
+    for(size_t filled = 0; filled < kTableSize;) {
+        for(size_t i = 0; i < length && filled < kTableSize; ++i) {
+            if((credits[i] += m_weights[i] / maximum) < 1.0) {
+                continue;
+            }
+
+            credits[i] -= 1.0;
+
+            uint64_t slot;
+
+            do {
+                slot = (offsets[i] + next[i]++ * skips[i]) % kTableSize;
+            } while(m_table[slot] != std::numeric_limits<index_type>::max());
+
+            m_table[slot] = static_cast<index_type>(i);
+            filled++;
+        }
+    }
+
+    COCAINE_LOG_DEBUG(m_log, "populated maglev table based on {} group elements, {} slots", length,
+        kTableSize);
+}
+
+points_type
+maglev_t::all() const {
+    points_type tuples;
+
+    // Each table slot covers a range of points up to the next slot boundary. Adjacent slots with
+    // the same element are merged into a single continuum point.
+    for(uint64_t slot = 0; slot + 1 < kTableSize; ++slot) {
+        if(slot + 2 < kTableSize && m_table[slot] == m_table[slot + 1]) {
+            continue;
+        }
+
+        const uint64_t boundary = (((slot + 1) << 32) + kTableSize - 1) / kTableSize;
+
+        tuples.push_back(std::make_tuple(static_cast<point_type>(boundary), m_values[m_table[slot]]));
+    }
 
     return tuples;
 }
+
+// Jump consistent hash implementation
+
+class jump_t:
+    public routing_group_t
+{
+    // Upper bound for the number of buckets, each of which is a unit of weight.
+    static const size_t kMaximumBuckets = 1 << 20;
+
+    std::vector<index_type> m_buckets;
+
+public:
+    jump_t(std::unique_ptr<logging::logger_t> log, const stored_type& group, hash_type hash);
+
+    virtual
+    points_type
+    all() const {
+        throw cocaine::error_t("jump routing groups can't be represented as a continuum");
+    }
+
+    virtual
+    size_t
+    footprint() const {
+        return m_buckets.capacity() * sizeof(index_type);
+    }
+
+protected:
+    virtual
+    index_type
+    select(point_type point) const {
+        uint64_t key = finalize(point);
+
+        int64_t bucket = -1;
+        int64_t next   = 0;
+
+        // See "A Fast, Minimal Memory, Consistent Hash Algorithm" by Lamping and Veach.
+        while(next < static_cast<int64_t>(m_buckets.size())) {
+            bucket = next;
+            key = key * 2862933555777941757ULL + 1;
+            next = static_cast<int64_t>((bucket + 1) * (double(1LL << 31) / double((key >> 33) + 1)));
+        }
+
+        return m_buckets[bucket];
+    }
+};
+
+jump_t::jump_t(std::unique_ptr<logging::logger_t> log, const stored_type& group, hash_type hash):
+    routing_group_t(std::move(log), group, hash)
+{
+    // Weights are reduced by their greatest common divisor to keep the number of buckets low.
+    const unsigned int divisor = std::accumulate(m_weights.begin(), m_weights.end(), 0u, &gcd);
+
+    const size_t total = std::accumulate(m_weights.begin(), m_weights.end(), size_t(0)) / divisor;
+
+    if(total > kMaximumBuckets) {
+        throw cocaine::error_t("the routing group weights require too many buckets: {}", total);
+    }
+
+    m_buckets.reserve(total);
+
+    for(size_t i = 0; i < m_values.size(); ++i) {
+        m_buckets.insert(m_buckets.end(), m_weights[i] / divisor, static_cast<index_type>(i));
+    }
+
+    COCAINE_LOG_DEBUG(m_log, "populated jump hash based on {} group elements, {} buckets",
+        m_values.size(), m_buckets.size());
+}
+
+// Weighted rendezvous hashing implementation
+
+class rendezvous_t:
+    public routing_group_t
+{
+    std::vector<uint64_t> m_seeds;
+
+public:
+    rendezvous_t(std::unique_ptr<logging::logger_t> log, const stored_type& group, hash_type hash):
+        routing_group_t(std::move(log), group, hash)
+    {
+        for(auto it = m_values.begin(); it != m_values.end(); ++it) {
+            m_seeds.push_back(fingerprint(*it));
+        }
+    }
+
+    virtual
+    points_type
+    all() const {
+        throw cocaine::error_t("rendezvous routing groups can't be represented as a continuum");
+    }
+
+    virtual
+    size_t
+    footprint() const {
+        return m_seeds.capacity() * sizeof(uint64_t);
+    }
+
+protected:
+    // Picks the element with the highest score of -weight / ln(hash), where hash is uniformly
+    // distributed in (0, 1). See "Weighted Distributed Hash Tables" by Schindelhauer and Schomaker.
+    virtual
+    index_type
+    select(point_type point) const {
+        const uint64_t key = finalize(point);
+
+        size_t result = 0;
+        double maximum = -std::numeric_limits<double>::infinity();
+
+        for(size_t i = 0; i < m_seeds.size(); ++i) {
+            if(!m_weights[i]) {
+                continue;
+            }
+
+            const double unit  = ((finalize(key ^ m_seeds[i]) >> 11) + 0.5) / double(1ULL << 53);
+            const double score = -static_cast<double>(m_weights[i]) / std::log(unit);
+
+            if(score > maximum) {
+                maximum = score;
+                result  = i;
+            }
+        }
+
+        return static_cast<index_type>(result);
+    }
+};
+
+} // namespace
+
+routing_group_t::routing_group_t(std::unique_ptr<logging::logger_t> log, const stored_type& group,
+                                 hash_type hash):
+    m_log(std::move(log)),
+    m_hash(hash)
+{
+    const size_t length = group.size();
+    const double weight = boost::accumulate(group | boost::adaptors::map_values, 0.0f);
+
+    // Each item in a routing group has its own positive integer weight, so the total weight must
+    // be more than 0.
+    if(!length || weight < std::numeric_limits<double>::epsilon()) {
+        throw cocaine::error_t("the total weight of the routing group must be positive");
+    }
+
+    if(length > std::numeric_limits<index_type>::max()) {
+        throw cocaine::error_t("the routing group must have at most {} elements",
+            std::numeric_limits<index_type>::max());
+    }
+
+    for(auto it = group.begin(); it != group.end(); ++it) {
+        m_values.push_back(it->first);
+        m_weights.push_back(it->second);
+    }
+
+    // Prepare the RNG.
+    std::random_device rd; m_sequence = (static_cast<uint64_t>(rd()) << 32) | rd();
+}
+
+routing_group_t::~routing_group_t() = default;
+
+const std::string&
+routing_group_t::get(const std::string& key) const {
+    digest_t digest;
+
+    ::hash(m_hash, digest, key, nullptr);
+
+    // Derive the target point by XORing each 4-byte part of the hash.
+    const point_type point = boost::accumulate(digest.points, 0, std::bit_xor<point_type>());
+    const auto&      value = m_values[select(point)];
+
+    COCAINE_LOG_DEBUG(m_log, "hashed key '{}' -> point {:d}, value: {}", key, point, value);
+
+    return value;
+}
+
+const std::string&
+routing_group_t::get() const {
+    // Each step of the sequence passed through the finalizer yields a new SplitMix64 output.
+    const uint64_t   random = finalize(m_sequence.fetch_add(kSplitMixGamma, std::memory_order_relaxed));
+    const point_type point  = static_cast<point_type>(random ^ (random >> 32));
+    const auto&      value  = m_values[select(point)];
+
+    COCAINE_LOG_DEBUG(m_log, "randomized keyless point {:d}, value: {}", point, value);
+
+    return value;
+}
+
+namespace cocaine { namespace service {
+
+bool
+is_advertisable(routing_group_t::algorithm_type algorithm) {
+    typedef routing_group_t::algorithm_type algorithm_type;
+
+    return algorithm == algorithm_type::ketama || algorithm == algorithm_type::maglev;
+}
+
+std::unique_ptr<routing_group_t>
+make_routing_group(routing_group_t::algorithm_type algorithm, std::unique_ptr<logging::logger_t> log,
+                   const routing_group_t::stored_type& group, routing_group_t::hash_type hash)
+{
+    typedef routing_group_t::algorithm_type algorithm_type;
+
+    switch(algorithm) {
+    case algorithm_type::ketama:
+        return std::make_unique<continuum_t>(std::move(log), group, hash);
+    case algorithm_type::maglev:
+        return std::make_unique<maglev_t>(std::move(log), group, hash);
+    case algorithm_type::jump:
+        return std::make_unique<jump_t>(std::move(log), group, hash);
+    case algorithm_type::rendezvous:
+        return std::make_unique<rendezvous_t>(std::move(log), group, hash);
+    }
+
+    __builtin_unreachable();
+}
+
+}} // namespace cocaine::service
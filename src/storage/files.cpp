@@ -19,45 +19,575 @@
 */
 
 #include "cocaine/detail/storage/files.hpp"
+#include "cocaine/detail/storage/index.hpp"
+#include "cocaine/detail/storage/record.hpp"
 
 #include "cocaine/context.hpp"
 #include "cocaine/dynamic.hpp"
+#include "cocaine/errors.hpp"
 #include "cocaine/logging.hpp"
 
-#include <boost/filesystem/fstream.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <boost/filesystem/convenience.hpp>
 #include <boost/optional/optional.hpp>
 
 #include <blackhole/logger.hpp>
 
-#include <numeric>
+#include <metrics/accumulator/sliding/window.hpp>
+#include <metrics/registry.hpp>
+#include <metrics/timer.hpp>
+
+#include <array>
+#include <cctype>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace cocaine::storage;
+using namespace cocaine::storage::record;
 
 namespace fs = boost::filesystem;
 
 using blackhole::attribute_list;
 
+struct files_t::metrics_t {
+    struct operation_t {
+        // Operations waiting for a worker, including those waiting for other operations on the
+        // same key to complete.
+        metrics::shared_metric<std::atomic<std::int64_t>> queued;
+
+        // Time from submission till completion.
+        metrics::shared_metric<metrics::timer<metrics::accumulator::sliding::window_t>> timer;
+
+        static
+        operation_t
+        make(context_t& context, const std::string& name, const char* operation) {
+            return operation_t{
+                context.metrics_hub().counter<std::int64_t>(cocaine::format("{}.{}.queued", name, operation)),
+                context.metrics_hub().timer(cocaine::format("{}.{}.timer", name, operation))
+            };
+        }
+    };
+
+    // Indexed by operation type.
+    std::array<operation_t, 4> operations;
+};
+
+namespace {
+
+// Number of strands to spread the keys over. Unrelated keys sharing a strand are serialized, so
+// there should be much more of them than workers.
+const size_t kStrandsPerWorker = 16;
+
+// Objects are written into temporary files named after this pattern, which are then renamed.
+const char kTemporaryPattern[] = ".%%%%-%%%%-%%%%-%%%%.tmp";
+
+// Temporary files of object writes and index rewrites, left behind if those were interrupted.
+bool
+is_leftover(const std::string& name) {
+    if(name == ".index.tmp") {
+        return true;
+    }
+
+    const std::string pattern(kTemporaryPattern);
+
+    if(name.size() != pattern.size()) {
+        return false;
+    }
+
+    for(size_t i = 0; i < name.size(); ++i) {
+        if(pattern[i] == '%' ? !std::isxdigit(static_cast<unsigned char>(name[i])) : pattern[i] != name[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// The index and temporary files share the directory with objects, so their names can't be keys.
+void
+check_key(const std::string& key) {
+    if(key == ".index" || is_leftover(key)) {
+        throw std::system_error(std::make_error_code(std::errc::invalid_argument),
+            cocaine::format("key '{}' is reserved", key));
+    }
+}
+
+// Objects found in the collection directory, with the tags they are linked from. Tag directories
+// are the only subdirectories of a collection, with symlinks to objects.
+std::map<std::string, std::set<std::string>>
+scan(const fs::path& store_path) {
+    std::map<std::string, std::set<std::string>> objects;
+    std::vector<fs::path> tags;
+
+    for(fs::directory_iterator it(store_path), end; it != end; ++it) {
+        const auto name = it->path().filename().native();
+        const auto status = it->symlink_status();
+
+        if(fs::is_directory(status)) {
+            tags.push_back(it->path());
+        } else if(fs::is_regular_file(status) && name != ".index" && !is_leftover(name)) {
+            objects[name];
+        }
+    }
+
+    for(auto tag = tags.begin(); tag != tags.end(); ++tag) {
+        for(fs::directory_iterator it(*tag), end; it != end; ++it) {
+            auto object = objects.find(it->path().filename().native());
+
+            if(object != objects.end()) {
+                object->second.insert(tag->filename().native());
+            }
+        }
+    }
+
+    return objects;
+}
+
+} // namespace
+
+// Group commit: the first writer to arrive waits for the window to collect concurrent writes, then
+// syncs all of them at once, while the others wait for the batch they've joined to complete.
+class files_t::committer_t {
+    const std::chrono::milliseconds window;
+
+    std::mutex mutex;
+    std::condition_variable completed;
+
+    // Descriptors to sync in the batch being collected, along with where to put the results.
+    std::vector<std::pair<int, int*>> pending;
+
+    // The batch being collected and the last synced one.
+    std::uint64_t batch;
+    std::uint64_t synced;
+
+    bool flushing;
+
+public:
+    explicit
+    committer_t(std::chrono::milliseconds window_):
+        window(window_),
+        batch(1),
+        synced(0),
+        flushing(false)
+    { }
+
+    // Returns once the descriptor is synced, with the errno of its fsync() call if it has failed.
+    int
+    commit(int fd) {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        int error = 0;
+        const auto joined = batch;
+
+        pending.emplace_back(fd, &error);
+
+        while(synced < joined) {
+            if(flushing) {
+                completed.wait(lock);
+                continue;
+            }
+
+            flushing = true;
+
+            lock.unlock();
+            std::this_thread::sleep_for(window);
+            lock.lock();
+
+            std::vector<std::pair<int, int*>> entries;
+
+            entries.swap(pending);
+            batch++;
+
+            lock.unlock();
+
+            std::vector<int> results(entries.size());
+
+            for(size_t i = 0; i < entries.size(); ++i) {
+                results[i] = ::fsync(entries[i].first) == 0 ? 0 : errno;
+            }
+
+            lock.lock();
+
+            // The writers are blocked until their batch is synced, so their results are still there.
+            for(size_t i = 0; i < entries.size(); ++i) {
+                *entries[i].second = results[i];
+            }
+
+            synced = batch - 1;
+            flushing = false;
+
+            completed.notify_all();
+        }
+
+        return error;
+    }
+};
+
+std::string
+cocaine::storage::read_object(const fs::path& path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if(fd == -1) {
+        throw make_system_error(path);
+    }
+
+    const descriptor_t descriptor(fd);
+
+    struct stat info;
+
+    if(::fstat(fd, &info) != 0) {
+        throw make_system_error(path);
+    }
+
+    if(S_ISDIR(info.st_mode)) {
+        throw std::system_error(std::make_error_code(std::errc::is_a_directory), path.string());
+    }
+
+    std::string blob(info.st_size, '\0');
+    size_t offset = 0;
+
+    while(offset < blob.size()) {
+        const auto size = ::pread(fd, &blob[offset], blob.size() - offset, offset);
+
+        if(size == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            throw make_system_error(path);
+        }
+
+        if(size == 0) {
+            // The file has been truncated in the meantime.
+            blob.resize(offset);
+            break;
+        }
+
+        offset += size;
+    }
+
+    return blob;
+}
+
 files_t::files_t(context_t& context, const std::string& name, const dynamic_t& args):
     category_type(context, name, args),
     m_log(context.log(name)),
     m_parent_path(args.as_object().at("path").as_string()),
     io_loop(),
     io_work(asio::io_service::work(io_loop)),
-    thread([&](){
-        io_loop.run();
-    })
-{ }
+    m_metrics(new metrics_t{{{
+        metrics_t::operation_t::make(context, name, "read"),
+        metrics_t::operation_t::make(context, name, "write"),
+        metrics_t::operation_t::make(context, name, "remove"),
+        metrics_t::operation_t::make(context, name, "find")
+    }}})
+{
+    const auto workers = std::max<dynamic_t::uint_t>(1, args.as_object().at("workers", 4u).as_uint());
+    const auto durability = args.as_object().at("durability", "none").as_string();
+
+    if(durability == "none") {
+        m_durability = durability_t::none;
+    } else if(durability == "fsync") {
+        m_durability = durability_t::fsync;
+    } else if(durability == "group") {
+        m_durability = durability_t::group;
+        m_committer.reset(new committer_t(std::chrono::milliseconds(
+            args.as_object().at("group_window", 5u).as_uint()
+        )));
+    } else {
+        throw cocaine::error_t("unknown durability mode '{}'", durability);
+    }
+
+    if(args.as_object().at("compact", false).as_bool() && fs::exists(m_parent_path)) {
+        COCAINE_LOG_INFO(m_log, "compacting collections in '{}'", m_parent_path.string());
+
+        for(fs::directory_iterator it(m_parent_path), end; it != end; ++it) {
+            if(fs::is_directory(it->symlink_status())) {
+                compact_sync(it->path().filename().native());
+            }
+        }
+    }
+
+    for(size_t i = 0; i < workers * kStrandsPerWorker; ++i) {
+        m_strands.emplace_back(new asio::io_service::strand(io_loop));
+    }
+
+    for(size_t i = 0; i < workers; ++i) {
+        m_workers.emplace_back([&](){
+            io_loop.run();
+        });
+    }
+
+    COCAINE_LOG_INFO(m_log, "using {:d} worker(s) for '{}' with '{}' durability", workers,
+        m_parent_path.string(), durability);
+}
 
 files_t::~files_t() {
     io_work = boost::none;
-    thread.join();
+
+    for(auto it = m_workers.begin(); it != m_workers.end(); ++it) {
+        it->join();
+    }
+
+    // No operations are in progress anymore, so the indexes match the collections, unless they've
+    // been tainted by failed operations.
+    auto indexes = m_indexes.synchronize();
+
+    for(auto it = indexes->begin(); it != indexes->end(); ++it) {
+        try {
+            it->second.get()->close();
+        } catch(const std::exception& e) {
+            COCAINE_LOG_WARNING(m_log, "unable to close tag index: {}", e.what(),
+                attribute_list({{"collection", it->first}}));
+        }
+    }
+}
+
+auto
+files_t::strand(const std::string& collection, const std::string& key) -> asio::io_service::strand& {
+    std::string id;
+
+    id.reserve(collection.size() + key.size() + 1);
+    id.append(collection).push_back('\0');
+    id.append(key);
+
+    return *m_strands[std::hash<std::string>()(id) % m_strands.size()];
+}
+
+template<class F>
+void
+files_t::spawn(operations operation, asio::io_service::strand* strand, F fn) {
+    auto& stats = m_metrics->operations[static_cast<size_t>(operation)];
+
+    ++(*stats.queued.get());
+
+    auto timer = std::make_shared<metrics::timer_t::context_t>(stats.timer->context());
+
+    auto task = [&stats, timer, fn]() mutable {
+        --(*stats.queued.get());
+
+        fn();
+
+        // Stop the timer before the task is destroyed, whenever that happens.
+        timer.reset();
+    };
+
+    if(strand) {
+        strand->post(std::move(task));
+    } else {
+        io_loop.post(std::move(task));
+    }
+}
+
+auto
+files_t::index(const std::string& collection) -> std::shared_ptr<tag_index_t> {
+    std::promise<std::shared_ptr<tag_index_t>> promise;
+
+    bool opening = false;
+
+    auto future = m_indexes.apply([&](index_map_t& indexes) -> index_map_t::mapped_type {
+        auto it = indexes.find(collection);
+
+        if(it == indexes.end()) {
+            opening = true;
+            it = indexes.insert({collection, promise.get_future().share()}).first;
+        }
+
+        return it->second;
+    });
+
+    if(!opening) {
+        return future.get();
+    }
+
+    try {
+        promise.set_value(open_index(collection));
+    } catch(...) {
+        // Operations waiting for the index fail along with this one, the next ones try again.
+        m_indexes.apply([&](index_map_t& indexes) {
+            indexes.erase(collection);
+        });
+
+        promise.set_exception(std::current_exception());
+    }
+
+    return future.get();
+}
+
+auto
+files_t::open_index(const std::string& collection) -> std::shared_ptr<tag_index_t> {
+    const fs::path store_path(m_parent_path / collection);
+
+    auto index = std::make_shared<tag_index_t>(store_path / ".index", [this](int fd, const fs::path& path) {
+        sync(fd, path);
+    });
+
+    if(index->clean()) {
+        return index;
+    }
+
+    const auto found = scan(store_path);
+
+    std::map<std::string, std::vector<std::string>> objects;
+
+    if(index->exists()) {
+        // Writes interrupted after the object has been renamed into place leave it out of the index,
+        // or with only some of its new tags indexed, but all of them linked. Removals might also be
+        // interrupted before the object is gone.
+        const auto indexed = index->objects();
+
+        for(auto it = found.begin(); it != found.end(); ++it) {
+            std::set<std::string> tags(it->second);
+
+            const auto entry = indexed.find(it->first);
+
+            if(entry != indexed.end()) {
+                tags.insert(entry->second.begin(), entry->second.end());
+            }
+
+            objects[it->first].assign(tags.begin(), tags.end());
+        }
+
+        if(objects == indexed) {
+            return index;
+        }
+
+        COCAINE_LOG_INFO(m_log, "reconciling tag index of {:d} object(s) with {:d} found object(s)",
+            indexed.size(), objects.size(), attribute_list({{"collection", collection}}));
+    } else {
+        for(auto it = found.begin(); it != found.end(); ++it) {
+            objects[it->first].assign(it->second.begin(), it->second.end());
+        }
+
+        COCAINE_LOG_INFO(m_log, "building tag index for {:d} object(s)", objects.size(),
+            attribute_list({{"collection", collection}}));
+    }
+
+    index->reset(objects);
+
+    return index;
+}
+
+void
+files_t::compact_sync(const std::string& collection) {
+    const fs::path store_path(m_parent_path / collection);
+    const auto index = this->index(collection);
+
+    // Objects are those found on disk, as some might have been removed behind the storage's back,
+    // while others might be missing from the index. Symlinks are kept, unless they are dangling.
+    std::map<std::string, std::vector<std::string>> objects;
+
+    {
+        auto found = scan(store_path);
+        const auto indexed = index->objects();
+
+        for(auto it = indexed.begin(); it != indexed.end(); ++it) {
+            auto object = found.find(it->first);
+
+            if(object != found.end()) {
+                object->second.insert(it->second.begin(), it->second.end());
+            }
+        }
+
+        for(auto it = found.begin(); it != found.end(); ++it) {
+            objects[it->first].assign(it->second.begin(), it->second.end());
+        }
+    }
+
+    std::map<std::string, std::set<std::string>> links;
+
+    for(auto it = objects.begin(); it != objects.end(); ++it) {
+        for(auto tag = it->second.begin(); tag != it->second.end(); ++tag) {
+            links[*tag].insert(it->first);
+        }
+    }
+
+    size_t purged = 0, linked = 0;
+
+    const std::vector<fs::path> entries((fs::directory_iterator(store_path)), fs::directory_iterator());
+
+    for(auto entry = entries.begin(); entry != entries.end(); ++entry) {
+        const auto name = entry->filename().native();
+
+        if(fs::is_directory(fs::symlink_status(*entry))) {
+            // Make sure the tag is visited below, so that its directory is removed if unused.
+            links[name];
+        } else if(is_leftover(name) && !objects.count(name)) {
+            COCAINE_LOG_DEBUG(m_log, "removing leftover file '{}'", name,
+                attribute_list({{"collection", collection}}));
+
+            fs::remove(*entry);
+        }
+    }
+
+    for(auto tag = links.begin(); tag != links.end(); ++tag) {
+        const auto tag_path = store_path / tag->first;
+        const bool used = !tag->second.empty();
+
+        // Symlinks which are expected but not found.
+        auto& missing = tag->second;
+
+        if(fs::is_directory(tag_path)) {
+            const std::vector<fs::path> symlinks((fs::directory_iterator(tag_path)), fs::directory_iterator());
+
+            for(auto it = symlinks.begin(); it != symlinks.end(); ++it) {
+                if(missing.erase(it->filename().native()) == 0) {
+                    fs::remove(*it);
+                    purged++;
+                }
+            }
+        }
+
+        if(!used) {
+            // Its symlinks are all purged by now.
+            fs::remove(tag_path);
+            continue;
+        }
+
+        fs::create_directories(tag_path);
+
+        for(auto it = missing.begin(); it != missing.end(); ++it) {
+            fs::create_symlink(store_path / *it, tag_path / *it);
+            linked++;
+        }
+    }
+
+    index->reset(objects);
+
+    COCAINE_LOG_INFO(m_log, "compacted {:d} object(s), purged {:d} and restored {:d} symlink(s)",
+        objects.size(), purged, linked, attribute_list({{"collection", collection}}));
+}
+
+void
+files_t::sync(int fd, const fs::path& path) {
+    int error = 0;
+
+    switch(m_durability) {
+    case durability_t::none:
+        return;
+    case durability_t::fsync:
+        error = ::fsync(fd) == 0 ? 0 : errno;
+        break;
+    case durability_t::group:
+        error = m_committer->commit(fd);
+        break;
+    }
+
+    if(error != 0) {
+        throw std::system_error(std::make_error_code(static_cast<std::errc>(error)), path.string());
+    }
 }
 
 void
 files_t::read(const std::string& collection, const std::string& key, callback<std::string> cb) {
-    io_loop.post([=]() {
+    spawn(operations::read, &strand(collection, key), [=]() {
         try {
             cb(make_ready_future(read_sync(collection, key)));
         } catch (...) {
@@ -73,7 +603,7 @@ files_t::write(const std::string& collection,
                const std::vector<std::string>& tags,
                callback<void> cb)
 {
-    io_loop.post([=]() {
+    spawn(operations::write, &strand(collection, key), [=]() {
         try {
             write_sync(collection, key, blob, tags);
             cb(make_ready_future());
@@ -85,7 +615,7 @@ files_t::write(const std::string& collection,
 
 void
 files_t::remove(const std::string& collection, const std::string& key, callback<void> cb) {
-    io_loop.post([=]() {
+    spawn(operations::remove, &strand(collection, key), [=]() {
         try {
             remove_sync(collection, key);
             cb(make_ready_future());
@@ -97,7 +627,8 @@ files_t::remove(const std::string& collection, const std::string& key, callback<
 
 void
 files_t::find(const std::string& collection, const std::vector<std::string>& tags, callback<std::vector<std::string>> cb) {
-    io_loop.post([=]() {
+    // Finds are not bound to any key, so they run in parallel with everything else.
+    spawn(operations::find, nullptr, [=]() {
         try {
             cb(make_ready_future(find_sync(collection, tags)));
         } catch (...) {
@@ -108,21 +639,13 @@ files_t::find(const std::string& collection, const std::vector<std::string>& tag
 
 std::string
 files_t::read_sync(const std::string& collection, const std::string& key) {
-    const fs::path file_path(m_parent_path / collection / key);
+    check_key(key);
 
-    if(!fs::exists(file_path)) {
-        throw std::system_error(std::make_error_code(std::errc::no_such_file_or_directory), file_path.string());
-    }
+    const fs::path file_path(m_parent_path / collection / key);
 
     COCAINE_LOG_DEBUG(m_log, "reading object '{}'", key, attribute_list({{"collection", collection}}));
 
-    fs::ifstream stream(file_path, fs::ifstream::in | fs::ifstream::binary);
-
-    if(!stream) {
-        throw std::system_error(std::make_error_code(std::errc::permission_denied), file_path.string());
-    }
-
-    return std::string{std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>()};
+    return read_object(file_path);
 }
 
 void
@@ -130,6 +653,8 @@ files_t::write_sync(const std::string& collection,
                     const std::string& key,
                     const std::string& blob,
                     const std::vector<std::string>& tags) {
+    check_key(key);
+
     const fs::path store_path(m_parent_path / collection);
     const auto store_status = fs::status(store_path);
 
@@ -140,40 +665,97 @@ files_t::write_sync(const std::string& collection,
         throw std::system_error(std::make_error_code(std::errc::not_a_directory), store_path.string());
     }
 
+    const auto index = this->index(collection);
+
     const fs::path file_path(store_path / key);
+    const fs::path temp_path(store_path / fs::unique_path(kTemporaryPattern));
 
     COCAINE_LOG_DEBUG(m_log, "writing object '{}'", key, attribute_list({{"collection", collection}}));
 
-    fs::ofstream stream(file_path, fs::ofstream::out | fs::ofstream::trunc | fs::ofstream::binary);
+    {
+        const int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+
+        if(fd == -1) {
+            throw make_system_error(temp_path);
+        }
+
+        const descriptor_t descriptor(fd);
 
-    if (!stream) {
-        throw std::system_error(std::make_error_code(std::errc::permission_denied), file_path.string());
+        try {
+            write_all(fd, blob, temp_path);
+
+            // The data must hit the disk before the file replaces the object, otherwise a crash
+            // might leave an empty object behind.
+            sync(fd, temp_path);
+        } catch(...) {
+            ::unlink(temp_path.c_str());
+            throw;
+        }
+    }
+
+    // Readers see either the old object or the new one, never a partially written one.
+    if(::rename(temp_path.c_str(), file_path.c_str()) != 0) {
+        const auto error = make_system_error(file_path);
+        ::unlink(temp_path.c_str());
+        throw error;
     }
 
-    for (auto it = tags.begin(); it != tags.end(); ++it) {
-        const auto tag_path = store_path / *it;
-        const auto tag_status = fs::status(tag_path);
+    try {
+        if(m_durability != durability_t::none) {
+            // The rename itself is durable only once the directory is synced.
+            const int fd = ::open(store_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
 
-        if (!fs::exists(tag_status)) {
-            fs::create_directory(tag_path);
-        } else if (!fs::is_directory(tag_status)) {
-            throw std::system_error(std::make_error_code(std::errc::not_a_directory), tag_path.string());
+            if(fd == -1) {
+                throw make_system_error(store_path);
+            }
+
+            const descriptor_t descriptor(fd);
+
+            sync(fd, store_path);
         }
 
-        if (fs::is_symlink(tag_path / key)) {
-            continue;
+        // Tags are linked only once the object is in place, so that finds never return objects
+        // which can't be read yet.
+        for (auto it = tags.begin(); it != tags.end(); ++it) {
+            const auto tag_path = store_path / *it;
+            const auto tag_status = fs::status(tag_path);
+
+            if (!fs::exists(tag_status)) {
+                fs::create_directory(tag_path);
+            } else if (!fs::is_directory(tag_status)) {
+                throw std::system_error(std::make_error_code(std::errc::not_a_directory), tag_path.string());
+            }
+
+            if (fs::is_symlink(tag_path / key)) {
+                continue;
+            }
+
+            fs::create_symlink(file_path, tag_path / key);
         }
 
-        fs::create_symlink(file_path, tag_path / key);
-    }
+        const auto previous = index->tags(key);
+
+        index->insert(key, tags);
 
-    stream.write(blob.c_str(), blob.size());
-    stream.close();
+        // Unlink the object from the tags it doesn't have anymore.
+        for(auto it = previous.begin(); it != previous.end(); ++it) {
+            if(std::find(tags.begin(), tags.end(), *it) == tags.end()) {
+                fs::remove(store_path / *it / key);
+            }
+        }
+    } catch(...) {
+        // The object is in place, but it might be linked and indexed only partially.
+        index->taint();
+        throw;
+    }
 }
 
 void
 files_t::remove_sync(const std::string& collection, const std::string& key) {
-    const auto file_path(m_parent_path / collection / key);
+    check_key(key);
+
+    const fs::path store_path(m_parent_path / collection);
+    const fs::path file_path(store_path / key);
 
     if (!fs::exists(file_path)) {
         return;
@@ -181,27 +763,26 @@ files_t::remove_sync(const std::string& collection, const std::string& key) {
 
     COCAINE_LOG_DEBUG(m_log, "removing object '{}'", key, attribute_list({{"collection", collection}}));
 
-    fs::remove(file_path);
-}
-
-namespace {
+    const auto index = this->index(collection);
+    const auto tags = index->tags(key);
 
-struct intersect {
-    template<class T>
-    T
-    operator()(const T& accumulator, T& keys) const {
-        T result;
+    // Dropped from the index first, so that finds never return objects which can't be read.
+    index->erase(key);
 
-        auto builder = std::back_inserter(result);
+    try {
+        fs::remove(file_path);
 
-        std::sort(keys.begin(), keys.end());
-        std::set_intersection(accumulator.begin(), accumulator.end(), keys.begin(), keys.end(), builder);
-
-        return result;
+        // Tag directories themselves are left in place, as concurrent writes might be linking into
+        // them. Empty ones are removed by compaction.
+        for(auto it = tags.begin(); it != tags.end(); ++it) {
+            fs::remove(store_path / *it / key);
+        }
+    } catch(...) {
+        // The object might still be there, but it's not indexed anymore.
+        index->taint();
+        throw;
     }
-};
-
-} // namespace
+}
 
 std::vector<std::string>
 files_t::find_sync(const std::string& collection, const std::vector<std::string>& tags) {
@@ -211,44 +792,5 @@ files_t::find_sync(const std::string& collection, const std::vector<std::string>
         return {};
     }
 
-    std::vector<std::vector<std::string>> result;
-
-    for (auto tag = tags.begin(); tag != tags.end(); ++tag) {
-        auto tagged = result.insert(result.end(), std::vector<std::string>());
-
-        if (!fs::exists(store_path / *tag)) {
-            // If one of the tags doesn't exist, the intersection is evidently empty.
-            return {};
-        }
-
-        fs::directory_iterator it(store_path / *tag), end;
-
-        while (it != end) {
-            const std::string object = it->path().filename().native();
-            if (!fs::exists(*it)) {
-                COCAINE_LOG_DEBUG(m_log, "purging object '{}' from tag '{}'", object, *tag);
-
-                // Remove the symlink if the object was removed.
-                fs::remove(*it++);
-
-                continue;
-            }
-
-            tagged->push_back(object);
-
-            ++it;
-        }
-    }
-
-    std::vector<std::string> initial = std::move(result.back());
-
-    // NOTE: Pop the initial accumulator value from the result queue, so that it
-    // won't be intersected with itself later.
-    result.pop_back();
-
-    // NOTE: Sort the initial accumulator value here once, because it will always
-    // be kept sorted inside the functor by std::set_intersection().
-    std::sort(initial.begin(), initial.end());
-
-    return std::accumulate(result.begin(), result.end(), initial, intersect());
-}
\ No newline at end of file
+    return index(collection)->find(tags);
+}
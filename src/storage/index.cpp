@@ -0,0 +1,489 @@
+/*
+    Copyright (c) 2011-2014 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2014 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cocaine/detail/storage/index.hpp"
+#include "cocaine/detail/storage/record.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace cocaine::storage;
+using namespace cocaine::storage::record;
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+const char kMagic[8] = { 'C', 'O', 'C', 'A', 'I', 'D', 'X', '1' };
+
+// The log is rewritten once it has that many superseded updates and more of them than live ones.
+const std::uint64_t kMinStale = 1024;
+
+enum record_types: std::uint8_t { insert_record = 1, erase_record = 2, close_record = 3 };
+
+// Payloads are [type][key] with [count][tag]... following for inserts. Close records have an empty key.
+std::string
+make_record(record_types type, const std::string& key, const std::vector<std::string>& tags) {
+    std::string payload(1, static_cast<char>(type));
+
+    put(payload, key);
+
+    if(type == insert_record) {
+        put(payload, static_cast<std::uint32_t>(tags.size()));
+
+        for(auto it = tags.begin(); it != tags.end(); ++it) {
+            put(payload, *it);
+        }
+    }
+
+    return frame(payload);
+}
+
+} // namespace
+
+size_t
+tag_map_t::size() const {
+    return m_objects.size();
+}
+
+auto
+tag_map_t::objects() const -> const object_map_type& {
+    return m_objects;
+}
+
+const std::vector<std::string>*
+tag_map_t::tags(const std::string& key) const {
+    const auto it = m_objects.find(key);
+    return it == m_objects.end() ? nullptr : &it->second;
+}
+
+void
+tag_map_t::attach(const std::string& key, std::vector<std::string> tags) {
+    detach(key);
+
+    for(auto it = tags.begin(); it != tags.end(); ++it) {
+        auto& keys = m_tags[*it];
+        keys.insert(std::lower_bound(keys.begin(), keys.end(), key), key);
+    }
+
+    m_objects[key] = std::move(tags);
+}
+
+bool
+tag_map_t::detach(const std::string& key) {
+    const auto object = m_objects.find(key);
+
+    if(object == m_objects.end()) {
+        return false;
+    }
+
+    for(auto it = object->second.begin(); it != object->second.end(); ++it) {
+        const auto list = m_tags.find(*it);
+        auto& keys = list->second;
+
+        keys.erase(std::lower_bound(keys.begin(), keys.end(), key));
+
+        if(keys.empty()) {
+            m_tags.erase(list);
+        }
+    }
+
+    m_objects.erase(object);
+
+    return true;
+}
+
+void
+tag_map_t::clear() {
+    m_objects.clear();
+    m_tags.clear();
+}
+
+std::vector<std::string>
+tag_map_t::find(const std::vector<std::string>& tags) const {
+    std::vector<const std::vector<std::string>*> lists;
+
+    for(auto it = tags.begin(); it != tags.end(); ++it) {
+        const auto list = m_tags.find(*it);
+
+        if(list == m_tags.end()) {
+            // If one of the tags doesn't exist, the intersection is evidently empty.
+            return {};
+        }
+
+        lists.push_back(&list->second);
+    }
+
+    if(lists.empty()) {
+        return {};
+    }
+
+    // Starting with the shortest list keeps intermediate results as small as possible.
+    std::sort(lists.begin(), lists.end(), [](const std::vector<std::string>* lhs,
+                                             const std::vector<std::string>* rhs)
+    {
+        return lhs->size() < rhs->size();
+    });
+
+    std::vector<std::string> result(*lists.front()), buffer;
+
+    for(auto it = lists.begin() + 1; it != lists.end() && !result.empty(); ++it) {
+        buffer.clear();
+
+        std::set_intersection(result.begin(), result.end(), (*it)->begin(), (*it)->end(),
+            std::back_inserter(buffer));
+
+        result.swap(buffer);
+    }
+
+    return result;
+}
+
+void
+tag_map_t::normalize(std::vector<std::string>& tags) {
+    std::sort(tags.begin(), tags.end());
+    tags.erase(std::unique(tags.begin(), tags.end()), tags.end());
+}
+
+tag_index_t::tag_index_t(const fs::path& path, sync_type sync):
+    m_path(path),
+    m_sync(std::move(sync)),
+    m_fd(-1),
+    m_size(0),
+    m_stale(0),
+    m_clean(false),
+    m_tainted(false)
+{
+    load();
+}
+
+tag_index_t::~tag_index_t() {
+    if(m_fd != -1) {
+        ::close(m_fd);
+    }
+}
+
+bool
+tag_index_t::exists() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_fd != -1;
+}
+
+bool
+tag_index_t::clean() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_clean;
+}
+
+void
+tag_index_t::close() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(m_fd == -1 || m_tainted) {
+        return;
+    }
+
+    append(make_record(close_record, std::string(), {}));
+
+    // Superseded by whatever follows it.
+    m_stale++;
+}
+
+void
+tag_index_t::taint() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tainted = true;
+}
+
+size_t
+tag_index_t::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_map.size();
+}
+
+std::vector<std::string>
+tag_index_t::tags(const std::string& key) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    const auto tags = m_map.tags(key);
+
+    if(!tags) {
+        return {};
+    }
+
+    return *tags;
+}
+
+std::map<std::string, std::vector<std::string>>
+tag_index_t::objects() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return std::map<std::string, std::vector<std::string>>(m_map.objects().begin(), m_map.objects().end());
+}
+
+void
+tag_index_t::insert(const std::string& key, std::vector<std::string> tags) {
+    tag_map_t::normalize(tags);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    const auto previous = m_map.tags(key);
+
+    if(previous && *previous == tags) {
+        return;
+    }
+
+    if(m_fd == -1) {
+        m_map.attach(key, std::move(tags));
+        rewrite();
+        return;
+    }
+
+    append(make_record(insert_record, key, tags));
+
+    if(previous) {
+        m_stale++;
+    }
+
+    m_map.attach(key, std::move(tags));
+    compact();
+}
+
+void
+tag_index_t::erase(const std::string& key) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(!m_map.tags(key)) {
+        return;
+    }
+
+    if(m_fd != -1) {
+        append(make_record(erase_record, key, {}));
+
+        // Both the erasure and the insert it cancels are useless from now on.
+        m_stale += 2;
+    }
+
+    m_map.detach(key);
+    compact();
+}
+
+void
+tag_index_t::reset(const std::map<std::string, std::vector<std::string>>& objects) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_map.clear();
+
+    for(auto it = objects.begin(); it != objects.end(); ++it) {
+        auto tags = it->second;
+
+        tag_map_t::normalize(tags);
+        m_map.attach(it->first, std::move(tags));
+    }
+
+    rewrite();
+}
+
+std::vector<std::string>
+tag_index_t::find(const std::vector<std::string>& tags) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_map.find(tags);
+}
+
+void
+tag_index_t::load() {
+    descriptor_t descriptor(::open(m_path.c_str(), O_RDWR | O_APPEND | O_CLOEXEC));
+
+    if(descriptor.fd == -1) {
+        if(errno == ENOENT) {
+            return;
+        }
+
+        throw make_system_error(m_path);
+    }
+
+    struct stat info;
+
+    if(::fstat(descriptor.fd, &info) != 0) {
+        throw make_system_error(m_path);
+    }
+
+    const size_t size = info.st_size;
+
+    if(size < sizeof(kMagic)) {
+        // Not an index, so it's treated as a missing one.
+        return;
+    }
+
+    const auto data = static_cast<const char*>(::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor.fd, 0));
+
+    if(data == MAP_FAILED) {
+        throw make_system_error(m_path);
+    }
+
+    if(std::memcmp(data, kMagic, sizeof(kMagic)) != 0) {
+        ::munmap(const_cast<char*>(data), size);
+        return;
+    }
+
+    reader_t reader{data + sizeof(kMagic), data + size};
+    reader_t payload{nullptr, nullptr};
+
+    size_t valid = sizeof(kMagic);
+    bool clean = false;
+
+    while(reader.next(payload) && payload.it != payload.end) {
+        const auto type = static_cast<std::uint8_t>(*payload.it++);
+
+        std::string key;
+
+        if(!payload.get(key)) {
+            break;
+        }
+
+        if(type == insert_record) {
+            std::uint32_t count;
+            std::vector<std::string> tags;
+
+            if(!payload.get(count)) {
+                break;
+            }
+
+            for(std::string tag; count > 0 && payload.get(tag); --count) {
+                tags.push_back(std::move(tag));
+            }
+
+            if(count > 0) {
+                break;
+            }
+
+            if(m_map.tags(key)) {
+                m_stale++;
+            }
+
+            tag_map_t::normalize(tags);
+            m_map.attach(key, std::move(tags));
+        } else if(type == erase_record) {
+            m_map.detach(key);
+            m_stale += 2;
+        } else if(type != close_record) {
+            break;
+        } else {
+            m_stale++;
+        }
+
+        clean = type == close_record;
+        valid = reader.it - data;
+    }
+
+    ::munmap(const_cast<char*>(data), size);
+
+    if(valid < size && ::ftruncate(descriptor.fd, valid) != 0) {
+        throw make_system_error(m_path);
+    }
+
+    m_fd = descriptor.release();
+    m_size = valid;
+
+    // Anything following the close, even a torn update, means that the index has been updated since.
+    m_clean = clean && valid == size;
+}
+
+void
+tag_index_t::append(const std::string& record) {
+    try {
+        write_all(m_fd, record, m_path);
+        m_sync(m_fd, m_path);
+    } catch(...) {
+        // Otherwise the torn record would hide all the following ones on replay.
+        if(::ftruncate(m_fd, m_size) != 0) {
+            // Nothing else can be done about it, the tail will be dropped on replay.
+        }
+
+        throw;
+    }
+
+    m_size += record.size();
+}
+
+void
+tag_index_t::compact() {
+    if(m_stale >= kMinStale && m_stale > m_map.size()) {
+        rewrite();
+    }
+}
+
+void
+tag_index_t::rewrite() {
+    const fs::path temp_path(m_path.string() + ".tmp");
+
+    std::string buffer(kMagic, sizeof(kMagic));
+
+    for(auto it = m_map.objects().begin(); it != m_map.objects().end(); ++it) {
+        buffer.append(make_record(insert_record, it->first, it->second));
+    }
+
+    {
+        descriptor_t descriptor(::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+
+        if(descriptor.fd == -1) {
+            throw make_system_error(temp_path);
+        }
+
+        write_all(descriptor.fd, buffer, temp_path);
+        m_sync(descriptor.fd, temp_path);
+    }
+
+    if(::rename(temp_path.c_str(), m_path.c_str()) != 0) {
+        const auto error = make_system_error(m_path);
+        ::unlink(temp_path.c_str());
+        throw error;
+    }
+
+    {
+        const auto parent_path = m_path.parent_path();
+
+        descriptor_t descriptor(::open(parent_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+
+        if(descriptor.fd == -1) {
+            throw make_system_error(parent_path);
+        }
+
+        m_sync(descriptor.fd, parent_path);
+    }
+
+    const int fd = ::open(m_path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+
+    if(fd == -1) {
+        throw make_system_error(m_path);
+    }
+
+    if(m_fd != -1) {
+        ::close(m_fd);
+    }
+
+    m_fd = fd;
+    m_size = buffer.size();
+    m_stale = 0;
+}
@@ -0,0 +1,687 @@
+/*
+    Copyright (c) 2011-2014 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2014 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cocaine/detail/storage/journal.hpp"
+#include "cocaine/detail/storage/record.hpp"
+
+#include "cocaine/context.hpp"
+#include "cocaine/dynamic.hpp"
+#include "cocaine/errors.hpp"
+#include "cocaine/logging.hpp"
+
+#include <boost/filesystem/operations.hpp>
+
+#include <blackhole/logger.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace cocaine::storage;
+using namespace cocaine::storage::record;
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+const char kMagic[8] = { 'C', 'O', 'C', 'A', 'J', 'R', 'N', '1' };
+
+// Compaction copies objects into the new log in chunks of this size.
+const size_t kCompactionChunk = 1 << 20;
+
+enum record_types: std::uint8_t { insert_record = 1, erase_record = 2 };
+
+// Whether a valid record starts anywhere in the given range.
+bool
+has_record(const char* it, const char* end) {
+    for(; it < end; ++it) {
+        reader_t reader{it, end}, payload{nullptr, nullptr};
+
+        if(reader.next(payload) && payload.it != payload.end) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// An interrupted append leaves either an incomplete or garbled last record behind, or a zero-filled
+// tail if the file has been extended, but the data hasn't made it to the disk. Anything else which
+// doesn't check out is corruption in the middle of the log.
+bool
+is_torn(const char* it, const char* end) {
+    reader_t header{it, end};
+    std::uint32_t size, sum;
+
+    if(!header.get(size) || !header.get(sum) || static_cast<size_t>(end - header.it) <= size) {
+        // This looks like the last record, so it's torn unless it checks out and only its payload is
+        // malformed. But the size isn't covered by the checksum, so a corrupted one can make any
+        // record look like the last one, and then the records following it are still there.
+        reader_t record{it, end}, payload{nullptr, nullptr};
+
+        if(!record.next(payload)) {
+            return !has_record(it + 1, end);
+        }
+    }
+
+    return std::all_of(it, end, [](char c) { return c == 0; });
+}
+
+// Payloads are [type][collection][key] with [blob][count][tag]... following for inserts. Returns
+// the record along with the offset of the blob in it.
+std::pair<std::string, size_t>
+make_record(record_types type,
+            const std::string& collection,
+            const std::string& key,
+            const std::string& blob,
+            const std::vector<std::string>& tags)
+{
+    std::string payload(1, static_cast<char>(type));
+
+    put(payload, collection);
+    put(payload, key);
+
+    const size_t offset = header_size + payload.size() + sizeof(std::uint32_t);
+
+    if(type == insert_record) {
+        put(payload, blob);
+        put(payload, static_cast<std::uint32_t>(tags.size()));
+
+        for(auto it = tags.begin(); it != tags.end(); ++it) {
+            put(payload, *it);
+        }
+    }
+
+    return std::make_pair(frame(payload), offset);
+}
+
+std::string
+make_id(const std::string& collection, const std::string& key) {
+    std::string id;
+
+    id.reserve(collection.size() + key.size() + 1);
+    id.append(collection).push_back('\0');
+    id.append(key);
+
+    return id;
+}
+
+void
+sync(int fd, const fs::path& path) {
+    if(::fsync(fd) != 0) {
+        throw make_system_error(path);
+    }
+}
+
+void
+sync_directory(const fs::path& path) {
+    descriptor_t descriptor(::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+
+    if(descriptor.fd == -1) {
+        throw make_system_error(path);
+    }
+
+    sync(descriptor.fd, path);
+}
+
+} // namespace
+
+journal_t::journal_t(context_t& context, const std::string& name, const dynamic_t& args):
+    category_type(context, name, args),
+    m_log(context.log(name)),
+    m_path(fs::path(args.as_object().at("path").as_string()) / "journal"),
+    m_fsync(args.as_object().at("durability", "none").as_string() == "fsync"),
+    m_compaction_interval(boost::posix_time::seconds(
+        args.as_object().at("compaction_interval", 60u).as_uint())),
+    m_compaction_garbage(args.as_object().at("compaction_garbage", 16u << 20).as_uint()),
+    io_loop(),
+    io_work(asio::io_service::work(io_loop)),
+    m_strand(io_loop),
+    m_timer(io_loop),
+    m_stopping(false)
+{
+    const auto durability = args.as_object().at("durability", "none").as_string();
+
+    if(durability != "none" && durability != "fsync") {
+        throw cocaine::error_t("unknown durability mode '{}'", durability);
+    }
+
+    fs::create_directories(m_path.parent_path());
+
+    load();
+
+    const auto workers = std::max<dynamic_t::uint_t>(1, args.as_object().at("workers", 2u).as_uint());
+
+    for(size_t i = 0; i < workers; ++i) {
+        m_workers.emplace_back([&](){
+            io_loop.run();
+        });
+    }
+
+    m_strand.post([this]() {
+        schedule();
+    });
+}
+
+journal_t::~journal_t() {
+    m_stopping = true;
+
+    m_strand.post([this]() {
+        m_timer.cancel();
+    });
+
+    io_work = boost::none;
+
+    for(auto it = m_workers.begin(); it != m_workers.end(); ++it) {
+        it->join();
+    }
+}
+
+void
+journal_t::read(const std::string& collection, const std::string& key, callback<std::string> cb) {
+    io_loop.post([=]() {
+        try {
+            cb(make_ready_future(read_sync(collection, key)));
+        } catch (...) {
+            cb(make_exceptional_future<std::string>());
+        }
+    });
+}
+
+void
+journal_t::write(const std::string& collection,
+                 const std::string& key,
+                 const std::string& blob,
+                 const std::vector<std::string>& tags,
+                 callback<void> cb)
+{
+    m_strand.post([=]() {
+        try {
+            write_sync(collection, key, blob, tags);
+            cb(make_ready_future());
+        } catch (...) {
+            cb(make_exceptional_future<void>());
+        }
+    });
+}
+
+void
+journal_t::remove(const std::string& collection, const std::string& key, callback<void> cb) {
+    m_strand.post([=]() {
+        try {
+            remove_sync(collection, key);
+            cb(make_ready_future());
+        } catch (...) {
+            cb(make_exceptional_future<void>());
+        }
+    });
+}
+
+void
+journal_t::find(const std::string& collection, const std::vector<std::string>& tags, callback<std::vector<std::string>> cb) {
+    io_loop.post([=]() {
+        try {
+            cb(make_ready_future(find_sync(collection, tags)));
+        } catch (...) {
+            cb(make_exceptional_future<std::vector<std::string>>());
+        }
+    });
+}
+
+void
+journal_t::load() {
+    descriptor_t descriptor(::open(m_path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644));
+
+    if(descriptor.fd == -1) {
+        throw make_system_error(m_path);
+    }
+
+    struct stat info;
+
+    if(::fstat(descriptor.fd, &info) != 0) {
+        throw make_system_error(m_path);
+    }
+
+    const size_t size = info.st_size;
+
+    auto ptr = m_state.synchronize();
+
+    ptr->size = sizeof(kMagic);
+    ptr->garbage = 0;
+    ptr->compacting = false;
+
+    if(size < sizeof(kMagic)) {
+        // A brand new journal, or one which has crashed before its header was written.
+        if(::ftruncate(descriptor.fd, 0) != 0) {
+            throw make_system_error(m_path);
+        }
+
+        write_all(descriptor.fd, std::string(kMagic, sizeof(kMagic)), m_path);
+        ptr->log = std::make_shared<descriptor_t>(descriptor.release());
+
+        return;
+    }
+
+    const auto data = static_cast<const char*>(::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor.fd, 0));
+
+    if(data == MAP_FAILED) {
+        throw make_system_error(m_path);
+    }
+
+    if(std::memcmp(data, kMagic, sizeof(kMagic)) != 0) {
+        ::munmap(const_cast<char*>(data), size);
+        throw cocaine::error_t("'{}' is not a journal", m_path.string());
+    }
+
+    reader_t reader{data + sizeof(kMagic), data + size};
+    reader_t payload{nullptr, nullptr};
+
+    size_t objects = 0;
+
+    for(auto record = reader.it; reader.next(payload) && payload.it != payload.end; record = reader.it) {
+        const auto length = static_cast<std::uint32_t>(reader.it - record);
+        const auto type = static_cast<std::uint8_t>(*payload.it++);
+
+        std::string collection, key;
+
+        if(!payload.get(collection) || !payload.get(key)) {
+            break;
+        }
+
+        auto& target = ptr->collections[collection];
+
+        if(type == insert_record) {
+            std::uint32_t blob_size, count;
+
+            if(!payload.get(blob_size) || static_cast<size_t>(payload.end - payload.it) < blob_size) {
+                break;
+            }
+
+            const location_t location{static_cast<std::uint64_t>(payload.it - data), blob_size, length};
+
+            payload.it += blob_size;
+
+            std::vector<std::string> tags;
+
+            if(!payload.get(count)) {
+                break;
+            }
+
+            for(std::string tag; count > 0 && payload.get(tag); --count) {
+                tags.push_back(std::move(tag));
+            }
+
+            if(count > 0) {
+                break;
+            }
+
+            const auto it = target.objects.find(key);
+
+            if(it != target.objects.end()) {
+                ptr->garbage += it->second.record;
+                it->second = location;
+            } else {
+                target.objects.insert({key, location});
+            }
+
+            tag_map_t::normalize(tags);
+            target.tags.attach(key, std::move(tags));
+        } else if(type == erase_record) {
+            const auto it = target.objects.find(key);
+
+            if(it != target.objects.end()) {
+                ptr->garbage += it->second.record;
+                target.objects.erase(it);
+                target.tags.detach(key);
+            }
+
+            ptr->garbage += length;
+        } else {
+            break;
+        }
+
+        if(target.objects.empty()) {
+            ptr->collections.erase(collection);
+        }
+
+        ptr->size = reader.it - data;
+    }
+
+    if(ptr->size < size && !is_torn(data + ptr->size, data + size)) {
+        ::munmap(const_cast<char*>(data), size);
+
+        throw cocaine::error_t("'{}' is corrupted at offset {:d}, with {:d} byte(s) following it", m_path.string(),
+            ptr->size, size - ptr->size);
+    }
+
+    ::munmap(const_cast<char*>(data), size);
+
+    if(ptr->size < size) {
+        COCAINE_LOG_WARNING(m_log, "dropping {:d} byte(s) of torn journal tail", size - ptr->size);
+
+        if(::ftruncate(descriptor.fd, ptr->size) != 0) {
+            throw make_system_error(m_path);
+        }
+    }
+
+    for(auto it = ptr->collections.begin(); it != ptr->collections.end(); ++it) {
+        objects += it->second.objects.size();
+    }
+
+    COCAINE_LOG_INFO(m_log, "loaded {:d} object(s) in {:d} collection(s) from '{}', {:d} of {:d} byte(s) "
+        "are garbage", objects, ptr->collections.size(), m_path.string(), ptr->garbage, ptr->size);
+
+    ptr->log = std::make_shared<descriptor_t>(descriptor.release());
+}
+
+void
+journal_t::append(state_t& state, const std::string& record) {
+    try {
+        write_all(state.log->fd, record, m_path);
+    } catch(...) {
+        // Otherwise the torn record would hide all the following ones on replay.
+        if(::ftruncate(state.log->fd, state.size) != 0) {
+            // Nothing else can be done about it, the tail will be dropped on replay.
+        }
+
+        throw;
+    }
+
+    state.size += record.size();
+}
+
+void
+journal_t::schedule() {
+    if(m_stopping) {
+        return;
+    }
+
+    m_timer.expires_from_now(m_compaction_interval);
+    m_timer.async_wait(m_strand.wrap([this](const std::error_code& ec) {
+        if(ec == asio::error::operation_aborted) {
+            return;
+        }
+
+        // Compaction runs outside of the strand, so that writes are not blocked.
+        io_loop.post([this]() {
+            compact();
+        });
+
+        schedule();
+    }));
+}
+
+void
+journal_t::compact() {
+    struct entry_t {
+        std::string collection;
+        std::string key;
+        location_t location;
+        std::vector<std::string> tags;
+    };
+
+    std::vector<entry_t> entries;
+    std::shared_ptr<descriptor_t> source;
+
+    // Log size and garbage as of the snapshot.
+    std::uint64_t end = 0, garbage = 0;
+
+    const bool proceed = m_state.apply([&](state_t& state) -> bool {
+        if(state.compacting || state.garbage < m_compaction_garbage || state.garbage * 2 < state.size) {
+            return false;
+        }
+
+        for(auto it = state.collections.begin(); it != state.collections.end(); ++it) {
+            for(auto object = it->second.objects.begin(); object != it->second.objects.end(); ++object) {
+                entries.push_back({it->first, object->first, object->second, *it->second.tags.tags(object->first)});
+            }
+        }
+
+        state.compacting = true;
+
+        source = state.log;
+        end = state.size;
+        garbage = state.garbage;
+
+        return true;
+    });
+
+    if(!proceed) {
+        return;
+    }
+
+    COCAINE_LOG_INFO(m_log, "compacting journal, {:d} of {:d} byte(s) are garbage", garbage, end);
+
+    const fs::path temp_path(m_path.string() + ".tmp");
+
+    try {
+        auto target = std::make_shared<descriptor_t>(
+            ::open(temp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644));
+
+        if(target->fd == -1) {
+            throw make_system_error(temp_path);
+        }
+
+        // New locations of the snapshotted objects.
+        std::unordered_map<std::string, location_t> relocated;
+
+        std::string buffer(kMagic, sizeof(kMagic)), blob;
+        std::uint64_t written = 0;
+
+        for(auto it = entries.begin(); it != entries.end(); ++it) {
+            blob.resize(it->location.size);
+            read_all(source->fd, &blob[0], blob.size(), it->location.offset, m_path);
+
+            const auto record = make_record(insert_record, it->collection, it->key, blob, it->tags);
+
+            relocated[make_id(it->collection, it->key)] = location_t{
+                written + buffer.size() + record.second,
+                it->location.size,
+                static_cast<std::uint32_t>(record.first.size())
+            };
+
+            buffer.append(record.first);
+
+            if(buffer.size() >= kCompactionChunk) {
+                write_all(target->fd, buffer, temp_path);
+                written += buffer.size();
+                buffer.clear();
+            }
+        }
+
+        write_all(target->fd, buffer, temp_path);
+        written += buffer.size();
+
+        // The bulk of the new log is synced without blocking writes.
+        sync(target->fd, temp_path);
+
+        m_state.apply([&](state_t& state) {
+            // Catch up with the writes and removes applied since the snapshot. Their records are
+            // copied as is, so the objects they've touched are just shifted.
+            const std::uint64_t tail = state.size - end;
+
+            if(tail) {
+                buffer.resize(tail);
+                read_all(state.log->fd, &buffer[0], buffer.size(), end, m_path);
+                write_all(target->fd, buffer, temp_path);
+                sync(target->fd, temp_path);
+            }
+
+            if(::rename(temp_path.c_str(), m_path.c_str()) != 0) {
+                throw make_system_error(m_path);
+            }
+
+            for(auto it = state.collections.begin(); it != state.collections.end(); ++it) {
+                for(auto object = it->second.objects.begin(); object != it->second.objects.end(); ++object) {
+                    auto& location = object->second;
+
+                    if(location.offset >= end) {
+                        location.offset = location.offset - end + written;
+                    } else {
+                        location = relocated.at(make_id(it->first, object->first));
+                    }
+                }
+            }
+
+            state.log = target;
+            state.size = written + tail;
+
+            // Objects superseded since the snapshot now have their garbage in the new log.
+            state.garbage -= garbage;
+            state.compacting = false;
+
+            COCAINE_LOG_INFO(m_log, "compacted journal to {:d} byte(s)", state.size);
+
+            // The new log is in use already, so a failure here only affects durability.
+            sync_directory(m_path.parent_path());
+        });
+    } catch(const std::system_error& e) {
+        COCAINE_LOG_ERROR(m_log, "unable to compact journal: {}", error::to_string(e));
+
+        ::unlink(temp_path.c_str());
+
+        m_state.apply([&](state_t& state) {
+            state.compacting = false;
+        });
+    }
+}
+
+std::string
+journal_t::read_sync(const std::string& collection, const std::string& key) {
+    std::shared_ptr<descriptor_t> log;
+    location_t location;
+
+    m_state.apply([&](state_t& state) {
+        const auto it = state.collections.find(collection);
+
+        if(it == state.collections.end() || !it->second.objects.count(key)) {
+            throw std::system_error(std::make_error_code(std::errc::no_such_file_or_directory),
+                cocaine::format("{}/{}", collection, key));
+        }
+
+        log = state.log;
+        location = it->second.objects.at(key);
+    });
+
+    std::string blob(location.size, '\0');
+
+    // Records are never modified once appended, so the lock is not needed anymore.
+    read_all(log->fd, &blob[0], blob.size(), location.offset, m_path);
+
+    return blob;
+}
+
+void
+journal_t::write_sync(const std::string& collection,
+                      const std::string& key,
+                      const std::string& blob,
+                      const std::vector<std::string>& tags)
+{
+    if(blob.size() > std::numeric_limits<std::uint32_t>::max()) {
+        throw std::system_error(std::make_error_code(std::errc::file_too_large), key);
+    }
+
+    auto normalized = tags;
+    tag_map_t::normalize(normalized);
+
+    const auto record = make_record(insert_record, collection, key, blob, normalized);
+
+    std::shared_ptr<descriptor_t> log;
+
+    m_state.apply([&](state_t& state) {
+        const location_t location{
+            state.size + record.second,
+            static_cast<std::uint32_t>(blob.size()),
+            static_cast<std::uint32_t>(record.first.size())
+        };
+
+        append(state, record.first);
+
+        auto& target = state.collections[collection];
+        const auto it = target.objects.find(key);
+
+        if(it != target.objects.end()) {
+            state.garbage += it->second.record;
+            it->second = location;
+        } else {
+            target.objects.insert({key, location});
+        }
+
+        target.tags.attach(key, std::move(normalized));
+
+        log = state.log;
+    });
+
+    if(m_fsync) {
+        sync(log->fd, m_path);
+    }
+}
+
+void
+journal_t::remove_sync(const std::string& collection, const std::string& key) {
+    const auto record = make_record(erase_record, collection, key, std::string(), {});
+
+    std::shared_ptr<descriptor_t> log;
+
+    m_state.apply([&](state_t& state) {
+        const auto it = state.collections.find(collection);
+
+        if(it == state.collections.end() || !it->second.objects.count(key)) {
+            return;
+        }
+
+        append(state, record.first);
+
+        auto& target = it->second;
+
+        state.garbage += target.objects.at(key).record + record.first.size();
+
+        target.objects.erase(key);
+        target.tags.detach(key);
+
+        if(target.objects.empty()) {
+            state.collections.erase(it);
+        }
+
+        log = state.log;
+    });
+
+    if(log && m_fsync) {
+        sync(log->fd, m_path);
+    }
+}
+
+std::vector<std::string>
+journal_t::find_sync(const std::string& collection, const std::vector<std::string>& tags) {
+    return m_state.apply([&](state_t& state) -> std::vector<std::string> {
+        const auto it = state.collections.find(collection);
+
+        if(it == state.collections.end()) {
+            return {};
+        }
+
+        return it->second.tags.find(tags);
+    });
+}
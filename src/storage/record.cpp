@@ -0,0 +1,176 @@
+/*
+    Copyright (c) 2011-2014 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2014 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cocaine/detail/storage/record.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+
+namespace cocaine { namespace storage { namespace record {
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+// FNV-1a.
+std::uint32_t
+checksum(const char* data, size_t size) {
+    std::uint32_t hash = 2166136261u;
+
+    for(size_t i = 0; i < size; ++i) {
+        hash = (hash ^ static_cast<std::uint8_t>(data[i])) * 16777619u;
+    }
+
+    return hash;
+}
+
+} // namespace
+
+descriptor_t::~descriptor_t() {
+    if(fd != -1) {
+        ::close(fd);
+    }
+}
+
+int
+descriptor_t::release() {
+    const int result = fd;
+    fd = -1;
+    return result;
+}
+
+std::system_error
+make_system_error(const fs::path& path) {
+    return std::system_error(std::make_error_code(static_cast<std::errc>(errno)), path.string());
+}
+
+void
+write_all(int fd, const std::string& data, const fs::path& path) {
+    size_t offset = 0;
+
+    while(offset < data.size()) {
+        const auto size = ::write(fd, data.data() + offset, data.size() - offset);
+
+        if(size == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            throw make_system_error(path);
+        }
+
+        offset += size;
+    }
+}
+
+void
+read_all(int fd, char* data, size_t size, off_t offset, const fs::path& path) {
+    size_t done = 0;
+
+    while(done < size) {
+        const auto result = ::pread(fd, data + done, size - done, offset + done);
+
+        if(result == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            throw make_system_error(path);
+        }
+
+        if(result == 0) {
+            throw std::system_error(std::make_error_code(std::errc::io_error), path.string());
+        }
+
+        done += result;
+    }
+}
+
+void
+put(std::string& buffer, std::uint32_t value) {
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void
+put(std::string& buffer, const std::string& value) {
+    put(buffer, static_cast<std::uint32_t>(value.size()));
+    buffer.append(value);
+}
+
+std::string
+frame(const std::string& payload) {
+    std::string result;
+
+    result.reserve(header_size + payload.size());
+
+    put(result, static_cast<std::uint32_t>(payload.size()));
+    put(result, checksum(payload.data(), payload.size()));
+
+    return result.append(payload);
+}
+
+bool
+reader_t::get(std::uint32_t& value) {
+    if(static_cast<size_t>(end - it) < sizeof(value)) {
+        return false;
+    }
+
+    std::memcpy(&value, it, sizeof(value));
+    it += sizeof(value);
+
+    return true;
+}
+
+bool
+reader_t::get(std::string& value) {
+    std::uint32_t size;
+
+    if(!get(size) || static_cast<size_t>(end - it) < size) {
+        return false;
+    }
+
+    value.assign(it, size);
+    it += size;
+
+    return true;
+}
+
+bool
+reader_t::next(reader_t& payload) {
+    reader_t header{it, end};
+    std::uint32_t size, sum;
+
+    if(!header.get(size) || !header.get(sum) || static_cast<size_t>(header.end - header.it) < size) {
+        return false;
+    }
+
+    if(checksum(header.it, size) != sum) {
+        return false;
+    }
+
+    payload = reader_t{header.it, header.it + size};
+    it = header.it + size;
+
+    return true;
+}
+
+}}} // namespace cocaine::storage::record
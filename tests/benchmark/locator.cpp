@@ -0,0 +1,157 @@
+/*
+    Copyright (c) 2011-2014 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2014 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cocaine/detail/service/locator/sharded.hpp"
+
+#include "cocaine/format.hpp"
+#include "cocaine/locked_ptr.hpp"
+
+#include <celero/Celero.h>
+
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+using namespace cocaine;
+using service::sharded_ptr;
+
+// Resolve responses are packed once and shared, so resolving a service copies a pointer to them
+// out of the cache, just like here.
+typedef std::unordered_map<std::string, std::shared_ptr<const std::string>> cache_map_t;
+
+// Number of services known to the locator.
+const size_t kServiceCount = 1000;
+
+// Number of resolves done by every thread per iteration, i.e. the throughput is the number of
+// threads times this over the iteration time.
+const size_t kResolvesPerThread = 10000;
+
+struct locator_globals_t {
+    locator_globals_t():
+        shared(make()),
+        sharded(make(), std::thread::hardware_concurrency())
+    {
+        *locked.synchronize() = *make();
+
+        for(size_t i = 0; i < kServiceCount; ++i) {
+            names.push_back(cocaine::format("app-{}", i));
+        }
+    }
+
+    // Locator resolve cache before sharding: a single map behind a mutex.
+    synchronized<cache_map_t> locked;
+
+    // A single immutable map, loaded with std::atomic_load().
+    std::shared_ptr<const cache_map_t> shared;
+
+    // Locator resolve cache now: an immutable map replicated into per-thread shards.
+    sharded_ptr<cache_map_t> sharded;
+
+    std::vector<std::string> names;
+
+private:
+    static
+    std::shared_ptr<cache_map_t>
+    make() {
+        auto result = std::make_shared<cache_map_t>();
+
+        for(size_t i = 0; i < kServiceCount; ++i) {
+            (*result)[cocaine::format("app-{}", i)] = std::make_shared<const std::string>(
+                cocaine::format("endpoint-{}", i));
+        }
+
+        return result;
+    }
+};
+
+locator_globals_t&
+globals() {
+    static locator_globals_t instance;
+    return instance;
+}
+
+// Runs the given resolve function concurrently on the given number of threads, mimicking resolve
+// requests served by the I/O pool.
+template<class F>
+void
+run(size_t threads, F resolve) {
+    std::vector<std::thread> workers;
+
+    for(size_t thread = 0; thread < threads; ++thread) {
+        workers.emplace_back([=] {
+            const auto& names = globals().names;
+
+            size_t result = 0;
+
+            for(size_t i = 0; i < kResolvesPerThread; ++i) {
+                result += resolve(names[(i * 7 + thread) % names.size()])->size();
+            }
+
+            celero::DoNotOptimizeAway(result);
+        });
+    }
+
+    for(auto it = workers.begin(); it != workers.end(); ++it) {
+        it->join();
+    }
+}
+
+std::shared_ptr<const std::string>
+synchronized_resolve(const std::string& name) {
+    return globals().locked.apply([&](const cache_map_t& mapping) {
+        return mapping.find(name)->second;
+    });
+}
+
+std::shared_ptr<const std::string>
+atomic_resolve(const std::string& name) {
+    const auto mapping = std::atomic_load(&globals().shared);
+    return mapping->find(name)->second;
+}
+
+std::shared_ptr<const std::string>
+sharded_resolve(const std::string& name) {
+    const auto mapping = globals().sharded.load();
+    return mapping->find(name)->second;
+}
+
+} // namespace
+
+#define LOCATOR_RESOLVE_BENCHMARKS(threads)                             \
+    BASELINE(LocatorResolve##threads, AtomicLoad, 10, 10) {             \
+        run(threads, atomic_resolve);                                   \
+    }                                                                   \
+                                                                        \
+    BENCHMARK(LocatorResolve##threads, Synchronized, 10, 10) {          \
+        run(threads, synchronized_resolve);                             \
+    }                                                                   \
+                                                                        \
+    BENCHMARK(LocatorResolve##threads, Sharded, 10, 10) {               \
+        run(threads, sharded_resolve);                                  \
+    }
+
+LOCATOR_RESOLVE_BENCHMARKS(1)
+LOCATOR_RESOLVE_BENCHMARKS(2)
+LOCATOR_RESOLVE_BENCHMARKS(4)
+LOCATOR_RESOLVE_BENCHMARKS(8)
+LOCATOR_RESOLVE_BENCHMARKS(16)
+LOCATOR_RESOLVE_BENCHMARKS(32)
@@ -0,0 +1,194 @@
+/*
+    Copyright (c) 2011-2014 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2014 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cocaine/detail/service/locator/routing.hpp"
+
+#include "cocaine/format.hpp"
+
+#include <blackhole/handler.hpp>
+#include <blackhole/root.hpp>
+
+#include <celero/Celero.h>
+
+#include <iostream>
+#include <map>
+
+namespace {
+
+using namespace cocaine;
+using service::routing_group_t;
+
+typedef routing_group_t::algorithm_type algorithm_type;
+typedef routing_group_t::hash_type hash_type;
+
+// Number of routing group members, all with equal weights.
+const size_t kGroupSize = 100;
+
+// Number of distinct routing keys cycled through by the benchmarks.
+const size_t kKeyCount = 1024;
+
+// Number of keys used to estimate balance and disruption.
+const size_t kSampleCount = 100000;
+
+std::unique_ptr<logging::logger_t>
+make_logger() {
+    std::unique_ptr<blackhole::root_logger_t> log(
+        new blackhole::root_logger_t(std::vector<std::unique_ptr<blackhole::handler_t>>()));
+
+    // Drop everything, so that only the lookups are measured.
+    log->filter([](const blackhole::record_t&) -> bool {
+        return false;
+    });
+
+    return std::move(log);
+}
+
+routing_group_t::stored_type
+make_group(size_t size) {
+    routing_group_t::stored_type result;
+
+    for(size_t i = 0; i < size; ++i) {
+        result[cocaine::format("app-v{:03d}", i)] = 1;
+    }
+
+    return result;
+}
+
+std::unique_ptr<routing_group_t>
+make(algorithm_type algorithm, const routing_group_t::stored_type& group, hash_type hash = hash_type::md5) {
+    return service::make_routing_group(algorithm, make_logger(), group, hash);
+}
+
+// Prints the memory footprint, the most loaded member share relative to the fair one, and the
+// share of keys moved to other members (apart from the keys of the removed member itself) when a
+// member from the middle of the group is removed.
+void
+report(const char* name, algorithm_type algorithm) {
+    auto group = make_group(kGroupSize);
+    auto original = make(algorithm, group);
+
+    const auto removed = std::next(group.begin(), kGroupSize / 2)->first;
+
+    group.erase(removed);
+
+    auto updated = make(algorithm, group);
+
+    std::map<std::string, size_t> load;
+    size_t moved = 0;
+
+    for(size_t i = 0; i < kSampleCount; ++i) {
+        const auto key = cocaine::format("user-{}", i);
+        const auto& value = original->get(key);
+
+        load[value]++;
+
+        if(value != removed && value != updated->get(key)) {
+            moved++;
+        }
+    }
+
+    size_t maximum = 0;
+
+    for(auto it = load.begin(); it != load.end(); ++it) {
+        maximum = std::max(maximum, it->second);
+    }
+
+    std::cout << cocaine::format("{}: footprint: {} bytes, max load: {:.3f} of fair, moved: {:.2f}%",
+        name,
+        original->footprint(),
+        static_cast<double>(maximum) * kGroupSize / kSampleCount,
+        100.0 * moved / kSampleCount) << std::endl;
+}
+
+struct routing_globals_t {
+    routing_globals_t():
+        ketama(make(algorithm_type::ketama, make_group(kGroupSize))),
+        fnv1a(make(algorithm_type::ketama, make_group(kGroupSize), hash_type::fnv1a)),
+        maglev(make(algorithm_type::maglev, make_group(kGroupSize))),
+        jump(make(algorithm_type::jump, make_group(kGroupSize))),
+        rendezvous(make(algorithm_type::rendezvous, make_group(kGroupSize)))
+    {
+        for(size_t i = 0; i < kKeyCount; ++i) {
+            keys.push_back(cocaine::format("user-{}", i));
+        }
+
+        report("ketama", algorithm_type::ketama);
+        report("maglev", algorithm_type::maglev);
+        report("jump", algorithm_type::jump);
+        report("rendezvous", algorithm_type::rendezvous);
+    }
+
+    std::unique_ptr<routing_group_t> ketama;
+    std::unique_ptr<routing_group_t> fnv1a;
+    std::unique_ptr<routing_group_t> maglev;
+    std::unique_ptr<routing_group_t> jump;
+    std::unique_ptr<routing_group_t> rendezvous;
+
+    std::vector<std::string> keys;
+};
+
+routing_globals_t&
+globals() {
+    static routing_globals_t instance;
+    return instance;
+}
+
+size_t
+resolve_all(const routing_group_t& group, const std::vector<std::string>& keys) {
+    size_t result = 0;
+
+    for(auto it = keys.begin(); it != keys.end(); ++it) {
+        result += group.get(*it).size();
+    }
+
+    return result;
+}
+
+} // namespace
+
+BASELINE(RoutingGroupResolve, Ketama, 10, 100) {
+    celero::DoNotOptimizeAway(resolve_all(*globals().ketama, globals().keys));
+}
+
+BENCHMARK(RoutingGroupResolve, KetamaFNV1a, 10, 100) {
+    celero::DoNotOptimizeAway(resolve_all(*globals().fnv1a, globals().keys));
+}
+
+BENCHMARK(RoutingGroupResolve, Maglev, 10, 100) {
+    celero::DoNotOptimizeAway(resolve_all(*globals().maglev, globals().keys));
+}
+
+BENCHMARK(RoutingGroupResolve, Jump, 10, 100) {
+    celero::DoNotOptimizeAway(resolve_all(*globals().jump, globals().keys));
+}
+
+BENCHMARK(RoutingGroupResolve, Rendezvous, 10, 100) {
+    celero::DoNotOptimizeAway(resolve_all(*globals().rendezvous, globals().keys));
+}
+
+BENCHMARK(RoutingGroupResolve, Keyless, 10, 100) {
+    size_t result = 0;
+
+    for(size_t i = 0; i < kKeyCount; ++i) {
+        result += globals().ketama->get().size();
+    }
+
+    celero::DoNotOptimizeAway(result);
+}
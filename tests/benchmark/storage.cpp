@@ -0,0 +1,254 @@
+/*
+    Copyright (c) 2011-2014 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2014 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cocaine/detail/storage/files.hpp"
+
+#include "cocaine/api/storage.hpp"
+#include "cocaine/context.hpp"
+#include "cocaine/context/config.hpp"
+#include "cocaine/format.hpp"
+
+#include <blackhole/handler.hpp>
+#include <blackhole/root.hpp>
+
+#include <celero/Celero.h>
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+
+namespace {
+
+namespace fs = boost::filesystem;
+
+// Objects of various sizes stored the way files_t stores them, one file per object.
+struct storage_globals_t {
+    storage_globals_t():
+        path(fs::temp_directory_path() / fs::unique_path("cocaine-benchmark-%%%%-%%%%"))
+    {
+        fs::create_directories(path);
+
+        make("1K", 1 << 10);
+        make("1M", 1 << 20);
+        make("64M", 64 << 20);
+    }
+
+   ~storage_globals_t() {
+        fs::remove_all(path);
+    }
+
+    fs::path path;
+
+private:
+    void
+    make(const std::string& key, size_t size) {
+        fs::ofstream stream(path / key, fs::ofstream::out | fs::ofstream::trunc | fs::ofstream::binary);
+
+        for(size_t i = 0; i < size; ++i) {
+            stream.put(static_cast<char>(i * 31));
+        }
+    }
+};
+
+storage_globals_t&
+globals() {
+    static storage_globals_t instance;
+    return instance;
+}
+
+// The way files_t used to read objects: an existence check followed by a stream read through
+// a byte iterator.
+std::string
+stream_read(const fs::path& path) {
+    if(!fs::exists(path)) {
+        throw std::system_error(std::make_error_code(std::errc::no_such_file_or_directory), path.string());
+    }
+
+    fs::ifstream stream(path, fs::ifstream::in | fs::ifstream::binary);
+
+    return std::string{std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>()};
+}
+
+void
+run(std::string(*read)(const fs::path&), const std::string& key) {
+    celero::DoNotOptimizeAway(read(globals().path / key).size());
+}
+
+// Number of small objects stored in every backend, cycled through by the benchmarks.
+const size_t kObjectCount = 10000;
+
+std::unique_ptr<cocaine::logging::logger_t>
+make_logger() {
+    std::unique_ptr<blackhole::root_logger_t> log(
+        new blackhole::root_logger_t(std::vector<std::unique_ptr<blackhole::handler_t>>()));
+
+    // Drop everything, so that only the storage operations are measured.
+    log->filter([](const blackhole::record_t&) -> bool {
+        return false;
+    });
+
+    return std::move(log);
+}
+
+// Both backends configured in a context of their own, each holding the same set of small tagged
+// objects, like ACLs or routing groups.
+struct backends_globals_t {
+    backends_globals_t():
+        path(fs::temp_directory_path() / fs::unique_path("cocaine-benchmark-%%%%-%%%%")),
+        blob(256, 'x'),
+        counter(0)
+    {
+        fs::create_directories(path / "plugins");
+        fs::create_directories(path / "runtime");
+
+        const auto config_path = path / "cocaine.conf";
+
+        {
+            fs::ofstream stream(config_path);
+
+            stream << "{"
+                   << "\"version\": 4,"
+                   << "\"paths\": {"
+                   << "    \"plugins\": \"" << (path / "plugins").string() << "\","
+                   << "    \"runtime\": \"" << (path / "runtime").string() << "\""
+                   << "},"
+                   << "\"network\": {\"pool\": 1},"
+                   << "\"logging\": {\"loggers\": {}},"
+                   << "\"storages\": {"
+                   << "    \"files\": {\"type\": \"files\", \"args\": {\"path\": \"" << (path / "files").string() << "\"}},"
+                   << "    \"journal\": {\"type\": \"journal\", \"args\": {\"path\": \"" << (path / "journal").string() << "\"}}"
+                   << "}"
+                   << "}";
+        }
+
+        context = cocaine::make_context(cocaine::make_config(config_path.string()), make_logger());
+
+        files = cocaine::api::storage(*context, "files");
+        journal = cocaine::api::storage(*context, "journal");
+
+        for(size_t i = 0; i < kObjectCount; ++i) {
+            files->write("benchmark", key(i), blob, tags(i)).get();
+            journal->write("benchmark", key(i), blob, tags(i)).get();
+        }
+    }
+
+   ~backends_globals_t() {
+        files.reset();
+        journal.reset();
+        context.reset();
+
+        fs::remove_all(path);
+    }
+
+    static
+    std::string
+    key(size_t i) {
+        return cocaine::format("object-{:05d}", i % kObjectCount);
+    }
+
+    static
+    std::vector<std::string>
+    tags(size_t i) {
+        return {"group", i % 2 ? "active" : "inactive"};
+    }
+
+    fs::path path;
+    std::string blob;
+
+    std::unique_ptr<cocaine::context_t> context;
+
+    cocaine::api::storage_ptr files;
+    cocaine::api::storage_ptr journal;
+
+    size_t counter;
+};
+
+backends_globals_t&
+backends() {
+    static backends_globals_t instance;
+    return instance;
+}
+
+void
+write_small(cocaine::api::storage_t& storage) {
+    const auto i = backends().counter++;
+    storage.write("benchmark", backends_globals_t::key(i), backends().blob, backends_globals_t::tags(i)).get();
+}
+
+void
+read_small(cocaine::api::storage_t& storage) {
+    // Stride over the keys, so that consecutive reads don't hit neighbouring objects.
+    const auto i = (backends().counter++ * 7919) % kObjectCount;
+    celero::DoNotOptimizeAway(storage.read("benchmark", backends_globals_t::key(i)).get().size());
+}
+
+void
+find_small(cocaine::api::storage_t& storage) {
+    celero::DoNotOptimizeAway(storage.find("benchmark", {"group", "active"}).get().size());
+}
+
+} // namespace
+
+BASELINE(StorageRead1K, Stream, 10, 1000) {
+    run(stream_read, "1K");
+}
+
+BENCHMARK(StorageRead1K, Pread, 10, 1000) {
+    run(cocaine::storage::read_object, "1K");
+}
+
+BASELINE(StorageRead1M, Stream, 10, 100) {
+    run(stream_read, "1M");
+}
+
+BENCHMARK(StorageRead1M, Pread, 10, 100) {
+    run(cocaine::storage::read_object, "1M");
+}
+
+BASELINE(StorageRead64M, Stream, 5, 2) {
+    run(stream_read, "64M");
+}
+
+BENCHMARK(StorageRead64M, Pread, 5, 2) {
+    run(cocaine::storage::read_object, "64M");
+}
+
+BASELINE(StorageWriteSmall, Files, 10, 1000) {
+    write_small(*backends().files);
+}
+
+BENCHMARK(StorageWriteSmall, Journal, 10, 1000) {
+    write_small(*backends().journal);
+}
+
+BASELINE(StorageReadSmall, Files, 10, 1000) {
+    read_small(*backends().files);
+}
+
+BENCHMARK(StorageReadSmall, Journal, 10, 1000) {
+    read_small(*backends().journal);
+}
+
+BASELINE(StorageFindSmall, Files, 10, 100) {
+    find_small(*backends().files);
+}
+
+BENCHMARK(StorageFindSmall, Journal, 10, 100) {
+    find_small(*backends().journal);
+}
@@ -0,0 +1,123 @@
+/*
+    Copyright (c) 2011-2014 Andrey Sibiryov <me@kobology.ru>
+    Copyright (c) 2011-2014 Other contributors as noted in the AUTHORS file.
+
+    This file is part of Cocaine.
+
+    Cocaine is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    Cocaine is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cocaine/idl/streaming.hpp"
+
+#include "cocaine/rpc/asio/encoder.hpp"
+
+#include <celero/Celero.h>
+
+#include <random>
+
+namespace {
+
+using namespace cocaine;
+
+typedef io::streaming<boost::mpl::list<std::string>>::chunk chunk_type;
+typedef io::event_traits<chunk_type>::tuple_type tuple_type;
+
+// Number of chunks written per iteration, either one by one or as a single batch.
+const size_t kChunksPerIteration = 64;
+
+struct chunk_globals_t {
+    chunk_globals_t() {
+        generate(chunks16,  16);
+        generate(chunks256, 256);
+        generate(chunks4K,  4096);
+    }
+
+    std::vector<std::string> chunks16, chunks256, chunks4K;
+
+private:
+    static
+    void
+    generate_one(std::string& chunk, size_t size) {
+        static std::default_random_engine engine;
+        std::uniform_int_distribution<int> distribution(0, 255);
+
+        for(size_t i = 0; i < size; ++i) {
+            chunk.push_back(static_cast<char>(distribution(engine)));
+        }
+    }
+
+    static
+    void
+    generate(std::vector<std::string>& chunks, size_t size) {
+        chunks.resize(kChunksPerIteration);
+
+        for(auto it = chunks.begin(); it != chunks.end(); ++it) {
+            generate_one(*it, size);
+        }
+    }
+};
+
+const chunk_globals_t&
+chunks() {
+    static const chunk_globals_t instance;
+    return instance;
+}
+
+// Mimics streamed<T>::write() - every chunk is a separate message and a separate buffer.
+void
+encode_each(io::encoder_t& encoder, const std::vector<std::string>& source) {
+    for(auto it = source.begin(); it != source.end(); ++it) {
+        celero::DoNotOptimizeAway(encoder.encode(io::encoded<chunk_type>(1, *it)).size());
+    }
+}
+
+// Mimics streamed<T>::write_batch() - all chunks are packed into consecutive frames of one buffer.
+void
+encode_batch(io::encoder_t& encoder, const std::vector<std::string>& source) {
+    std::vector<tuple_type> batch(source.begin(), source.end());
+
+    celero::DoNotOptimizeAway(encoder.encode(io::encoded_batch<chunk_type>(1, std::move(batch))).size());
+}
+
+io::encoder_t&
+encoder() {
+    static io::encoder_t instance;
+    return instance;
+}
+
+} // namespace
+
+BASELINE(ChunkThroughput16, Single, 10, 10000) {
+    encode_each(encoder(), chunks().chunks16);
+}
+
+BENCHMARK(ChunkThroughput16, Batch, 10, 10000) {
+    encode_batch(encoder(), chunks().chunks16);
+}
+
+BASELINE(ChunkThroughput256, Single, 10, 10000) {
+    encode_each(encoder(), chunks().chunks256);
+}
+
+BENCHMARK(ChunkThroughput256, Batch, 10, 10000) {
+    encode_batch(encoder(), chunks().chunks256);
+}
+
+BASELINE(ChunkThroughput4K, Single, 10, 1000) {
+    encode_each(encoder(), chunks().chunks4K);
+}
+
+BENCHMARK(ChunkThroughput4K, Batch, 10, 1000) {
+    encode_batch(encoder(), chunks().chunks4K);
+}
@@ -0,0 +1,162 @@
+#include <gtest/gtest.h>
+
+#include <cocaine/context.hpp>
+#include <cocaine/context/config.hpp>
+#include <cocaine/detail/storage/journal.hpp>
+#include <cocaine/dynamic.hpp>
+
+#include <blackhole/handler.hpp>
+#include <blackhole/record.hpp>
+#include <blackhole/root.hpp>
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <cstdint>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace cocaine { namespace storage {
+namespace {
+
+namespace fs = boost::filesystem;
+
+// Size of the journal magic, which is followed by the records.
+const off_t kMagicSize = 8;
+
+std::unique_ptr<logging::logger_t>
+make_logger() {
+    std::unique_ptr<blackhole::root_logger_t> log(
+        new blackhole::root_logger_t(std::vector<std::unique_ptr<blackhole::handler_t>>()));
+
+    log->filter([](const blackhole::record_t&) -> bool {
+        return false;
+    });
+
+    return std::move(log);
+}
+
+class journal_test: public ::testing::Test {
+protected:
+    fs::path root;
+    fs::path path;
+
+    dynamic_t args;
+
+    std::unique_ptr<context_t> context;
+
+    void
+    SetUp() {
+        root = fs::temp_directory_path() / fs::unique_path("cocaine-journal-%%%%-%%%%");
+        path = root / "storage" / "journal";
+
+        fs::create_directories(root / "plugins");
+        fs::create_directories(root / "runtime");
+
+        const auto config_path = root / "cocaine.conf";
+
+        {
+            fs::ofstream stream(config_path);
+
+            stream << "{"
+                   << "\"version\": " << config_t::versions() << ","
+                   << "\"paths\": {"
+                   << "    \"plugins\": \"" << (root / "plugins").string() << "\","
+                   << "    \"runtime\": \"" << (root / "runtime").string() << "\""
+                   << "},"
+                   << "\"network\": {\"pool\": 1},"
+                   << "\"logging\": {\"loggers\": {}}"
+                   << "}";
+        }
+
+        context = make_context(make_config(config_path.string()), make_logger());
+
+        dynamic_t::object_t object;
+        object["path"] = (root / "storage").string();
+        args = object;
+
+        journal_t journal(*context, "journal", args);
+
+        for(auto key: {"a", "b", "c"}) {
+            journal.write("collection", key, std::string(64, *key), {"tag"}).get();
+        }
+    }
+
+    void
+    TearDown() {
+        context.reset();
+        fs::remove_all(root);
+    }
+
+    // Offsets of the records in the log.
+    std::vector<off_t>
+    records() const {
+        std::vector<off_t> result;
+
+        const auto size = static_cast<off_t>(fs::file_size(path));
+
+        for(off_t offset = kMagicSize; offset < size; ) {
+            result.push_back(offset);
+            offset += 2 * sizeof(std::uint32_t) + read_size(offset);
+        }
+
+        return result;
+    }
+
+    std::uint32_t
+    read_size(off_t offset) const {
+        std::uint32_t size = 0;
+
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        EXPECT_EQ(static_cast<ssize_t>(sizeof(size)), ::pread(fd, &size, sizeof(size), offset));
+        ::close(fd);
+
+        return size;
+    }
+
+    void
+    write_size(off_t offset, std::uint32_t size) const {
+        const int fd = ::open(path.c_str(), O_WRONLY);
+        EXPECT_EQ(static_cast<ssize_t>(sizeof(size)), ::pwrite(fd, &size, sizeof(size), offset));
+        ::close(fd);
+    }
+};
+
+TEST_F(journal_test, drops_torn_tail) {
+    const auto offsets = records();
+
+    ASSERT_EQ(3u, offsets.size());
+
+    // An append interrupted in the middle of the last record.
+    fs::resize_file(path, offsets[2] + 16);
+
+    journal_t journal(*context, "journal", args);
+
+    EXPECT_EQ(std::string(64, 'a'), journal.read("collection", "a").get());
+    EXPECT_EQ(std::string(64, 'b'), journal.read("collection", "b").get());
+    EXPECT_THROW(journal.read("collection", "c").get(), std::system_error);
+
+    EXPECT_EQ(static_cast<std::uintmax_t>(offsets[2]), fs::file_size(path));
+}
+
+TEST_F(journal_test, refuses_corrupted_size_in_the_middle) {
+    const auto offsets = records();
+    const auto size = fs::file_size(path);
+
+    ASSERT_EQ(3u, offsets.size());
+
+    // The record now seems to run past the end of the log, like a torn one would.
+    write_size(offsets[1], 1u << 30);
+
+    EXPECT_THROW(journal_t journal(*context, "journal", args), std::system_error);
+
+    // Nothing is dropped.
+    EXPECT_EQ(size, fs::file_size(path));
+}
+
+} // namespace
+}} // namespace cocaine::storage
@@ -0,0 +1,297 @@
+#include <gtest/gtest.h>
+
+#include <cocaine/context.hpp>
+#include <cocaine/context/config.hpp>
+#include <cocaine/context/quote.hpp>
+#include <cocaine/context/signal.hpp>
+#include <cocaine/detail/gateway/adhoc.hpp>
+#include <cocaine/dynamic.hpp>
+#include <cocaine/idl/context.hpp>
+#include <cocaine/memory.hpp>
+#include <cocaine/rpc/actor.hpp>
+#include <cocaine/rpc/dispatch.hpp>
+#include <cocaine/rpc/graph.hpp>
+
+#include <blackhole/handler.hpp>
+#include <blackhole/record.hpp>
+#include <blackhole/root.hpp>
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/optional/optional.hpp>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <signal.h>
+
+namespace cocaine {
+namespace {
+
+namespace fs = boost::filesystem;
+
+using asio::ip::address;
+using asio::ip::tcp;
+
+typedef std::vector<tcp::endpoint> endpoints_type;
+typedef std::tuple<endpoints_type, unsigned int, io::graph_root_t> meta_type;
+
+// Configuration with a hostname which can be changed on the fly, like /etc/hosts or DNS records
+// are changed under a running node.
+class hostname_config_t:
+    public config_t
+{
+    struct network_t:
+        public config_t::network_t
+    {
+        const config_t::network_t& base;
+        std::string hostname_;
+
+        network_t(const config_t::network_t& base_):
+            base(base_),
+            hostname_(base_.hostname())
+        { }
+
+        const ports_t&
+        ports() const {
+            return base.ports();
+        }
+
+        const std::string&
+        endpoint() const {
+            return base.endpoint();
+        }
+
+        const std::string&
+        hostname() const {
+            return hostname_;
+        }
+
+        size_t
+        pool() const {
+            return base.pool();
+        }
+    };
+
+    std::unique_ptr<config_t> base;
+    network_t m_network;
+
+public:
+    hostname_config_t(std::unique_ptr<config_t> base_):
+        base(std::move(base_)),
+        m_network(base->network())
+    { }
+
+    void
+    hostname(std::string value) {
+        m_network.hostname_ = std::move(value);
+    }
+
+    const network_t&
+    network() const {
+        return m_network;
+    }
+
+    const logging_t&
+    logging() const {
+        return base->logging();
+    }
+
+    const path_t&
+    path() const {
+        return base->path();
+    }
+
+    const component_group_t&
+    services() const {
+        return base->services();
+    }
+
+    const component_group_t&
+    storages() const {
+        return base->storages();
+    }
+
+    const component_group_t&
+    unicorns() const {
+        return base->unicorns();
+    }
+
+    const component_group_t&
+    component_group(const std::string& name) const {
+        return base->component_group(name);
+    }
+};
+
+std::unique_ptr<logging::logger_t>
+make_logger() {
+    std::unique_ptr<blackhole::root_logger_t> log(
+        new blackhole::root_logger_t(std::vector<std::unique_ptr<blackhole::handler_t>>()));
+
+    log->filter([](const blackhole::record_t&) -> bool {
+        return false;
+    });
+
+    return std::move(log);
+}
+
+class refresh_test: public ::testing::Test {
+protected:
+    fs::path root;
+
+    // Owned by the context.
+    hostname_config_t* config;
+
+    std::unique_ptr<context_t> context;
+
+    void
+    SetUp() {
+        root = fs::temp_directory_path() / fs::unique_path("cocaine-refresh-%%%%-%%%%");
+
+        fs::create_directories(root / "plugins");
+        fs::create_directories(root / "runtime");
+
+        const auto config_path = root / "cocaine.conf";
+
+        {
+            fs::ofstream stream(config_path);
+
+            // Services are bound to an unspecified address, so their endpoints are resolved from
+            // the hostname.
+            stream << "{"
+                   << "\"version\": " << config_t::versions() << ","
+                   << "\"paths\": {"
+                   << "    \"plugins\": \"" << (root / "plugins").string() << "\","
+                   << "    \"runtime\": \"" << (root / "runtime").string() << "\""
+                   << "},"
+                   << "\"network\": {\"endpoint\": \"0.0.0.0\", \"hostname\": \"127.0.0.1\", \"pool\": 1},"
+                   << "\"logging\": {\"loggers\": {}}"
+                   << "}";
+        }
+
+        config = new hostname_config_t(make_config(config_path.string()));
+        context = make_context(std::unique_ptr<config_t>(config), make_logger());
+    }
+
+    void
+    TearDown() {
+        context.reset();
+        fs::remove_all(root);
+    }
+
+    // Polls the subscriber event loop until the condition holds, the context signals from its own
+    // threads.
+    static
+    bool
+    wait(asio::io_service& asio, const std::function<bool()>& condition,
+         std::chrono::milliseconds timeout = std::chrono::milliseconds(5000))
+    {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+        do {
+            asio.poll();
+            asio.reset();
+
+            if(condition()) {
+                return true;
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        } while(std::chrono::steady_clock::now() < deadline);
+
+        return false;
+    }
+};
+
+TEST_F(refresh_test, signals_updated_endpoints) {
+    context->insert("echo", std::make_unique<actor_t>(*context, std::make_shared<asio::io_service>(),
+        std::make_unique<dispatch<io::context_tag>>("echo")));
+
+    const auto port = context->locate("echo")->endpoints.at(0).port();
+
+    const endpoints_type before{tcp::endpoint(address::from_string("127.0.0.1"), port)};
+    const endpoints_type after {tcp::endpoint(address::from_string("127.0.0.2"), port)};
+
+    ASSERT_EQ(before, context->locate("echo")->endpoints);
+
+    asio::io_service asio;
+
+    std::vector<endpoints_type> exposed;
+    std::vector<endpoints_type> updated;
+
+    auto slot = std::make_shared<dispatch<io::context_tag>>("test");
+
+    slot->on<io::context::service::exposed>([&](const std::string& name, const meta_type& meta) {
+        if(name == "echo") exposed.push_back(std::get<0>(meta));
+    });
+
+    slot->on<io::context::service::updated>([&](const std::string& name, const meta_type& meta) {
+        if(name == "echo") updated.push_back(std::get<0>(meta));
+    });
+
+    context->signal_hub().listen(slot, asio);
+
+    ASSERT_TRUE(wait(asio, [&] { return exposed.size() == 1; }));
+    EXPECT_EQ(before, exposed.back());
+
+    config->hostname("127.0.0.2");
+    context->signal_hub().invoke<io::context::os_signal>(SIGHUP, siginfo_t());
+
+    ASSERT_TRUE(wait(asio, [&] { return updated.size() == 1; }));
+    EXPECT_EQ(after, updated.back());
+
+    // The service is never exposed twice.
+    EXPECT_EQ(1u, exposed.size());
+    EXPECT_EQ(after, context->locate("echo")->endpoints);
+
+    // Nothing changes on a refresh without any endpoint changes.
+    context->signal_hub().invoke<io::context::os_signal>(SIGHUP, siginfo_t());
+
+    EXPECT_FALSE(wait(asio, [&] { return updated.size() > 1; }, std::chrono::milliseconds(200)));
+
+    // Late subscribers only see the service exposed with its current endpoints.
+    asio::io_service late_asio;
+
+    std::vector<endpoints_type> late;
+
+    auto late_slot = std::make_shared<dispatch<io::context_tag>>("late");
+
+    late_slot->on<io::context::service::exposed>([&](const std::string& name, const meta_type& meta) {
+        if(name == "echo") late.push_back(std::get<0>(meta));
+    });
+
+    late_slot->on<io::context::service::updated>([&](const std::string& name, const meta_type&) {
+        if(name == "echo") ADD_FAILURE() << "update replayed to a late subscriber";
+    });
+
+    context->signal_hub().listen(late_slot, late_asio);
+
+    ASSERT_TRUE(wait(late_asio, [&] { return late.size() == 1; }));
+    EXPECT_EQ(after, late.back());
+}
+
+TEST_F(refresh_test, gateway_replaces_updated_services) {
+    gateway::adhoc_t gateway(*context, "local", "adhoc", dynamic_t::empty_object);
+
+    const endpoints_type before{tcp::endpoint(address::from_string("10.0.0.1"), 10053)};
+    const endpoints_type after {tcp::endpoint(address::from_string("10.0.0.2"), 10053)};
+
+    gateway.consume("remote", "echo", 1, before, io::graph_root_t());
+
+    EXPECT_EQ(before, gateway.resolve("echo").endpoints);
+
+    std::map<std::string, api::gateway_t::service_description_t> services;
+    services["echo"] = api::gateway_t::service_description_t{after, io::graph_root_t(), 1};
+
+    ASSERT_NO_THROW(gateway.update("remote", services));
+
+    EXPECT_EQ(after, gateway.resolve("echo").endpoints);
+    EXPECT_EQ(1u, gateway.total_count("echo"));
+}
+
+} // namespace
+} // namespace cocaine
@@ -0,0 +1,258 @@
+#include <gtest/gtest.h>
+
+#include <cocaine/detail/cluster/swim.hpp>
+
+#include <algorithm>
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace cocaine { namespace cluster { namespace swim {
+namespace {
+
+using asio::ip::address;
+using asio::ip::tcp;
+using asio::ip::udp;
+
+using std::chrono::milliseconds;
+
+// A cluster of membership state machines talking to each other through an in-memory network with
+// simulated time. Every message goes through the wire encoding.
+class simulation_t {
+    struct datagram_t {
+        udp::endpoint from;
+        udp::endpoint to;
+        std::string payload;
+    };
+
+    struct node_t {
+        std::unique_ptr<membership_t> membership;
+
+        // Nodes as reported via the alive and dead handlers.
+        std::set<std::string> linked;
+    };
+
+    std::vector<node_t> m_nodes;
+    std::deque<datagram_t> m_network;
+    std::set<size_t> m_isolated;
+
+    // Size of the largest datagram sent so far.
+    size_t m_largest;
+
+public:
+    membership_t::time_point now;
+
+    explicit
+    simulation_t(size_t size, size_t endpoints = 1):
+        m_nodes(size),
+        m_largest(0),
+        now(membership_t::clock_type::now())
+    {
+        membership_cfg_t cfg;
+
+        cfg.interval   = milliseconds(1000);
+        cfg.timeout    = milliseconds(300);
+        cfg.indirect   = 3;
+        cfg.suspicion  = 3;
+        cfg.retransmit = 3;
+        cfg.piggyback  = 8;
+        cfg.sync       = 10;
+        cfg.seeds      = {gossip(0)};
+
+        for(size_t i = 0; i < size; ++i) {
+            update_t self;
+
+            self.uuid        = uuid(i);
+            self.gossip      = gossip(i);
+            self.endpoints   = {tcp::endpoint(address::from_string("127.0.0.1"), 10053 + i)};
+
+            // Multihomed nodes also have a bunch of IPv6 endpoints, which make their updates larger.
+            for(size_t j = 1; j < endpoints; ++j) {
+                self.endpoints.emplace_back(address::from_string(
+                    "2001:db8:" + std::to_string(j) + "::" + std::to_string(i)), 10053 + i);
+            }
+
+            self.incarnation = 1;
+            self.state       = states::alive;
+
+            membership_t::handlers_t handlers;
+
+            handlers.send = [this, i](const udp::endpoint& target, const message_t& message) {
+                m_network.push_back(datagram_t{gossip(i), target, encode(message)});
+                m_largest = std::max(m_largest, m_network.back().payload.size());
+            };
+
+            handlers.alive = [this, i](const std::string& uuid, const std::vector<tcp::endpoint>&) {
+                m_nodes[i].linked.insert(uuid);
+            };
+
+            handlers.dead = [this, i](const std::string& uuid) {
+                m_nodes[i].linked.erase(uuid);
+            };
+
+            m_nodes[i].membership.reset(new membership_t(cfg, self, handlers, now));
+        }
+    }
+
+    static
+    std::string
+    uuid(size_t i) {
+        return "node-" + std::to_string(i);
+    }
+
+    static
+    udp::endpoint
+    gossip(size_t i) {
+        return udp::endpoint(address::from_string("127.0.0.1"), 20000 + i);
+    }
+
+    const std::set<std::string>&
+    linked(size_t i) const {
+        return m_nodes[i].linked;
+    }
+
+    size_t
+    largest() const {
+        return m_largest;
+    }
+
+    void
+    isolate(size_t i) {
+        m_isolated.insert(i);
+    }
+
+    void
+    heal(size_t i) {
+        m_isolated.erase(i);
+    }
+
+    void
+    run(milliseconds duration) {
+        const auto step = milliseconds(50);
+
+        for(auto elapsed = milliseconds(0); elapsed < duration; elapsed += step) {
+            now += step;
+
+            for(size_t i = 0; i < m_nodes.size(); ++i) {
+                if(!m_isolated.count(i)) {
+                    m_nodes[i].membership->tick(now);
+                }
+            }
+
+            deliver();
+        }
+    }
+
+private:
+    void
+    deliver() {
+        while(!m_network.empty()) {
+            const auto datagram = m_network.front();
+            m_network.pop_front();
+
+            const size_t from = datagram.from.port() - 20000;
+            const size_t to   = datagram.to.port() - 20000;
+
+            if(to >= m_nodes.size() || m_isolated.count(from) || m_isolated.count(to)) {
+                continue;
+            }
+
+            message_t message;
+            ASSERT_TRUE(decode(datagram.payload.data(), datagram.payload.size(), message));
+
+            m_nodes[to].membership->receive(datagram.from, message, now);
+        }
+    }
+};
+
+TEST(swim, encoding) {
+    message_t message{message_t::types::ping_req, 42, simulation_t::gossip(1), {
+        update_t{"node-0", simulation_t::gossip(0), {}, 7, states::suspect}
+    }};
+
+    const auto payload = encode(message);
+
+    message_t result;
+    ASSERT_TRUE(decode(payload.data(), payload.size(), result));
+
+    EXPECT_EQ(message_t::types::ping_req, result.type);
+    EXPECT_EQ(42u, result.seq);
+    EXPECT_EQ(simulation_t::gossip(1), result.target);
+    ASSERT_EQ(1u, result.updates.size());
+    EXPECT_EQ("node-0", result.updates[0].uuid);
+    EXPECT_EQ(7u, result.updates[0].incarnation);
+    EXPECT_EQ(states::suspect, result.updates[0].state);
+
+    EXPECT_FALSE(decode(payload.data(), payload.size() / 2, result));
+}
+
+TEST(swim, converges_through_seed) {
+    const size_t size = 8;
+
+    simulation_t simulation(size);
+    simulation.run(milliseconds(10000));
+
+    for(size_t i = 0; i < size; ++i) {
+        EXPECT_EQ(size - 1, simulation.linked(i).size()) << "node " << i;
+    }
+}
+
+TEST(swim, detects_failures) {
+    const size_t size = 8;
+
+    simulation_t simulation(size);
+    simulation.run(milliseconds(10000));
+
+    simulation.isolate(5);
+    simulation.run(milliseconds(60000));
+
+    for(size_t i = 0; i < size; ++i) {
+        if(i == 5) {
+            continue;
+        }
+
+        EXPECT_EQ(size - 2, simulation.linked(i).size()) << "node " << i;
+        EXPECT_FALSE(simulation.linked(i).count(simulation_t::uuid(5))) << "node " << i;
+    }
+}
+
+TEST(swim, heals_after_isolation) {
+    const size_t size = 8;
+
+    // Heal both while the others still keep the tombstone of the isolated node and after they've
+    // forgotten it. The isolated node is not a seed, so it can only rejoin via anti-entropy.
+    for(auto duration: {milliseconds(20000), milliseconds(60000)}) {
+        simulation_t simulation(size);
+        simulation.run(milliseconds(10000));
+
+        simulation.isolate(5);
+        simulation.run(duration);
+
+        ASSERT_FALSE(simulation.linked(0).count(simulation_t::uuid(5)));
+
+        simulation.heal(5);
+        simulation.run(milliseconds(60000));
+
+        for(size_t i = 0; i < size; ++i) {
+            EXPECT_EQ(size - 1, simulation.linked(i).size()) << "node " << i << " after " << duration.count() << "ms";
+        }
+    }
+}
+
+TEST(swim, splits_large_snapshots) {
+    const size_t size = 200;
+
+    // Snapshots of this many multihomed nodes are way larger than a single datagram.
+    simulation_t simulation(size, 4);
+    simulation.run(milliseconds(45000));
+
+    for(size_t i = 0; i < size; ++i) {
+        EXPECT_EQ(size - 1, simulation.linked(i).size()) << "node " << i;
+    }
+
+    EXPECT_LE(simulation.largest(), max_datagram_size);
+}
+
+} // namespace
+}}} // namespace cocaine::cluster::swim
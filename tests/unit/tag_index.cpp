@@ -0,0 +1,182 @@
+#include <gtest/gtest.h>
+
+#include <cocaine/detail/storage/index.hpp>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace cocaine { namespace storage {
+namespace {
+
+namespace fs = boost::filesystem;
+
+typedef std::vector<std::string> keys_type;
+
+class tag_index_test: public ::testing::Test {
+protected:
+    fs::path root;
+    fs::path path;
+
+    void
+    SetUp() {
+        root = fs::temp_directory_path() / fs::unique_path("cocaine-index-%%%%-%%%%");
+        path = root / ".index";
+
+        fs::create_directories(root);
+    }
+
+    void
+    TearDown() {
+        fs::remove_all(root);
+    }
+
+    static
+    void
+    sync(int, const fs::path&) { }
+};
+
+TEST_F(tag_index_test, intersects_tags) {
+    tag_index_t index(path, &sync);
+
+    EXPECT_FALSE(index.exists());
+
+    index.insert("a", {"group", "active"});
+    index.insert("b", {"group"});
+    index.insert("c", {"active", "group", "group"});
+
+    EXPECT_TRUE(index.exists());
+    EXPECT_EQ(3u, index.size());
+
+    EXPECT_EQ((keys_type{"a", "b", "c"}), index.find({"group"}));
+    EXPECT_EQ((keys_type{"a", "c"}), index.find({"group", "active"}));
+    EXPECT_EQ(keys_type{}, index.find({"group", "missing"}));
+    EXPECT_EQ(keys_type{}, index.find({}));
+
+    EXPECT_EQ((keys_type{"active", "group"}), index.tags("c"));
+    EXPECT_EQ(keys_type{}, index.tags("missing"));
+
+    index.insert("a", {"group"});
+    index.erase("c");
+
+    EXPECT_EQ(keys_type{}, index.tags("c"));
+    EXPECT_EQ((std::map<std::string, keys_type>{{"a", {"group"}}, {"b", {"group"}}}), index.objects());
+
+    EXPECT_EQ(keys_type{}, index.find({"active"}));
+    EXPECT_EQ((keys_type{"a", "b"}), index.find({"group"}));
+}
+
+TEST_F(tag_index_test, survives_reopening) {
+    {
+        tag_index_t index(path, &sync);
+
+        index.insert("a", {"x", "y"});
+        index.insert("b", {"y"});
+        index.insert("a", {"x"});
+        index.erase("b");
+        index.insert("c", {"y"});
+    }
+
+    tag_index_t index(path, &sync);
+
+    EXPECT_TRUE(index.exists());
+    EXPECT_EQ(2u, index.size());
+    EXPECT_EQ(keys_type{"a"}, index.find({"x"}));
+    EXPECT_EQ(keys_type{"c"}, index.find({"y"}));
+}
+
+TEST_F(tag_index_test, drops_torn_tail) {
+    {
+        tag_index_t index(path, &sync);
+
+        index.insert("a", {"x"});
+        index.insert("b", {"x"});
+    }
+
+    // Simulate a crash in the middle of appending the last record.
+    fs::resize_file(path, fs::file_size(path) - 3);
+
+    {
+        tag_index_t index(path, &sync);
+
+        EXPECT_EQ(keys_type{"a"}, index.find({"x"}));
+
+        index.insert("c", {"x"});
+    }
+
+    tag_index_t index(path, &sync);
+
+    EXPECT_EQ((keys_type{"a", "c"}), index.find({"x"}));
+}
+
+TEST_F(tag_index_test, compacts_log) {
+    tag_index_t index(path, &sync);
+
+    index.insert("a", {"x"});
+
+    for(int i = 0; i < 10000; ++i) {
+        index.insert("b", {i % 2 ? "x" : "y"});
+    }
+
+    // Otherwise the log would have grown to over 200KB.
+    EXPECT_LT(fs::file_size(path), 64 * 1024u);
+    EXPECT_EQ((keys_type{"a", "b"}), index.find({"x"}));
+
+    tag_index_t reopened(path, &sync);
+
+    EXPECT_EQ((keys_type{"a", "b"}), reopened.find({"x"}));
+    EXPECT_EQ(keys_type{}, reopened.find({"y"}));
+}
+
+TEST_F(tag_index_test, resets_contents) {
+    tag_index_t index(path, &sync);
+
+    index.insert("a", {"x"});
+    index.reset({{"b", {"y"}}, {"c", {"x", "y"}}});
+
+    EXPECT_EQ(keys_type{"c"}, index.find({"x"}));
+
+    tag_index_t reopened(path, &sync);
+
+    EXPECT_EQ((keys_type{"b", "c"}), reopened.find({"y"}));
+}
+
+TEST_F(tag_index_test, records_clean_close) {
+    {
+        tag_index_t index(path, &sync);
+
+        index.insert("a", {"x"});
+        index.close();
+    }
+
+    {
+        tag_index_t index(path, &sync);
+
+        EXPECT_TRUE(index.clean());
+        EXPECT_EQ(keys_type{"a"}, index.find({"x"}));
+
+        // Updated, but never closed, like after a crash.
+        index.insert("b", {"x"});
+    }
+
+    {
+        tag_index_t index(path, &sync);
+
+        EXPECT_FALSE(index.clean());
+        EXPECT_EQ((keys_type{"a", "b"}), index.find({"x"}));
+
+        index.taint();
+        index.close();
+    }
+
+    tag_index_t index(path, &sync);
+
+    EXPECT_FALSE(index.clean());
+}
+
+} // namespace
+}} // namespace cocaine::storage
@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+
+#include <cocaine/detail/timing_wheel.hpp>
+
+#include <string>
+#include <vector>
+
+namespace cocaine {
+namespace {
+
+typedef timing_wheel<std::string> wheel_type;
+
+using std::chrono::milliseconds;
+
+struct collector_t {
+    std::vector<std::string>* expired;
+
+    void
+    operator()(const std::string& key) const {
+        expired->push_back(key);
+    }
+};
+
+TEST(timing_wheel, expires_at_deadline) {
+    const auto origin = wheel_type::clock_type::now();
+
+    wheel_type wheel(milliseconds(10), 8, origin);
+    std::vector<std::string> expired;
+
+    wheel.schedule("a", origin + milliseconds(25));
+    wheel.schedule("b", origin + milliseconds(200));
+
+    wheel.advance(origin + milliseconds(20), collector_t{&expired});
+    EXPECT_TRUE(expired.empty());
+
+    wheel.advance(origin + milliseconds(30), collector_t{&expired});
+    ASSERT_EQ(1u, expired.size());
+    EXPECT_EQ("a", expired[0]);
+    EXPECT_FALSE(wheel.contains("a"));
+
+    // Longer than a full round of the wheel.
+    wheel.advance(origin + milliseconds(190), collector_t{&expired});
+    EXPECT_EQ(1u, expired.size());
+
+    wheel.advance(origin + milliseconds(200), collector_t{&expired});
+    ASSERT_EQ(2u, expired.size());
+    EXPECT_EQ("b", expired[1]);
+    EXPECT_EQ(0u, wheel.size());
+}
+
+TEST(timing_wheel, reschedule) {
+    const auto origin = wheel_type::clock_type::now();
+
+    wheel_type wheel(milliseconds(10), 4, origin);
+    std::vector<std::string> expired;
+
+    wheel.schedule("a", origin + milliseconds(20));
+    wheel.schedule("b", origin + milliseconds(100));
+
+    // Postpone one key and bring the other one forward.
+    wheel.schedule("a", origin + milliseconds(90));
+    wheel.schedule("b", origin + milliseconds(30));
+
+    wheel.advance(origin + milliseconds(30), collector_t{&expired});
+    ASSERT_EQ(1u, expired.size());
+    EXPECT_EQ("b", expired[0]);
+
+    wheel.advance(origin + milliseconds(80), collector_t{&expired});
+    EXPECT_EQ(1u, expired.size());
+
+    wheel.advance(origin + milliseconds(90), collector_t{&expired});
+    ASSERT_EQ(2u, expired.size());
+    EXPECT_EQ("a", expired[1]);
+}
+
+TEST(timing_wheel, erase) {
+    const auto origin = wheel_type::clock_type::now();
+
+    wheel_type wheel(milliseconds(10), 4, origin);
+    std::vector<std::string> expired;
+
+    wheel.schedule("a", origin + milliseconds(20));
+    wheel.erase("a");
+
+    wheel.advance(origin + milliseconds(1000), collector_t{&expired});
+    EXPECT_TRUE(expired.empty());
+    EXPECT_EQ(0u, wheel.size());
+}
+
+} // namespace
+} // namespace cocaine
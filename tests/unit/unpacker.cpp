@@ -0,0 +1,157 @@
+#include <gtest/gtest.h>
+
+#include <cocaine/rpc/unpacker.hpp>
+#include <cocaine/traits/tuple.hpp>
+#include <cocaine/traits/vector.hpp>
+
+#include <cocaine/idl/locator.hpp>
+#include <cocaine/idl/storage.hpp>
+
+#include <chrono>
+
+namespace cocaine {
+namespace {
+
+typedef boost::mpl::list<
+    std::string,
+    unsigned int,
+    int,
+    io::optional_with_default<unsigned int, 42>,
+    io::optional<bool>
+>::type sequence_type;
+
+typedef io::tuple::fold<sequence_type>::type tuple_type;
+
+struct unpacked_t {
+    template<class... Args>
+    explicit
+    unpacked_t(const Args&... args) {
+        msgpack::packer<msgpack::sbuffer> packer(buffer);
+
+        packer.pack_array(sizeof...(args));
+        pack(packer, args...);
+
+        msgpack::unpack(&unpacked, buffer.data(), buffer.size());
+    }
+
+    const msgpack::object&
+    get() const {
+        return unpacked.get();
+    }
+
+private:
+    static
+    void
+    pack(msgpack::packer<msgpack::sbuffer>&) { }
+
+    template<class T, class... Args>
+    static
+    void
+    pack(msgpack::packer<msgpack::sbuffer>& packer, const T& value, const Args&... args) {
+        io::type_traits<T>::pack(packer, value);
+        pack(packer, args...);
+    }
+
+    msgpack::sbuffer buffer;
+    msgpack::unpacked unpacked;
+};
+
+template<class Sequence, class Tuple>
+bool
+generic(const msgpack::object& source, Tuple& target) {
+    try {
+        io::type_traits<Sequence>::unpack(source, target);
+    } catch(const msgpack::type_error&) {
+        return false;
+    }
+
+    return true;
+}
+
+TEST(unpacker, full) {
+    unpacked_t object(std::string("service"), 1u, -1, 2u, true);
+
+    tuple_type actual, expected;
+
+    EXPECT_FALSE(io::unpacker<sequence_type>::unpack(object.get(), actual));
+    EXPECT_TRUE(generic<sequence_type>(object.get(), expected));
+    EXPECT_EQ(expected, actual);
+    EXPECT_EQ(std::make_tuple(std::string("service"), 1u, -1, 2u, true), actual);
+}
+
+TEST(unpacker, optional) {
+    unpacked_t object(std::string("service"), 1u, -1);
+
+    tuple_type actual, expected;
+
+    EXPECT_FALSE(io::unpacker<sequence_type>::unpack(object.get(), actual));
+    EXPECT_TRUE(generic<sequence_type>(object.get(), expected));
+    EXPECT_EQ(expected, actual);
+    EXPECT_EQ(std::make_tuple(std::string("service"), 1u, -1, 42u, false), actual);
+}
+
+TEST(unpacker, malformed) {
+    tuple_type target;
+
+    // Not enough arguments.
+    EXPECT_EQ(error::invalid_argument,
+        io::unpacker<sequence_type>::unpack(unpacked_t(std::string("service"), 1u).get(), target));
+
+    // Type mismatch.
+    EXPECT_EQ(error::invalid_argument,
+        io::unpacker<sequence_type>::unpack(unpacked_t(1u, 1u, -1).get(), target));
+
+    // Negative value for an unsigned element.
+    EXPECT_EQ(error::invalid_argument,
+        io::unpacker<sequence_type>::unpack(unpacked_t(std::string("service"), -1, -1).get(), target));
+
+    // Value out of range.
+    EXPECT_EQ(error::invalid_argument,
+        io::unpacker<sequence_type>::unpack(unpacked_t(std::string("service"), 1ull << 32, -1).get(), target));
+}
+
+TEST(unpacker, vector) {
+    typedef io::event_traits<io::storage::find>::argument_type find_type;
+
+    unpacked_t object(std::string("collection"), std::vector<std::string>({"a", "b", "c"}));
+
+    io::tuple::fold<find_type>::type actual, expected;
+
+    EXPECT_FALSE(io::unpacker<find_type>::unpack(object.get(), actual));
+    EXPECT_TRUE(generic<find_type>(object.get(), expected));
+    EXPECT_EQ(expected, actual);
+}
+
+TEST(unpacker, throughput) {
+    typedef io::event_traits<io::locator::resolve>::argument_type resolve_type;
+
+    const size_t iterations = 100000;
+
+    unpacked_t object(std::string("storage"), std::string("seed"));
+
+    io::tuple::fold<resolve_type>::type target;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for(size_t i = 0; i < iterations; ++i) {
+        ASSERT_FALSE(io::unpacker<resolve_type>::unpack(object.get(), target));
+    }
+
+    auto specialized = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+
+    for(size_t i = 0; i < iterations; ++i) {
+        ASSERT_TRUE(generic<resolve_type>(object.get(), target));
+    }
+
+    auto baseline = std::chrono::steady_clock::now() - start;
+
+    RecordProperty("specialized_us",
+        static_cast<int>(std::chrono::duration_cast<std::chrono::microseconds>(specialized).count()));
+    RecordProperty("generic_us",
+        static_cast<int>(std::chrono::duration_cast<std::chrono::microseconds>(baseline).count()));
+}
+
+} // namespace
+} // namespace cocaine